@@ -9,6 +9,8 @@ expr
     | (ADD | SUB) expr  # UnaryOp
     | expr (MUL | DIV) expr  # BinaryOp
     | expr (ADD | SUB) expr  # BinaryOp
+    | NAME '(' expr (',' expr)* ')'  # Function
+    | CELL ':' CELL  # Range
     | CELL  # Cell
     | NUMBER  # Literal
     ;
@@ -27,4 +29,5 @@ SUB: '-' ;
 MUL: '*' ;
 DIV: '/' ;
 CELL: [A-Z]+[0-9]+ ;
+NAME: [A-Z]+ ;
 WS: [ \t\n\r]+ -> skip ;
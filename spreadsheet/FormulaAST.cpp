@@ -4,11 +4,16 @@
 #include "FormulaLexer.h"
 #include "FormulaParser.h"
 
+#include <algorithm>
 #include <cassert>
+#include <charconv>
 #include <cmath>
+#include <cstdlib>
+#include <iterator>
 #include <memory>
 #include <optional>
 #include <sstream>
+#include <string_view>
 #include <limits>
 
 
@@ -73,13 +78,19 @@ class Expr {
 public:
     virtual ~Expr() = default;
     virtual void Print(std::ostream& out) const = 0;
-    virtual void DoPrintFormula(std::ostream& out, ExprPrecedence precedence) const = 0;
-    virtual double Evaluate(const SheetInterface &sheet) const = 0;
+    // Ссылки печатаются сдвинутыми на offset
+    virtual void DoPrintFormula(std::ostream& out, ExprPrecedence precedence, PositionOffset offset) const = 0;
+    virtual void Compile(FormulaProgram& program) const = 0;
+
+    // Аргумент-диапазон функция читает целиком, а не как число
+    virtual const CellRange* AsRange() const {
+        return nullptr;
+    }
 
     // higher is tighter
     virtual ExprPrecedence GetPrecedence() const = 0;
 
-    void PrintFormula(std::ostream& out, ExprPrecedence parent_precedence,
+    void PrintFormula(std::ostream& out, ExprPrecedence parent_precedence, PositionOffset offset,
                       bool right_child = false) const {
         auto precedence = GetPrecedence();
         auto mask = right_child ? PR_RIGHT : PR_LEFT;
@@ -88,7 +99,7 @@ public:
             out << '(';
         }
 
-        DoPrintFormula(out, precedence);
+        DoPrintFormula(out, precedence, offset);
 
         if (parens_needed) {
             out << ')';
@@ -122,10 +133,10 @@ public:
         out << ')';
     }
 
-    void DoPrintFormula(std::ostream& out, ExprPrecedence precedence) const override {
-        lhs_->PrintFormula(out, precedence);
+    void DoPrintFormula(std::ostream& out, ExprPrecedence precedence, PositionOffset offset) const override {
+        lhs_->PrintFormula(out, precedence, offset);
         out << static_cast<char>(type_);
-        rhs_->PrintFormula(out, precedence, /* right_child = */ true);
+        rhs_->PrintFormula(out, precedence, offset, /* right_child = */ true);
     }
 
     ExprPrecedence GetPrecedence() const override {
@@ -145,36 +156,26 @@ public:
         }
     }
 
-    double Evaluate(const SheetInterface &sheet) const override {
-        using namespace std::literals;
-        double lhs_value = lhs_->Evaluate(sheet);
-        double rhs_value = rhs_->Evaluate(sheet);
-        double result = 0.0;
+    void Compile(FormulaProgram& program) const override {
+        lhs_->Compile(program);
+        rhs_->Compile(program);
         switch (type_) {
             case Add:
-                result = lhs_value + rhs_value;
+                program.EmitOperation(FormulaProgram::OpCode::Add);
                 break;
             case Subtract:
-                result = lhs_value - rhs_value;
+                program.EmitOperation(FormulaProgram::OpCode::Subtract);
                 break;
             case Multiply:
-                result = lhs_value * rhs_value;
+                program.EmitOperation(FormulaProgram::OpCode::Multiply);
                 break;
             case Divide:
-                if(rhs_value == 0.0)
-                {
-                    throw FormulaException("You can't devide by 0");
-                }
-                result = lhs_value / rhs_value;
+                program.EmitOperation(FormulaProgram::OpCode::Divide);
                 break;
             default:
+                assert(false);
                 break;
         }
-       if(std::isinf(result))
-       {
-            throw FormulaException("Infinity");
-       }
-        return result;
     }
 
 private:
@@ -202,29 +203,20 @@ public:
         out << ')';
     }
 
-    void DoPrintFormula(std::ostream& out, ExprPrecedence precedence) const override {
+    void DoPrintFormula(std::ostream& out, ExprPrecedence precedence, PositionOffset offset) const override {
         out << static_cast<char>(type_);
-        operand_->PrintFormula(out, precedence);
+        operand_->PrintFormula(out, precedence, offset);
     }
 
     ExprPrecedence GetPrecedence() const override {
         return EP_UNARY;
     }
 
-    double Evaluate(const SheetInterface &sheet) const override {
-        double value = operand_->Evaluate(sheet);
-        double result = 0.0;
-        switch (type_) {
-            case UnaryPlus:
-                result = value;
-                break;
-            case UnaryMinus:
-                result = value * (-1.0);
-                break;
-            default:
-                break;
+    void Compile(FormulaProgram& program) const override {
+        operand_->Compile(program);
+        if (type_ == UnaryMinus) {
+            program.EmitOperation(FormulaProgram::OpCode::Negate);
         }
-        return result;
     }
 
 private:
@@ -239,62 +231,142 @@ public:
     }
 
     void Print(std::ostream& out) const override {
-        if (!cell_->IsValid()) {
+        PrintCell(out, *cell_);
+    }
+
+    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */, PositionOffset offset) const override {
+        PrintCell(out, offset.Apply(*cell_));
+    }
+
+    ExprPrecedence GetPrecedence() const override {
+        return EP_ATOM;
+    }
+
+    void Compile(FormulaProgram& program) const override {
+        program.EmitCell(*cell_);
+    }
+
+private:
+    const Position* cell_;
+
+    static void PrintCell(std::ostream& out, Position cell) {
+        if (!cell.IsValid()) {
             out << FormulaError(FormulaError::Category::Ref);
         } else {
-            out << cell_->ToString();
+            out << cell.ToString();
         }
     }
+};
+
+class RangeExpr final : public Expr {
+public:
+    explicit RangeExpr(CellRange range)
+        : range_(range) {
+    }
+
+    void Print(std::ostream& out) const override {
+        out << range_.ToString();
+    }
 
-    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */) const override {
-        Print(out);
+    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */, PositionOffset offset) const override {
+        out << offset.Apply(range_).ToString();
     }
 
     ExprPrecedence GetPrecedence() const override {
         return EP_ATOM;
     }
 
-    double Evaluate(const SheetInterface &sheet) const override {
-        if(sheet.GetCell(*cell_) == nullptr)
-        {
-            return 0;
+    void Compile(FormulaProgram& program) const override {
+        program.EmitRange(range_);
+    }
+
+    const CellRange* AsRange() const override {
+        return &range_;
+    }
+
+private:
+    CellRange range_;
+};
+
+class FunctionExpr final : public Expr {
+public:
+    using Function = FormulaProgram::Function;
+
+    explicit FunctionExpr(Function function, std::vector<std::unique_ptr<Expr>> args)
+        : function_(function)
+        , args_(std::move(args)) {
+    }
+
+    static std::optional<Function> FromName(std::string_view name) {
+        for (Function function : {Function::Sum, Function::Average, Function::Min, Function::Max,
+                                  Function::Count}) {
+            if (GetName(function) == name) {
+                return function;
+            }
         }
-        auto value = sheet.GetCell(*cell_)->GetValue();
-        double temp_value = 0.0;
-        if(std::holds_alternative<double>(value))
-        {
-            temp_value = std::get<double>(value);
+        return std::nullopt;
+    }
+
+    static std::string_view GetName(Function function) {
+        switch (function) {
+            case Function::Sum:
+                return "SUM";
+            case Function::Average:
+                return "AVERAGE";
+            case Function::Min:
+                return "MIN";
+            case Function::Max:
+                return "MAX";
+            case Function::Count:
+                return "COUNT";
         }
-        else if(std::holds_alternative<std::string>(value)) {
-            if(std::get<std::string>(value).size() == 0)
-            {
-                return temp_value = 0.0;
-            }
-            else {
-                try
-                {
-                    size_t pos = 0;
-                    temp_value = std::stod(std::get<std::string>(value), &pos);
-                    if(pos != std::get<std::string>(value).size())
-                    {
-                        throw FormulaError(FormulaError::Category::Value);
-                    }
-                }
-                catch(...)
-                {
-                    throw FormulaError(FormulaError::Category::Value);
-                }
+        assert(false);
+        return "";
+    }
+
+    void Print(std::ostream& out) const override {
+        out << '(' << GetName(function_);
+        for (const auto& arg : args_) {
+            out << ' ';
+            arg->Print(out);
+        }
+        out << ')';
+    }
+
+    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */, PositionOffset offset) const override {
+        out << GetName(function_) << '(';
+        bool first = true;
+        for (const auto& arg : args_) {
+            if (!first) {
+                out << ',';
             }
+            first = false;
+            // Аргументы разделены запятыми, скобки вокруг них не нужны
+            arg->PrintFormula(out, EP_ADD, offset);
         }
-        else
-        {
-            throw std::get<FormulaError>(value);
+        out << ')';
+    }
+
+    ExprPrecedence GetPrecedence() const override {
+        return EP_ATOM;
+    }
+
+    void Compile(FormulaProgram& program) const override {
+        program.EmitBeginCall(function_);
+        for (const auto& arg : args_) {
+            if (const CellRange* range = arg->AsRange()) {
+                program.EmitAccumulateRange(*range);
+            } else {
+                arg->Compile(program);
+                program.EmitAccumulateValue();
+            }
         }
-        return temp_value;
+        program.EmitEndCall();
     }
 
 private:
-    const Position* cell_;
+    Function function_;
+    std::vector<std::unique_ptr<Expr>> args_;
 };
 
 class NumberExpr final : public Expr {
@@ -307,7 +379,7 @@ public:
         out << value_;
     }
 
-    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */) const override {
+    void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */, PositionOffset /* offset */) const override {
         out << value_;
     }
 
@@ -315,15 +387,64 @@ public:
         return EP_ATOM;
     }
 
-// Для чисел метод возвращает значение числа.
-    double Evaluate(const SheetInterface &sheet) const override {
-        return value_;
+    void Compile(FormulaProgram& program) const override {
+        program.EmitNumber(value_);
     }
 
 private:
     double value_;
 };
 
+// Общая для обоих разборщиков часть: проверка ссылок и учёт ячеек и
+// диапазонов формулы
+class ReferenceCollector {
+public:
+    std::unique_ptr<Expr> MakeCell(std::string_view text) {
+        auto value = Position::FromString(text);
+        if (!value.IsValid()) {
+            throw FormulaException("Invalid position: " + std::string(text));
+        }
+
+        cells_.push_front(value);
+        return std::make_unique<CellExpr>(&cells_.front());
+    }
+
+    std::unique_ptr<Expr> MakeRange(std::string_view first_text, std::string_view last_text) {
+        auto first = Position::FromString(first_text);
+        auto last = Position::FromString(last_text);
+        if (!first.IsValid() || !last.IsValid()) {
+            throw FormulaException("Invalid range: " + std::string(first_text) + ':' + std::string(last_text));
+        }
+
+        // Углы можно указать в любом порядке, храним нормализованный диапазон
+        auto range = CellRange::FromCorners(first, last);
+        if (std::find(ranges_.begin(), ranges_.end(), range) == ranges_.end()) {
+            ranges_.push_back(range);
+        }
+        return std::make_unique<RangeExpr>(range);
+    }
+
+    static FunctionExpr::Function GetFunction(std::string_view name) {
+        auto function = FunctionExpr::FromName(name);
+        if (!function) {
+            throw ParsingError("Unknown function: " + std::string(name));
+        }
+        return *function;
+    }
+
+    std::forward_list<Position> MoveCells() {
+        return std::move(cells_);
+    }
+
+    std::vector<CellRange> MoveRanges() {
+        return std::move(ranges_);
+    }
+
+private:
+    std::forward_list<Position> cells_;
+    std::vector<CellRange> ranges_;
+};
+
 class ParseASTListener final : public FormulaBaseListener {
 public:
     std::unique_ptr<Expr> MoveRoot() {
@@ -335,7 +456,11 @@ public:
     }
 
     std::forward_list<Position> MoveCells() {
-        return std::move(cells_);
+        return references_.MoveCells();
+    }
+
+    std::vector<CellRange> MoveRanges() {
+        return references_.MoveRanges();
     }
 
 public:
@@ -370,14 +495,27 @@ public:
     }
 
     void exitCell(FormulaParser::CellContext* ctx) override {
-        auto value_str = ctx->CELL()->getSymbol()->getText();
-        auto value = Position::FromString(value_str);
-        if (!value.IsValid()) {
-            throw FormulaException("Invalid position: " + value_str);
+        args_.push_back(references_.MakeCell(ctx->CELL()->getSymbol()->getText()));
+    }
+
+    void exitRange(FormulaParser::RangeContext* ctx) override {
+        args_.push_back(references_.MakeRange(ctx->CELL(0)->getSymbol()->getText(),
+                                              ctx->CELL(1)->getSymbol()->getText()));
+    }
+
+    void exitFunction(FormulaParser::FunctionContext* ctx) override {
+        auto function = ReferenceCollector::GetFunction(ctx->NAME()->getSymbol()->getText());
+
+        const size_t arg_count = ctx->expr().size();
+        assert(args_.size() >= arg_count);
+        std::vector<std::unique_ptr<Expr>> args;
+        args.reserve(arg_count);
+        for (auto it = args_.end() - arg_count; it != args_.end(); ++it) {
+            args.push_back(std::move(*it));
         }
+        args_.resize(args_.size() - arg_count);
 
-        cells_.push_front(value);
-        auto node = std::make_unique<CellExpr>(&cells_.front());
+        auto node = std::make_unique<FunctionExpr>(function, std::move(args));
         args_.push_back(std::move(node));
     }
 
@@ -411,7 +549,7 @@ public:
 
 private:
     std::vector<std::unique_ptr<Expr>> args_;
-    std::forward_list<Position> cells_;
+    ReferenceCollector references_;
 };
 
 class BailErrorListener : public antlr4::BaseErrorListener {
@@ -424,10 +562,337 @@ public:
     }
 };
 
+enum class TokenKind {
+    End,
+    Number,
+    Cell,
+    Name,
+    Add,
+    Sub,
+    Mul,
+    Div,
+    LeftParen,
+    RightParen,
+    Colon,
+    Comma,
+};
+
+struct Token {
+    TokenKind kind = TokenKind::End;
+    std::string_view text;
+};
+
+// Лексер грамматики Formula.g4. Лексемы читаются прямо из строки по мере
+// разбора, без промежуточных буферов.
+class Lexer {
+public:
+    explicit Lexer(std::string_view text)
+        : text_(text) {
+        Advance();
+    }
+
+    const Token& Get() const {
+        return token_;
+    }
+
+    void Advance() {
+        while (offset_ < text_.size()
+               && (text_[offset_] == ' ' || text_[offset_] == '\t' || text_[offset_] == '\n'
+                   || text_[offset_] == '\r')) {
+            ++offset_;
+        }
+        if (offset_ == text_.size()) {
+            token_ = {TokenKind::End, {}};
+            return;
+        }
+
+        const char c = text_[offset_];
+        size_t length = 1;
+        TokenKind kind;
+        if (IsUpper(c)) {
+            while (offset_ + length < text_.size() && IsUpper(text_[offset_ + length])) {
+                ++length;
+            }
+            const size_t digits_end = SkipDigits(offset_ + length);
+            kind = digits_end > offset_ + length ? TokenKind::Cell : TokenKind::Name;
+            length = digits_end - offset_;
+        } else if (IsDigit(c) || c == '.') {
+            length = MatchNumber();
+            kind = TokenKind::Number;
+        } else {
+            switch (c) {
+                case '+':
+                    kind = TokenKind::Add;
+                    break;
+                case '-':
+                    kind = TokenKind::Sub;
+                    break;
+                case '*':
+                    kind = TokenKind::Mul;
+                    break;
+                case '/':
+                    kind = TokenKind::Div;
+                    break;
+                case '(':
+                    kind = TokenKind::LeftParen;
+                    break;
+                case ')':
+                    kind = TokenKind::RightParen;
+                    break;
+                case ':':
+                    kind = TokenKind::Colon;
+                    break;
+                case ',':
+                    kind = TokenKind::Comma;
+                    break;
+                default:
+                    length = 0;
+                    break;
+            }
+        }
+        if (length == 0) {
+            throw ParsingError("Error when lexing: token recognition error at: " + std::string(1, c));
+        }
+        token_ = {kind, text_.substr(offset_, length)};
+        offset_ += length;
+    }
+
+private:
+    std::string_view text_;
+    size_t offset_ = 0;
+    Token token_;
+
+    static bool IsUpper(char c) {
+        return c >= 'A' && c <= 'Z';
+    }
+    static bool IsDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    size_t SkipDigits(size_t offset) const {
+        while (offset < text_.size() && IsDigit(text_[offset])) {
+            ++offset;
+        }
+        return offset;
+    }
+
+    // Длина числа NUMBER, начинающегося с offset_, или 0
+    size_t MatchNumber() const {
+        size_t end = SkipDigits(offset_);
+        const bool has_int = end > offset_;
+        if (end + 1 < text_.size() && text_[end] == '.' && IsDigit(text_[end + 1])) {
+            end = SkipDigits(end + 1);
+        } else if (!has_int) {
+            return 0;
+        }
+        // Экспонента входит в число, только если за ней есть цифры
+        if (end < text_.size() && (text_[end] == 'e' || text_[end] == 'E')) {
+            size_t exponent = end + 1;
+            if (exponent < text_.size() && (text_[exponent] == '+' || text_[exponent] == '-')) {
+                ++exponent;
+            }
+            if (exponent < text_.size() && IsDigit(text_[exponent])) {
+                end = SkipDigits(exponent);
+            }
+        }
+        return end - offset_;
+    }
+};
+
+// Разборщик грамматики Formula.g4 рекурсивным спуском. Память выделяется
+// только под узлы дерева. Приоритеты и ассоциативность те же, что у ANTLR
+// для этой грамматики: унарный знак связывает сильнее умножения, бинарные
+// операции левоассоциативны.
+class DescentParser {
+public:
+    explicit DescentParser(std::string_view text)
+        : lexer_(text) {
+    }
+
+    FormulaAST Parse() {
+        auto root = ParseExpr(PRECEDENCE_ADD);
+        if (lexer_.Get().kind != TokenKind::End) {
+            Fail();
+        }
+        return FormulaAST(std::move(root), references_.MoveCells(), references_.MoveRanges());
+    }
+
+private:
+    static constexpr int PRECEDENCE_ADD = 1;
+    static constexpr int PRECEDENCE_MUL = 2;
+
+    Lexer lexer_;
+    ReferenceCollector references_;
+
+    [[noreturn]] void Fail() const {
+        throw ParsingError("Error when parsing: " + std::string(lexer_.Get().text));
+    }
+
+    Token Expect(TokenKind kind) {
+        if (lexer_.Get().kind != kind) {
+            Fail();
+        }
+        Token token = lexer_.Get();
+        lexer_.Advance();
+        return token;
+    }
+
+    static int GetPrecedence(TokenKind kind) {
+        switch (kind) {
+            case TokenKind::Add:
+            case TokenKind::Sub:
+                return PRECEDENCE_ADD;
+            case TokenKind::Mul:
+            case TokenKind::Div:
+                return PRECEDENCE_MUL;
+            default:
+                return 0;
+        }
+    }
+
+    static BinaryOpExpr::Type GetBinaryType(TokenKind kind) {
+        switch (kind) {
+            case TokenKind::Add:
+                return BinaryOpExpr::Add;
+            case TokenKind::Sub:
+                return BinaryOpExpr::Subtract;
+            case TokenKind::Mul:
+                return BinaryOpExpr::Multiply;
+            default:
+                assert(kind == TokenKind::Div);
+                return BinaryOpExpr::Divide;
+        }
+    }
+
+    // Бинарные операции с приоритетом не ниже min_precedence
+    std::unique_ptr<Expr> ParseExpr(int min_precedence) {
+        auto lhs = ParseUnary();
+        while (GetPrecedence(lexer_.Get().kind) >= min_precedence) {
+            const TokenKind op = lexer_.Get().kind;
+            lexer_.Advance();
+            auto rhs = ParseExpr(GetPrecedence(op) + 1);
+            lhs = std::make_unique<BinaryOpExpr>(GetBinaryType(op), std::move(lhs), std::move(rhs));
+        }
+        return lhs;
+    }
+
+    std::unique_ptr<Expr> ParseUnary() {
+        if (lexer_.Get().kind == TokenKind::Add || lexer_.Get().kind == TokenKind::Sub) {
+            const auto type = lexer_.Get().kind == TokenKind::Add ? UnaryOpExpr::UnaryPlus : UnaryOpExpr::UnaryMinus;
+            lexer_.Advance();
+            return std::make_unique<UnaryOpExpr>(type, ParseUnary());
+        }
+        return ParsePrimary();
+    }
+
+    std::unique_ptr<Expr> ParsePrimary() {
+        switch (lexer_.Get().kind) {
+            case TokenKind::LeftParen: {
+                lexer_.Advance();
+                auto expr = ParseExpr(PRECEDENCE_ADD);
+                Expect(TokenKind::RightParen);
+                return expr;
+            }
+            case TokenKind::Number:
+                return std::make_unique<NumberExpr>(ParseNumber(Expect(TokenKind::Number).text));
+            case TokenKind::Cell: {
+                const std::string_view first = Expect(TokenKind::Cell).text;
+                if (lexer_.Get().kind != TokenKind::Colon) {
+                    return references_.MakeCell(first);
+                }
+                lexer_.Advance();
+                return references_.MakeRange(first, Expect(TokenKind::Cell).text);
+            }
+            case TokenKind::Name: {
+                const auto function = ReferenceCollector::GetFunction(Expect(TokenKind::Name).text);
+                Expect(TokenKind::LeftParen);
+                std::vector<std::unique_ptr<Expr>> args;
+                args.push_back(ParseExpr(PRECEDENCE_ADD));
+                while (lexer_.Get().kind == TokenKind::Comma) {
+                    lexer_.Advance();
+                    args.push_back(ParseExpr(PRECEDENCE_ADD));
+                }
+                Expect(TokenKind::RightParen);
+                return std::make_unique<FunctionExpr>(function, std::move(args));
+            }
+            default:
+                Fail();
+        }
+    }
+
+    // Число разбирается без потоков и локали. Значение совпадает с
+    // operator>> для double: слишком большое число - ошибка, слишком
+    // маленькое становится нулём или денормализованным числом.
+    static double ParseNumber(std::string_view text) {
+        double value = 0.0;
+        auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+        if (error == std::errc::result_out_of_range) {
+            const std::string copy(text);
+            value = std::strtod(copy.c_str(), nullptr);
+            if (std::isinf(value)) {
+                throw ParsingError("Invalid number: " + copy);
+            }
+        } else if (error != std::errc() || end != text.data() + text.size()) {
+            throw ParsingError("Invalid number: " + std::string(text));
+        }
+        return value;
+    }
+};
+
 }  // namespace
 }  // namespace ASTImpl
 
+FormulaAST ParseFormulaAST(std::string_view text) {
+    return ASTImpl::DescentParser(text).Parse();
+}
+
+bool MakeRelativeKey(std::string_view text, Position anchor, std::string& key) {
+    using ASTImpl::TokenKind;
+
+    key.clear();
+    try {
+        bool previous_is_word = false;
+        for (ASTImpl::Lexer lexer(text); lexer.Get().kind != TokenKind::End; lexer.Advance()) {
+            const ASTImpl::Token& token = lexer.Get();
+            const bool is_word = token.kind == TokenKind::Number || token.kind == TokenKind::Name
+                                 || token.kind == TokenKind::Cell;
+            // Соседние числа и имена разделяются, иначе "1 2" совпало бы с "12"
+            if (is_word && previous_is_word) {
+                key += ' ';
+            }
+            previous_is_word = is_word;
+            if (token.kind != TokenKind::Cell) {
+                key += token.text;
+                continue;
+            }
+            const Position pos = Position::FromString(token.text);
+            if (!pos.IsValid()) {
+                return false;
+            }
+            const PositionOffset offset = PositionOffset::Between(anchor, pos);
+            key += 'R';
+            key += '[';
+            key += std::to_string(offset.rows);
+            key += "]C[";
+            key += std::to_string(offset.cols);
+            key += ']';
+        }
+    } catch (const ParsingError&) {
+        return false;
+    }
+    return true;
+}
+
 FormulaAST ParseFormulaAST(std::istream& in) {
+    std::string text(std::istreambuf_iterator<char>(in), {});
+    return ParseFormulaAST(std::string_view(text));
+}
+
+FormulaAST ParseFormulaAST(const std::string& in_str) {
+    return ParseFormulaAST(std::string_view(in_str));
+}
+
+FormulaAST ParseFormulaASTWithAntlr(std::istream& in) {
     using namespace antlr4;
 
     ANTLRInputStream input(in);
@@ -448,12 +913,12 @@ FormulaAST ParseFormulaAST(std::istream& in) {
     ASTImpl::ParseASTListener listener;
     tree::ParseTreeWalker::DEFAULT.walk(&listener, tree);
 
-    return FormulaAST(listener.MoveRoot(), listener.MoveCells());
+    return FormulaAST(listener.MoveRoot(), listener.MoveCells(), listener.MoveRanges());
 }
 
-FormulaAST ParseFormulaAST(const std::string& in_str) {
+FormulaAST ParseFormulaASTWithAntlr(const std::string& in_str) {
     std::istringstream in(in_str);
-    return ParseFormulaAST(in);
+    return ParseFormulaASTWithAntlr(in);
 }
 
 void FormulaAST::PrintCells(std::ostream& out) const {
@@ -466,17 +931,21 @@ void FormulaAST::Print(std::ostream& out) const {
     root_expr_->Print(out);
 }
 
-void FormulaAST::PrintFormula(std::ostream& out) const {
-    root_expr_->PrintFormula(out, ASTImpl::EP_ATOM);
+void FormulaAST::PrintFormula(std::ostream& out, PositionOffset offset) const {
+    root_expr_->PrintFormula(out, ASTImpl::EP_ATOM, offset);
 }
 
-double FormulaAST::Execute(const SheetInterface &sheet) const {
-    return root_expr_->Evaluate(sheet);
+FormulaProgram FormulaAST::Compile() const {
+    FormulaProgram program;
+    root_expr_->Compile(program);
+    return program;
 }
 
-FormulaAST::FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr, std::forward_list<Position> cells)
+FormulaAST::FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr, std::forward_list<Position> cells,
+                       std::vector<CellRange> ranges)
     : root_expr_(std::move(root_expr))
-    , cells_(std::move(cells)) {
+    , cells_(std::move(cells))
+    , ranges_(std::move(ranges)) {
     cells_.sort();  // to avoid sorting in GetReferencedCells
 }
 
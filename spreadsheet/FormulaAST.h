@@ -1,11 +1,13 @@
 #pragma once
 
 #include "FormulaLexer.h"
+#include "FormulaProgram.h"
 #include "common.h"
 
 #include <forward_list>
 #include <functional>
 #include <stdexcept>
+#include <string_view>
 
 namespace ASTImpl {
 class Expr;
@@ -18,15 +20,19 @@ class ParsingError : public std::runtime_error {
 class FormulaAST {
 public:
     explicit FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr,
-                        std::forward_list<Position> cells);
+                        std::forward_list<Position> cells,
+                        std::vector<CellRange> ranges = {});
     FormulaAST(FormulaAST&&) = default;
     FormulaAST& operator=(FormulaAST&&) = default;
     ~FormulaAST();
     
-    double Execute(const SheetInterface &sheet) const;
+    // Переводит выражение в байткод для вычисления. Само дерево остаётся
+    // для печати формулы.
+    FormulaProgram Compile() const;
     void PrintCells(std::ostream& out) const;
     void Print(std::ostream& out) const;
-    void PrintFormula(std::ostream& out) const;
+    // Печатает формулу со ссылками, сдвинутыми на offset
+    void PrintFormula(std::ostream& out, PositionOffset offset = {}) const;
 
     std::forward_list<Position>& GetCells() {
         return cells_;
@@ -36,6 +42,11 @@ public:
         return cells_;
     }
 
+    // Диапазоны не раскрываются в ячейки: их хранит граф зависимостей целиком
+    const std::vector<CellRange>& GetRanges() const {
+        return ranges_;
+    }
+
     std::vector<Position> GetReferencedCells() const {
         std::vector<Position> ref_cells;
         for(Position pos : cells_)
@@ -52,7 +63,23 @@ private:
     // efficiently traversed without going through
     // the whole AST
     std::forward_list<Position> cells_;
+    std::vector<CellRange> ranges_;
 };
 
+// Разбор формулы рукописным разборщиком рекурсивного спуска
+FormulaAST ParseFormulaAST(std::string_view text);
 FormulaAST ParseFormulaAST(std::istream& in);
-FormulaAST ParseFormulaAST(const std::string& in_str);
\ No newline at end of file
+FormulaAST ParseFormulaAST(const std::string& in_str);
+
+// Относительная (в стиле R1C1) запись формулы text, заданной в ячейке
+// anchor: лексемы формулы, где ссылки заменены на R[строки]C[столбцы] от
+// anchor. Формулы с одинаковой записью совпадают с точностью до сдвига
+// ссылок, как ячейки одного протянутого столбца. Синтаксис не проверяется;
+// возвращает false, если в тексте есть недопустимая лексема или позиция.
+bool MakeRelativeKey(std::string_view text, Position anchor, std::string& key);
+
+// Разбор сгенерированным ANTLR разборщиком по Formula.g4. На рабочем пути не
+// используется: служит эталоном для сверки с ParseFormulaAST в тестах и
+// бенчмарках.
+FormulaAST ParseFormulaASTWithAntlr(std::istream& in);
+FormulaAST ParseFormulaASTWithAntlr(const std::string& in_str);
\ No newline at end of file
@@ -0,0 +1,735 @@
+#include "FormulaProgram.h"
+
+#include "aggregate_kernels.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <optional>
+#include <string>
+#include <variant>
+
+namespace {
+// Глубины стека большинства формул хватает для буфера на стеке вызова
+const int INLINE_STACK_SIZE = 32;
+const int INLINE_CALL_DEPTH = 4;
+// Числа диапазона передаются ядрам порциями такого размера
+const size_t RANGE_BUFFER_SIZE = 256;
+// Глубина стека пачки, для которой хватает буфера на стеке вызова
+const int INLINE_BATCH_DEPTH = 8;
+
+// Читает операнд-ячейку в out. Возвращает false и ошибку в error, если
+// значение ячейки нельзя трактовать как число.
+bool ReadCell(const SheetInterface& sheet, Position pos, double& out, FormulaError& error) {
+    switch(sheet.GetNumber(pos, out, error))
+    {
+        case CellNumberKind::Empty:
+            out = 0.0;
+            return true;
+        case CellNumberKind::Number:
+            return true;
+        case CellNumberKind::Text:
+            error = FormulaError::Category::Value;
+            return false;
+        case CellNumberKind::Error:
+            return false;
+    }
+    return false;
+}
+
+bool IsValidResult(double result) {
+    return !std::isinf(result);
+}
+
+enum class RangeCell {
+    Number,
+    Skipped,
+    Error,
+};
+
+// Читает ячейку диапазона. В отличие от операнда-ячейки, пустые ячейки и
+// текст, который не является числом, агрегатными функциями пропускаются.
+RangeCell ReadRangeCell(const SheetInterface& sheet, Position pos, double& out, FormulaError& error) {
+    switch(sheet.GetNumber(pos, out, error))
+    {
+        case CellNumberKind::Number:
+            return RangeCell::Number;
+        case CellNumberKind::Error:
+            return RangeCell::Error;
+        default:
+            return RangeCell::Skipped;
+    }
+}
+
+// Аргументы выполняемого вызова агрегатной функции, свёрнутые по мере чтения.
+// Поля не инициализируются по умолчанию: буфер накопителей заводится при
+// каждом вычислении формулы, а заполняется только при вызове функции.
+struct Accumulator {
+    FormulaProgram::Function function;
+    double sum;
+    double min;
+    double max;
+    size_t count;
+
+    static Accumulator Start(FormulaProgram::Function function) {
+        return {function, 0.0, std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity(), 0};
+    }
+
+    void Add(double value) {
+        sum += value;
+        min = std::min(min, value);
+        max = std::max(max, value);
+        ++count;
+    }
+
+    // Сворачивает порцию чисел, считая только нужное функции
+    void Add(const double* values, size_t size) {
+        if(size == 0)
+        {
+            return;
+        }
+        switch(function)
+        {
+            case FormulaProgram::Function::Sum:
+            case FormulaProgram::Function::Average:
+                sum += aggregate::Sum(values, size);
+                break;
+            case FormulaProgram::Function::Min:
+                min = std::min(min, aggregate::Min(values, size));
+                break;
+            case FormulaProgram::Function::Max:
+                max = std::max(max, aggregate::Max(values, size));
+                break;
+            case FormulaProgram::Function::Count:
+                break;
+        }
+        count += size;
+    }
+
+    void Add(const RangeTotal& total) {
+        if(total.count == 0)
+        {
+            return;
+        }
+        sum += total.sum;
+        min = std::min(min, total.min);
+        max = std::max(max, total.max);
+        count += total.count;
+    }
+
+    FormulaInterface::Value GetResult() const {
+        double result = 0.0;
+        switch(function)
+        {
+            case FormulaProgram::Function::Sum:
+                result = sum;
+                break;
+            case FormulaProgram::Function::Average:
+                if(count == 0)
+                {
+                    return FormulaError(FormulaError::Category::Arithmetic);
+                }
+                result = sum / static_cast<double>(count);
+                break;
+            case FormulaProgram::Function::Min:
+                result = count == 0 ? 0.0 : min;
+                break;
+            case FormulaProgram::Function::Max:
+                result = count == 0 ? 0.0 : max;
+                break;
+            case FormulaProgram::Function::Count:
+                result = static_cast<double>(count);
+                break;
+        }
+        if(!IsValidResult(result))
+        {
+            return FormulaError(FormulaError::Category::Arithmetic);
+        }
+        return result;
+    }
+};
+
+// Собирает числа диапазона порциями и передаёт их накопителю. Диапазон
+// читается по столбцам: числовые данные обычно идут столбцами.
+bool AccumulateRange(const SheetInterface& sheet, const CellRange& range, Accumulator& accumulator,
+                     FormulaError& error) {
+    std::array<double, RANGE_BUFFER_SIZE> buffer;
+    size_t size = 0;
+    for(int col = range.first.col; col <= range.last.col; ++col)
+    {
+        for(int row = range.first.row; row <= range.last.row; ++row)
+        {
+            RangeCell cell = ReadRangeCell(sheet, {row, col}, buffer[size], error);
+            if(cell == RangeCell::Error)
+            {
+                return false;
+            }
+            if(cell == RangeCell::Number && ++size == buffer.size())
+            {
+                accumulator.Add(buffer.data(), size);
+                size = 0;
+            }
+        }
+    }
+    accumulator.Add(buffer.data(), size);
+    return true;
+}
+
+// Бинарная операция над числами с теми же проверками, что при вычислении
+FormulaInterface::Value ApplyOperation(FormulaProgram::OpCode code, double lhs, double rhs) {
+    double result = 0.0;
+    switch(code)
+    {
+        case FormulaProgram::OpCode::Add:
+            result = lhs + rhs;
+            break;
+        case FormulaProgram::OpCode::Subtract:
+            result = lhs - rhs;
+            break;
+        case FormulaProgram::OpCode::Multiply:
+            result = lhs * rhs;
+            break;
+        case FormulaProgram::OpCode::Divide:
+            if(rhs == 0.0)
+            {
+                return FormulaError(FormulaError::Category::Arithmetic);
+            }
+            result = lhs / rhs;
+            break;
+        default:
+            assert(false);
+            break;
+    }
+    if(!IsValidResult(result))
+    {
+        return FormulaError(FormulaError::Category::Arithmetic);
+    }
+    return result;
+}
+
+const size_t BATCH_SIZE = FormulaInterface::BATCH_SIZE;
+using BatchLanes = std::array<double, BATCH_SIZE>;
+
+// Ошибки дорожек пачки. Дорожка запоминает первую ошибку, как обычное
+// вычисление, которое на ней останавливается; дальше дорожка считается
+// вместе с остальными, но её значения не читаются. Циклы идут по всем
+// BATCH_SIZE дорожкам: постоянную длину компилятор векторизует.
+struct BatchErrors {
+    std::array<std::uint8_t, BATCH_SIZE> failed;
+    std::array<FormulaError::Category, BATCH_SIZE> categories;
+
+    void Fail(size_t lane, FormulaError::Category category) {
+        if(!failed[lane])
+        {
+            failed[lane] = 1;
+            categories[lane] = category;
+        }
+    }
+
+    // Отмечает дорожки, где bad, ошибкой #ARITHM!
+    void FailArithmetic(const std::array<std::uint8_t, BATCH_SIZE>& bad) {
+        for(size_t i = 0; i < BATCH_SIZE; ++i)
+        {
+            const bool first = bad[i] && !failed[i];
+            categories[i] = first ? FormulaError::Category::Arithmetic : categories[i];
+            failed[i] |= bad[i];
+        }
+    }
+
+    // Бесконечный результат - ошибка, как в IsValidResult
+    void CheckResults(const BatchLanes& values) {
+        std::array<std::uint8_t, BATCH_SIZE> bad;
+        for(size_t i = 0; i < BATCH_SIZE; ++i)
+        {
+            bad[i] = std::fabs(values[i]) > std::numeric_limits<double>::max();
+        }
+        FailArithmetic(bad);
+    }
+};
+
+// Читает ячейку pos + i строк в дорожку i каждой дорожки без ошибки
+void ReadBatchCells(const SheetInterface& sheet, Position pos, BatchLanes& lanes, BatchErrors& errors) {
+    FormulaError error(FormulaError::Category::Value);
+    for(size_t i = 0; i < BATCH_SIZE; ++i, ++pos.row)
+    {
+        lanes[i] = 0.0;
+        if(!errors.failed[i] && !ReadCell(sheet, pos, lanes[i], error))
+        {
+            errors.Fail(i, error.GetCategory());
+        }
+    }
+}
+
+// Читает диапазон целиком и сохраняет полный итог: его потом можно
+// обновлять по разнице для любой функции
+bool ComputeRangeTotal(const SheetInterface& sheet, const CellRange& range, RangeTotal& total,
+                       FormulaError& error) {
+    Accumulator accumulator = Accumulator::Start(FormulaProgram::Function::Sum);
+    std::array<double, RANGE_BUFFER_SIZE> buffer;
+    size_t size = 0;
+    auto flush = [&] {
+        if(size > 0)
+        {
+            accumulator.sum += aggregate::Sum(buffer.data(), size);
+            accumulator.min = std::min(accumulator.min, aggregate::Min(buffer.data(), size));
+            accumulator.max = std::max(accumulator.max, aggregate::Max(buffer.data(), size));
+            accumulator.count += size;
+            size = 0;
+        }
+    };
+    for(int col = range.first.col; col <= range.last.col; ++col)
+    {
+        for(int row = range.first.row; row <= range.last.row; ++row)
+        {
+            RangeCell cell = ReadRangeCell(sheet, {row, col}, buffer[size], error);
+            if(cell == RangeCell::Error)
+            {
+                total.Invalidate();
+                return false;
+            }
+            if(cell == RangeCell::Number && ++size == buffer.size())
+            {
+                flush();
+            }
+        }
+    }
+    flush();
+    total.sum = accumulator.sum;
+    total.min = accumulator.min;
+    total.max = accumulator.max;
+    total.count = accumulator.count;
+    total.rounding_error = 0.0;
+    total.valid = true;
+    total.extrema_valid = true;
+    return true;
+}
+
+// Подставляет в накопитель итог диапазона, при необходимости перечитав его
+bool AccumulateRangeTotal(const SheetInterface& sheet, const CellRange& range, RangeTotal& total,
+                          Accumulator& accumulator, FormulaError& error) {
+    const bool needs_extrema = accumulator.function == FormulaProgram::Function::Min
+                               || accumulator.function == FormulaProgram::Function::Max;
+    if(!total.valid || (needs_extrema && !total.extrema_valid))
+    {
+        if(!ComputeRangeTotal(sheet, range, total, error))
+        {
+            return false;
+        }
+    }
+    accumulator.Add(total);
+    return true;
+}
+}  // namespace
+
+void FormulaProgram::EmitNumber(double value) {
+    Instruction instruction;
+    instruction.code = OpCode::PushNumber;
+    instruction.number = value;
+    code_.push_back(instruction);
+    UpdateDepth(1);
+}
+
+void FormulaProgram::EmitCell(Position pos) {
+    Instruction instruction;
+    instruction.code = OpCode::PushCell;
+    instruction.cell = {pos.row, pos.col};
+    code_.push_back(instruction);
+    UpdateDepth(1);
+}
+
+void FormulaProgram::EmitRange(const CellRange& range) {
+    Instruction instruction;
+    instruction.code = OpCode::PushRange;
+    instruction.range = AddRange(range);
+    code_.push_back(instruction);
+    UpdateDepth(1);
+}
+
+void FormulaProgram::EmitOperation(OpCode code) {
+    assert(code == OpCode::Add || code == OpCode::Subtract || code == OpCode::Multiply
+           || code == OpCode::Divide || code == OpCode::Negate);
+    if(code == OpCode::Negate ? FoldNegate() : FoldBinary(code))
+    {
+        UpdateDepth(code == OpCode::Negate ? 0 : -1);
+        return;
+    }
+    Instruction instruction;
+    instruction.code = code;
+    instruction.number = 0.0;
+    code_.push_back(instruction);
+    UpdateDepth(code == OpCode::Negate ? 0 : -1);
+}
+
+void FormulaProgram::EmitBeginCall(Function function) {
+    call_starts_.push_back(code_.size());
+    Instruction instruction;
+    instruction.code = OpCode::BeginCall;
+    instruction.function = function;
+    code_.push_back(instruction);
+    max_call_depth_ = std::max(max_call_depth_, ++call_depth_);
+}
+
+void FormulaProgram::EmitAccumulateValue() {
+    Instruction instruction;
+    instruction.code = OpCode::AccumulateValue;
+    instruction.number = 0.0;
+    code_.push_back(instruction);
+    UpdateDepth(-1);
+}
+
+void FormulaProgram::EmitAccumulateRange(const CellRange& range) {
+    Instruction instruction;
+    instruction.code = OpCode::AccumulateRange;
+    instruction.range = AddRange(range);
+    code_.push_back(instruction);
+}
+
+void FormulaProgram::EmitEndCall() {
+    const size_t start = call_starts_.back();
+    call_starts_.pop_back();
+    --call_depth_;
+    UpdateDepth(1);
+    if(FoldCall(start))
+    {
+        return;
+    }
+    Instruction instruction;
+    instruction.code = OpCode::EndCall;
+    instruction.number = 0.0;
+    code_.push_back(instruction);
+    ++calls_;
+}
+
+bool FormulaProgram::IsConstant(const Instruction& instruction) {
+    return instruction.code == OpCode::PushNumber || instruction.code == OpCode::PushError;
+}
+
+FormulaProgram::Instruction FormulaProgram::MakeConstant(const FormulaInterface::Value& value) {
+    Instruction instruction;
+    if(std::holds_alternative<double>(value))
+    {
+        instruction.code = OpCode::PushNumber;
+        instruction.number = std::get<double>(value);
+    }
+    else
+    {
+        instruction.code = OpCode::PushError;
+        instruction.error = std::get<FormulaError>(value).GetCategory();
+    }
+    return instruction;
+}
+
+bool FormulaProgram::FoldNegate() {
+    if(code_.empty())
+    {
+        return false;
+    }
+    Instruction& operand = code_.back();
+    switch(operand.code)
+    {
+        case OpCode::PushNumber:
+            operand.number = -operand.number;
+            return true;
+        case OpCode::PushError:
+            return true;
+        case OpCode::Negate:
+            // -(-x) = x: у смены знака нет проверок, её можно убрать
+            code_.pop_back();
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool FormulaProgram::FoldBinary(OpCode code) {
+    const size_t size = code_.size();
+    if(size < 2 || !IsConstant(code_[size - 2]) || !IsConstant(code_[size - 1]))
+    {
+        return false;
+    }
+    const Instruction lhs = code_[size - 2];
+    const Instruction rhs = code_[size - 1];
+    code_.pop_back();
+    // Ошибка левого операнда возникает раньше, чем правого
+    if(lhs.code == OpCode::PushError)
+    {
+        return true;
+    }
+    if(rhs.code == OpCode::PushError)
+    {
+        code_.back() = rhs;
+        return true;
+    }
+    code_.back() = MakeConstant(ApplyOperation(code, lhs.number, rhs.number));
+    return true;
+}
+
+bool FormulaProgram::FoldCall(size_t start) {
+    // Вызов сворачивается, если все его аргументы - константы
+    for(size_t i = start + 1; i < code_.size(); i += 2)
+    {
+        if(i + 1 >= code_.size() || !IsConstant(code_[i]) || code_[i + 1].code != OpCode::AccumulateValue)
+        {
+            return false;
+        }
+    }
+    Accumulator accumulator = Accumulator::Start(code_[start].function);
+    std::optional<Instruction> error;
+    for(size_t i = start + 1; i < code_.size() && !error; i += 2)
+    {
+        if(code_[i].code == OpCode::PushError)
+        {
+            error = code_[i];
+        }
+        else
+        {
+            accumulator.Add(code_[i].number);
+        }
+    }
+    const Instruction result = error ? *error : MakeConstant(accumulator.GetResult());
+    code_.resize(start);
+    code_.push_back(result);
+    return true;
+}
+
+void FormulaProgram::UpdateDepth(int delta) {
+    depth_ += delta;
+    max_depth_ = std::max(max_depth_, depth_);
+}
+
+std::uint32_t FormulaProgram::AddRange(const CellRange& range) {
+    auto it = std::find(ranges_.begin(), ranges_.end(), range);
+    if(it != ranges_.end())
+    {
+        return static_cast<std::uint32_t>(it - ranges_.begin());
+    }
+    ranges_.push_back(range);
+    return static_cast<std::uint32_t>(ranges_.size() - 1);
+}
+
+FormulaInterface::Value FormulaProgram::Execute(const SheetInterface& sheet, RangeTotal* totals,
+                                                PositionOffset offset) const {
+    std::array<double, INLINE_STACK_SIZE> inline_stack;
+    std::vector<double> heap_stack;
+    double* stack = inline_stack.data();
+    if(max_depth_ > INLINE_STACK_SIZE)
+    {
+        heap_stack.resize(max_depth_);
+        stack = heap_stack.data();
+    }
+
+    std::array<Accumulator, INLINE_CALL_DEPTH> inline_calls;
+    std::vector<Accumulator> heap_calls;
+    Accumulator* calls = inline_calls.data();
+    if(max_call_depth_ > INLINE_CALL_DEPTH)
+    {
+        heap_calls.resize(max_call_depth_);
+        calls = heap_calls.data();
+    }
+
+    const FormulaError arithmetic_error(FormulaError::Category::Arithmetic);
+    FormulaError cell_error(FormulaError::Category::Value);
+    int top = 0;
+    int call_top = 0;
+    for(const Instruction& instruction : code_)
+    {
+        switch(instruction.code)
+        {
+            case OpCode::PushNumber:
+                stack[top++] = instruction.number;
+                break;
+            case OpCode::PushError:
+                return FormulaError(instruction.error);
+            case OpCode::PushCell:
+                if(!ReadCell(sheet, offset.Apply(Position{instruction.cell.row, instruction.cell.col}), stack[top++], cell_error))
+                {
+                    return cell_error;
+                }
+                break;
+            case OpCode::PushRange: {
+                // Как число можно прочитать только диапазон из одной ячейки
+                const CellRange range = offset.Apply(ranges_[instruction.range]);
+                if(!(range.first == range.last))
+                {
+                    return FormulaError(FormulaError::Category::Value);
+                }
+                if(!ReadCell(sheet, range.first, stack[top++], cell_error))
+                {
+                    return cell_error;
+                }
+                break;
+            }
+            case OpCode::Add:
+                --top;
+                stack[top - 1] += stack[top];
+                if(!IsValidResult(stack[top - 1]))
+                {
+                    return arithmetic_error;
+                }
+                break;
+            case OpCode::Subtract:
+                --top;
+                stack[top - 1] -= stack[top];
+                if(!IsValidResult(stack[top - 1]))
+                {
+                    return arithmetic_error;
+                }
+                break;
+            case OpCode::Multiply:
+                --top;
+                stack[top - 1] *= stack[top];
+                if(!IsValidResult(stack[top - 1]))
+                {
+                    return arithmetic_error;
+                }
+                break;
+            case OpCode::Divide:
+                --top;
+                if(stack[top] == 0.0)
+                {
+                    return arithmetic_error;
+                }
+                stack[top - 1] /= stack[top];
+                if(!IsValidResult(stack[top - 1]))
+                {
+                    return arithmetic_error;
+                }
+                break;
+            case OpCode::Negate:
+                stack[top - 1] = -stack[top - 1];
+                break;
+            case OpCode::BeginCall:
+                calls[call_top++] = Accumulator::Start(instruction.function);
+                break;
+            case OpCode::AccumulateValue:
+                calls[call_top - 1].Add(stack[--top]);
+                break;
+            case OpCode::AccumulateRange: {
+                const CellRange range = offset.Apply(ranges_[instruction.range]);
+                const bool accumulated = totals != nullptr
+                    ? AccumulateRangeTotal(sheet, range, totals[instruction.range], calls[call_top - 1], cell_error)
+                    : AccumulateRange(sheet, range, calls[call_top - 1], cell_error);
+                if(!accumulated)
+                {
+                    return cell_error;
+                }
+                break;
+            }
+            case OpCode::EndCall: {
+                FormulaInterface::Value result = calls[--call_top].GetResult();
+                if(std::holds_alternative<FormulaError>(result))
+                {
+                    return result;
+                }
+                stack[top++] = std::get<double>(result);
+                break;
+            }
+        }
+    }
+    assert(top == 1);
+    return stack[0];
+}
+
+void FormulaProgram::ExecuteBatch(const SheetInterface& sheet, PositionOffset offset, size_t count,
+                                  FormulaInterface::Value* results) const {
+    assert(IsBatchable() && count <= BATCH_SIZE);
+    std::array<BatchLanes, INLINE_BATCH_DEPTH> inline_stack;
+    std::vector<BatchLanes> heap_stack;
+    BatchLanes* stack = inline_stack.data();
+    if(max_depth_ > INLINE_BATCH_DEPTH)
+    {
+        heap_stack.resize(max_depth_);
+        stack = heap_stack.data();
+    }
+
+    // Лишние дорожки сразу отмечены ошибкой: ячейки для них не читаются
+    BatchErrors errors;
+    for(size_t i = 0; i < BATCH_SIZE; ++i)
+    {
+        errors.failed[i] = i >= count;
+        errors.categories[i] = FormulaError::Category::Value;
+    }
+    std::array<std::uint8_t, BATCH_SIZE> zero_divisor;
+    int top = 0;
+    for(const Instruction& instruction : code_)
+    {
+        switch(instruction.code)
+        {
+            case OpCode::PushNumber:
+                stack[top++].fill(instruction.number);
+                break;
+            case OpCode::PushError:
+                stack[top++].fill(0.0);
+                for(size_t i = 0; i < BATCH_SIZE; ++i)
+                {
+                    errors.Fail(i, instruction.error);
+                }
+                break;
+            case OpCode::PushCell:
+                ReadBatchCells(sheet, offset.Apply(Position{instruction.cell.row, instruction.cell.col}),
+                               stack[top++], errors);
+                break;
+            case OpCode::Add:
+                --top;
+                for(size_t i = 0; i < BATCH_SIZE; ++i)
+                {
+                    stack[top - 1][i] += stack[top][i];
+                }
+                errors.CheckResults(stack[top - 1]);
+                break;
+            case OpCode::Subtract:
+                --top;
+                for(size_t i = 0; i < BATCH_SIZE; ++i)
+                {
+                    stack[top - 1][i] -= stack[top][i];
+                }
+                errors.CheckResults(stack[top - 1]);
+                break;
+            case OpCode::Multiply:
+                --top;
+                for(size_t i = 0; i < BATCH_SIZE; ++i)
+                {
+                    stack[top - 1][i] *= stack[top][i];
+                }
+                errors.CheckResults(stack[top - 1]);
+                break;
+            case OpCode::Divide:
+                --top;
+                for(size_t i = 0; i < BATCH_SIZE; ++i)
+                {
+                    zero_divisor[i] = stack[top][i] == 0.0;
+                }
+                errors.FailArithmetic(zero_divisor);
+                for(size_t i = 0; i < BATCH_SIZE; ++i)
+                {
+                    stack[top - 1][i] /= stack[top][i];
+                }
+                errors.CheckResults(stack[top - 1]);
+                break;
+            case OpCode::Negate:
+                for(size_t i = 0; i < BATCH_SIZE; ++i)
+                {
+                    stack[top - 1][i] = -stack[top - 1][i];
+                }
+                break;
+            default:
+                // Диапазоны и функции в пачке не вычисляются, см. IsBatchable
+                assert(false);
+                break;
+        }
+    }
+    assert(top == 1);
+    for(size_t i = 0; i < count; ++i)
+    {
+        if(errors.failed[i])
+        {
+            results[i] = FormulaError(errors.categories[i]);
+        }
+        else
+        {
+            results[i] = stack[0][i];
+        }
+    }
+}
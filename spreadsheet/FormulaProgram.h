@@ -0,0 +1,130 @@
+#pragma once
+
+#include "common.h"
+#include "formula.h"
+
+#include <cstdint>
+#include <vector>
+
+// Формула, скомпилированная в плоский байткод в постфиксной записи.
+// Константы и адреса ячеек хранятся прямо в инструкциях, поэтому вычисление -
+// это один проход по массиву с небольшим стеком чисел, без обхода дерева и
+// виртуальных вызовов.
+//
+// Агрегатная функция компилируется в BeginCall, по инструкции на каждый
+// аргумент и EndCall. Аргументы не копятся на стеке, а сразу сворачиваются
+// в накопитель вызова: числовой аргумент - AccumulateValue, диапазон -
+// AccumulateRange, который собирает числа ячеек в буфер и обрабатывает его
+// векторными ядрами из aggregate_kernels.h.
+//
+// Константы сворачиваются уже при записи программы: операция над двумя
+// числами, смена знака числа и вызов функции от одних чисел заменяются
+// результатом, двойная смена знака убирается. Ошибка константного
+// выражения (1/0) становится инструкцией PushError на его месте, поэтому
+// порядок ошибок при вычислении не меняется, а формула без ссылок
+// сворачивается в одну инструкцию. Дерево формулы для печати не меняется.
+class FormulaProgram {
+public:
+    enum class Function : std::uint8_t {
+        Sum,
+        Average,
+        Min,
+        Max,
+        Count,
+    };
+
+    enum class OpCode : std::uint8_t {
+        PushNumber,
+        PushError,
+        PushCell,
+        PushRange,
+        Add,
+        Subtract,
+        Multiply,
+        Divide,
+        Negate,
+        BeginCall,
+        AccumulateValue,
+        AccumulateRange,
+        EndCall,
+    };
+
+    struct CellOperand {
+        int row;
+        int col;
+    };
+
+    struct Instruction {
+        OpCode code;
+        union {
+            double number;
+            FormulaError::Category error;
+            CellOperand cell;
+            // Номер диапазона в таблице программы
+            std::uint32_t range;
+            Function function;
+        };
+    };
+
+    void EmitNumber(double value);
+    void EmitCell(Position pos);
+    void EmitRange(const CellRange& range);
+    void EmitOperation(OpCode code);
+    void EmitBeginCall(Function function);
+    // Добавляет текущую вершину стека к аргументам вызова
+    void EmitAccumulateValue();
+    void EmitAccumulateRange(const CellRange& range);
+    void EmitEndCall();
+
+    // Вычисляет программу. Ошибки возвращаются значением, исключения не
+    // бросаются: первая же ошибка операнда или арифметики прерывает вычисление.
+    // totals - итоги диапазонов программы в порядке GetRanges() или nullptr:
+    // действительный итог заменяет чтение диапазона, прочитанный диапазон
+    // сохраняет свой итог. Ссылки программы сдвигаются на offset: так одна
+    // программа вычисляет все копии формулы протянутого столбца.
+    FormulaInterface::Value Execute(const SheetInterface& sheet, RangeTotal* totals = nullptr,
+                                    PositionOffset offset = {}) const;
+
+    // Программу без диапазонов и агрегатных функций можно вычислять пачкой
+    bool IsBatchable() const {
+        return ranges_.empty() && calls_ == 0;
+    }
+
+    // Вычисляет count <= FormulaInterface::BATCH_SIZE копий программы,
+    // сдвинутых на offset, offset и ещё одну строку и т.д. - ячейки
+    // протянутого столбца подряд. Значения и ошибки те же, что у Execute
+    // для каждой копии, но каждая инструкция обрабатывает всю пачку сразу,
+    // а ошибки копий хранятся маской, не прерывая вычисление остальных.
+    void ExecuteBatch(const SheetInterface& sheet, PositionOffset offset, size_t count,
+                      FormulaInterface::Value* results) const;
+
+    const std::vector<Instruction>& GetCode() const {
+        return code_;
+    }
+    const std::vector<CellRange>& GetRanges() const {
+        return ranges_;
+    }
+
+private:
+    std::vector<Instruction> code_;
+    std::vector<CellRange> ranges_;
+    int depth_ = 0;
+    int max_depth_ = 0;
+    int call_depth_ = 0;
+    int max_call_depth_ = 0;
+    // Начала открытых вызовов в code_
+    std::vector<size_t> call_starts_;
+    // Число несвёрнутых вызовов
+    size_t calls_ = 0;
+
+    void UpdateDepth(int delta);
+    std::uint32_t AddRange(const CellRange& range);
+
+    static bool IsConstant(const Instruction& instruction);
+    static Instruction MakeConstant(const FormulaInterface::Value& value);
+    // Сворачивают операцию или вызов, начатый в code_[start], если их
+    // операнды - константы в конце code_
+    bool FoldNegate();
+    bool FoldBinary(OpCode code);
+    bool FoldCall(size_t start);
+};
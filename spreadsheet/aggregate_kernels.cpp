@@ -0,0 +1,151 @@
+#include "aggregate_kernels.h"
+
+#include <algorithm>
+#include <cassert>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define SPREADSHEET_AVX2 1
+#include <immintrin.h>
+#endif
+
+namespace aggregate {
+
+namespace {
+const size_t LANES = 4;
+
+// Общее окончание суммы: частичные суммы по полосам, затем хвост
+double FinishSum(const double* lanes, const double* tail, size_t tail_count) {
+    double result = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for(size_t i = 0; i < tail_count; ++i)
+    {
+        result += tail[i];
+    }
+    return result;
+}
+
+#ifdef SPREADSHEET_AVX2
+__attribute__((target("avx2"))) double SumAvx2(const double* values, size_t count) {
+    const size_t body = count - count % LANES;
+    __m256d sum = _mm256_setzero_pd();
+    for(size_t i = 0; i < body; i += LANES)
+    {
+        sum = _mm256_add_pd(sum, _mm256_loadu_pd(values + i));
+    }
+    double lanes[LANES];
+    _mm256_storeu_pd(lanes, sum);
+    return FinishSum(lanes, values + body, count - body);
+}
+
+__attribute__((target("avx2"))) double MinAvx2(const double* values, size_t count) {
+    const size_t body = count - count % LANES;
+    if(body == 0)
+    {
+        return MinScalar(values, count);
+    }
+    __m256d result = _mm256_loadu_pd(values);
+    for(size_t i = LANES; i < body; i += LANES)
+    {
+        result = _mm256_min_pd(result, _mm256_loadu_pd(values + i));
+    }
+    double lanes[LANES];
+    _mm256_storeu_pd(lanes, result);
+    double min = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+    for(size_t i = body; i < count; ++i)
+    {
+        min = std::min(min, values[i]);
+    }
+    return min;
+}
+
+__attribute__((target("avx2"))) double MaxAvx2(const double* values, size_t count) {
+    const size_t body = count - count % LANES;
+    if(body == 0)
+    {
+        return MaxScalar(values, count);
+    }
+    __m256d result = _mm256_loadu_pd(values);
+    for(size_t i = LANES; i < body; i += LANES)
+    {
+        result = _mm256_max_pd(result, _mm256_loadu_pd(values + i));
+    }
+    double lanes[LANES];
+    _mm256_storeu_pd(lanes, result);
+    double max = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    for(size_t i = body; i < count; ++i)
+    {
+        max = std::max(max, values[i]);
+    }
+    return max;
+}
+
+// Проверка идёт при первом вызове ядра, возможно ещё из статических
+// инициализаторов других файлов: до них __builtin_cpu_supports без
+// __builtin_cpu_init не работает
+bool DetectAvx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+}  // namespace
+
+double SumScalar(const double* values, size_t count) {
+    const size_t body = count - count % LANES;
+    double lanes[LANES] = {0.0, 0.0, 0.0, 0.0};
+    for(size_t i = 0; i < body; i += LANES)
+    {
+        for(size_t lane = 0; lane < LANES; ++lane)
+        {
+            lanes[lane] += values[i + lane];
+        }
+    }
+    return FinishSum(lanes, values + body, count - body);
+}
+
+double MinScalar(const double* values, size_t count) {
+    assert(count > 0);
+    return *std::min_element(values, values + count);
+}
+
+double MaxScalar(const double* values, size_t count) {
+    assert(count > 0);
+    return *std::max_element(values, values + count);
+}
+
+#ifdef SPREADSHEET_AVX2
+double Sum(const double* values, size_t count) {
+    return HasAvx2() ? SumAvx2(values, count) : SumScalar(values, count);
+}
+
+double Min(const double* values, size_t count) {
+    assert(count > 0);
+    return HasAvx2() ? MinAvx2(values, count) : MinScalar(values, count);
+}
+
+double Max(const double* values, size_t count) {
+    assert(count > 0);
+    return HasAvx2() ? MaxAvx2(values, count) : MaxScalar(values, count);
+}
+#else
+double Sum(const double* values, size_t count) {
+    return SumScalar(values, count);
+}
+
+double Min(const double* values, size_t count) {
+    return MinScalar(values, count);
+}
+
+double Max(const double* values, size_t count) {
+    return MaxScalar(values, count);
+}
+#endif
+
+bool HasAvx2() {
+#ifdef SPREADSHEET_AVX2
+    static const bool has_avx2 = DetectAvx2();
+    return has_avx2;
+#else
+    return false;
+#endif
+}
+
+}  // namespace aggregate
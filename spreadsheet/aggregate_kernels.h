@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+
+// Ядра агрегатных функций над непрерывным массивом чисел. На x86-64 с AVX2
+// суммирование идёт по четыре числа за инструкцию, иначе работает скалярная
+// версия. Обе версии складывают числа в одном и том же порядке (четыре
+// частичные суммы и общий хвост), поэтому результат не зависит от процессора.
+namespace aggregate {
+
+double Sum(const double* values, size_t count);
+// Для пустого массива Min и Max не определены
+double Min(const double* values, size_t count);
+double Max(const double* values, size_t count);
+
+// Скалярные версии - для проверки и сравнения в бенчмарках
+double SumScalar(const double* values, size_t count);
+double MinScalar(const double* values, size_t count);
+double MaxScalar(const double* values, size_t count);
+
+// Выбрана ли версия с AVX2
+bool HasAvx2();
+
+}  // namespace aggregate
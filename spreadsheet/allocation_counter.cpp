@@ -0,0 +1,81 @@
+#include "allocation_counter.h"
+
+#include <cstdlib>
+#include <new>
+
+// Подменённые операторы определены в отдельном файле: иначе компилятор
+// встраивает delete в место вызова и принимает free для памяти из
+// встроенного operator new за несовпадающую пару (-Wmismatched-new-delete).
+// Подменены все обычные формы, и каждая пара сводится к malloc и free.
+
+namespace {
+
+thread_local size_t* allocation_count = nullptr;
+
+void* Allocate(std::size_t size) noexcept {
+    if(allocation_count != nullptr)
+    {
+        ++*allocation_count;
+    }
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void* AllocateOrThrow(std::size_t size) {
+    if(void* ptr = Allocate(size))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+}  // namespace
+
+AllocationCounter::AllocationCounter()
+    : previous_(allocation_count)
+{
+    allocation_count = &count_;
+}
+
+AllocationCounter::~AllocationCounter() {
+    allocation_count = previous_;
+}
+
+void* operator new(std::size_t size) {
+    return AllocateOrThrow(size);
+}
+
+void* operator new[](std::size_t size) {
+    return AllocateOrThrow(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return Allocate(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return Allocate(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    std::free(ptr);
+}
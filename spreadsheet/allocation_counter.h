@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+
+// Подсчёт выделений памяти для тестов: по нему тесты проверяют, что методы
+// чтения не выделяют память. Глобальные operator new и delete подменены в
+// allocation_counter.cpp и считают выделения только в потоке, где жив
+// AllocationCounter. Файл собирается только в тесты.
+class AllocationCounter {
+public:
+    AllocationCounter();
+    ~AllocationCounter();
+    AllocationCounter(const AllocationCounter&) = delete;
+    AllocationCounter& operator=(const AllocationCounter&) = delete;
+
+    // Число выделений с момента создания счётчика
+    size_t GetCount() const {
+        return count_;
+    }
+
+private:
+    size_t count_ = 0;
+    size_t* previous_;
+};
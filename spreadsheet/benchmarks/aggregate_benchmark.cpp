@@ -0,0 +1,96 @@
+#include "benchmarks.h"
+#include "log_duration.h"
+
+#include "aggregate_kernels.h"
+#include "common.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std::literals;
+
+namespace {
+
+const int ROWS = 10000;
+const int KERNEL_ROUNDS = 100;
+
+// Значения занимают столбцы по ROWS строк. Сумма столбца цепочкой "+" лежит
+// под ним, общая сумма - под суммами столбцов.
+void RunColumnSum(int cells) {
+    const int cols = cells / ROWS;
+    const std::string label = std::to_string(cells / 1000) + "k cells"s;
+    auto values = CreateSheet();
+    auto chain = CreateSheet();
+    for(int col = 0; col < cols; ++col)
+    {
+        for(int row = 0; row < ROWS; ++row)
+        {
+            values->SetCell({row, col}, std::to_string(row % 100));
+            chain->SetCell({row, col}, std::to_string(row % 100));
+        }
+    }
+
+    const Position total{ROWS + 1, 0};
+    {
+        LOG_DURATION(label + ", SUM: set formula"s);
+        values->SetCell(total, "=SUM(A1:"s + Position{ROWS - 1, cols - 1}.ToString() + ")"s);
+    }
+    {
+        LOG_DURATION(label + ", + chain: set formulas"s);
+        std::string total_text = "="s;
+        for(int col = 0; col < cols; ++col)
+        {
+            std::string column_sum = "="s + Position{0, col}.ToString();
+            for(int row = 1; row < ROWS; ++row)
+            {
+                column_sum += "+"s + Position{row, col}.ToString();
+            }
+            chain->SetCell({ROWS, col}, std::move(column_sum));
+            total_text += (col == 0 ? ""s : "+"s) + Position{ROWS, col}.ToString();
+        }
+        chain->SetCell(total, std::move(total_text));
+    }
+
+    // Первое вычисление: формулы ещё ни разу не считались
+    for(auto [name, sheet] : {std::pair{"+ chain"s, chain.get()}, std::pair{"SUM"s, values.get()}})
+    {
+        LOG_DURATION(label + ", "s + name + ": evaluate"s);
+        std::cerr << "value: "s << sheet->GetCell(total)->GetValue() << std::endl;
+    }
+}
+
+void RunKernels() {
+    std::vector<double> values(1000000);
+    for(size_t i = 0; i < values.size(); ++i)
+    {
+        values[i] = static_cast<double>(i % 100);
+    }
+    std::cerr << "AVX2: "s << (aggregate::HasAvx2() ? "yes"s : "no"s) << std::endl;
+    double sum = 0.0;
+    {
+        LOG_DURATION("1M doubles x100, scalar sum"s);
+        for(int round = 0; round < KERNEL_ROUNDS; ++round)
+        {
+            sum += aggregate::SumScalar(values.data(), values.size());
+        }
+    }
+    {
+        LOG_DURATION("1M doubles x100, dispatched sum"s);
+        for(int round = 0; round < KERNEL_ROUNDS; ++round)
+        {
+            sum += aggregate::Sum(values.data(), values.size());
+        }
+    }
+    std::cerr << "checksum: "s << sum << std::endl;
+}
+
+}  // namespace
+
+void BenchmarkAggregates() {
+    RunKernels();
+    for(int cells : {10000, 100000, 1000000})
+    {
+        RunColumnSum(cells);
+    }
+}
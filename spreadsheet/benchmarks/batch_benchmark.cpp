@@ -0,0 +1,113 @@
+#include "benchmarks.h"
+#include "log_duration.h"
+
+#include "formula.h"
+#include "sheet.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std::literals;
+
+namespace {
+
+const int ROWS = 16000;
+const int FORMULA_COLS = 6;
+
+// В столбцах A, B, C числа, в следующих FORMULA_COLS столбцах протянутые
+// формулы от них: один уровень из 96k независимых ячеек
+void FillColumns(Sheet& sheet) {
+    for(int row = 0; row < ROWS; ++row)
+    {
+        sheet.SetCell({row, 0}, std::to_string(row % 100));
+        sheet.SetCell({row, 1}, std::to_string(row % 7 + 1));
+        sheet.SetCell({row, 2}, std::to_string(row % 13));
+    }
+    for(int col = 0; col < FORMULA_COLS; ++col)
+    {
+        for(int row = 0; row < ROWS; ++row)
+        {
+            const std::string a = Position{row, 0}.ToString();
+            const std::string b = Position{row, 1}.ToString();
+            const std::string c = Position{row, 2}.ToString();
+            sheet.SetCell({row, 3 + col}, "="s + a + "*"s + b + "+"s + c + "/("s + b + "-"s + std::to_string(col) + ".5)"s);
+        }
+    }
+}
+
+// Меняет все числа столбца A: все формулы устаревают
+void TouchInputs(Sheet& sheet, int round) {
+    for(int row = 0; row < ROWS; ++row)
+    {
+        sheet.SetCell({row, 0}, std::to_string((row + round) % 100));
+    }
+}
+
+double SumFormulas(const Sheet& sheet) {
+    double total = 0.0;
+    for(int col = 0; col < FORMULA_COLS; ++col)
+    {
+        for(int row = 0; row < ROWS; ++row)
+        {
+            total += std::get<double>(sheet.GetCell({row, 3 + col})->GetValue());
+        }
+    }
+    return total;
+}
+
+// Одна и та же формула столбца по ячейкам и пачками, без пересчёта листа
+void CompareEvaluators(const Sheet& sheet) {
+    const auto formula = ParseFormula("A1*B1+C1/(B1-0.5)"s);
+    const int rounds = 20;
+    std::vector<FormulaInterface::Value> results(ROWS);
+    {
+        LOG_DURATION("16k rows x20, Evaluate per cell"s);
+        for(int round = 0; round < rounds; ++round)
+        {
+            for(int row = 0; row < ROWS; ++row)
+            {
+                results[row] = formula->Evaluate(sheet, nullptr, {row, 0});
+            }
+        }
+    }
+    const double per_cell = std::get<double>(results[ROWS - 1]);
+    {
+        LOG_DURATION("16k rows x20, EvaluateBatch"s);
+        for(int round = 0; round < rounds; ++round)
+        {
+            for(int row = 0; row < ROWS; row += FormulaInterface::BATCH_SIZE)
+            {
+                const size_t count = std::min<size_t>(FormulaInterface::BATCH_SIZE, ROWS - row);
+                formula->EvaluateBatch(sheet, {row, 0}, count, &results[row]);
+            }
+        }
+    }
+    std::cerr << "last value: "s << per_cell << " / "s << std::get<double>(results[ROWS - 1]) << std::endl;
+}
+
+}  // namespace
+
+void BenchmarkBatchEvaluation() {
+    Sheet sheet;
+    FillColumns(sheet);
+    CompareEvaluators(sheet);
+    ThreadPool pool(0);
+    for(int round = 0; round < 3; ++round)
+    {
+        TouchInputs(sheet, round);
+        {
+            LOG_DURATION("96k formulas, serial GetValue"s);
+            std::cerr << "sum: "s << SumFormulas(sheet) << std::endl;
+        }
+        TouchInputs(sheet, round + 1);
+        TouchInputs(sheet, round);
+        {
+            LOG_DURATION("96k formulas, Recalculate with batches, 1 thread"s);
+            sheet.Recalculate(pool);
+        }
+        std::cerr << "sum: "s << SumFormulas(sheet) << std::endl;
+    }
+}
@@ -0,0 +1,61 @@
+#include "benchmarks.h"
+#include "log_duration.h"
+
+#include "sheet.h"
+
+#include <string>
+
+using namespace std::literals;
+
+namespace {
+
+const int FAN_OUT = 100000;
+const int EDITS = 1000;
+const int INPUTS = 10000;
+const int RANGE_FORMULAS = 1000;
+const int ROWS = 10000;
+
+// Формулы занимают столбцы начиная с C
+Position FormulaPosition(int i) {
+    return {i % ROWS, 2 + i / ROWS};
+}
+
+}  // namespace
+
+void BenchmarkBatchEdits() {
+    {
+        // 100k формул ссылаются на A1, A1 правится 1000 раз подряд
+        Sheet sheet;
+        sheet.SetCell({0, 0}, "0"s);
+        for(int i = 0; i < FAN_OUT; ++i)
+        {
+            sheet.SetCell(FormulaPosition(i), "=A1+"s + std::to_string(i));
+        }
+        sheet.GetCell(FormulaPosition(0))->GetValue();
+        LOG_DURATION("1000 edits of a cell with 100k dependents, then a read"s);
+        for(int i = 1; i <= EDITS; ++i)
+        {
+            sheet.SetCell({0, 0}, std::to_string(i));
+        }
+        sheet.GetCell(FormulaPosition(FAN_OUT - 1))->GetValue();
+    }
+    {
+        // 1000 формул суммируют столбец A из 10k чисел, каждое число правится
+        Sheet sheet;
+        for(int i = 0; i < INPUTS; ++i)
+        {
+            sheet.SetCell({i, 0}, "1"s);
+        }
+        for(int i = 0; i < RANGE_FORMULAS; ++i)
+        {
+            sheet.SetCell(FormulaPosition(i), "=SUM(A1:A10000)+"s + std::to_string(i));
+        }
+        sheet.GetCell(FormulaPosition(0))->GetValue();
+        LOG_DURATION("10k edits under 1000 range formulas, then a read"s);
+        for(int i = 0; i < INPUTS; ++i)
+        {
+            sheet.SetCell({i, 0}, "2"s);
+        }
+        sheet.GetCell(FormulaPosition(RANGE_FORMULAS - 1))->GetValue();
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+// Каждый бенчмарк печатает свои замеры в std::cerr.
+void BenchmarkStorage();
+void BenchmarkErrorPropagation();
+void BenchmarkRecalculation();
+void BenchmarkDeepChain();
+void BenchmarkCycleCheck();
+void BenchmarkGraphMemory();
+void BenchmarkRanges();
+void BenchmarkAggregates();
+void BenchmarkIncrementalAggregates();
+void BenchmarkParser();
+void BenchmarkFillDown();
+void BenchmarkBatchEvaluation();
+void BenchmarkConstantFolding();
+void BenchmarkReads();
+void BenchmarkCellMemory();
+void BenchmarkEarlyCutoff();
+void BenchmarkBatchEdits();
+void BenchmarkBulkLoad();
+void BenchmarkTransactions();
+void BenchmarkImport();
+void BenchmarkSnapshot();
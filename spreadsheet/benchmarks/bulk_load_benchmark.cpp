@@ -0,0 +1,77 @@
+#include "benchmarks.h"
+
+#include "sheet.h"
+#include "thread_pool.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std::literals;
+
+namespace {
+
+const int ROWS = 10000;
+const int COLS = 99;
+
+// Тройки столбцов: числа, протянутая формула и формула с уникальной
+// константой, которую нужно разобрать отдельно. Строка итогов суммирует
+// каждый столбец. Ячейки идут по строкам, как при выгрузке листа.
+std::vector<std::pair<Position, std::string>> MakeCells() {
+    std::vector<std::pair<Position, std::string>> cells;
+    cells.reserve(ROWS * COLS + COLS);
+    for(int row = 0; row < ROWS; ++row)
+    {
+        for(int col = 0; col < COLS; col += 3)
+        {
+            const std::string number = Position{row, col}.ToString();
+            cells.emplace_back(Position{row, col}, std::to_string(row % 97));
+            cells.emplace_back(Position{row, col + 1}, "="s + number + "*2+1"s);
+            cells.emplace_back(Position{row, col + 2},
+                               "="s + Position{row, col + 1}.ToString() + "+"s + std::to_string(row * COLS + col));
+        }
+    }
+    for(int col = 0; col < COLS; ++col)
+    {
+        cells.emplace_back(Position{ROWS, col},
+                           "=SUM("s + Position{0, col}.ToString() + ":"s + Position{ROWS - 1, col}.ToString() + ")"s);
+    }
+    return cells;
+}
+
+template <typename Func>
+void Measure(const std::string& name, size_t cells, Func func) {
+    const auto start = std::chrono::steady_clock::now();
+    func();
+    const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+    std::cerr << name << ": "s << static_cast<long long>(duration.count() * 1000) << " ms, "s
+              << static_cast<long long>(cells / duration.count()) << " cells/s"s << std::endl;
+}
+
+}  // namespace
+
+void BenchmarkBulkLoad() {
+    const std::vector<std::pair<Position, std::string>> cells = MakeCells();
+    std::cerr << cells.size() << " cells"s << std::endl;
+    {
+        Sheet sheet;
+        Measure("SetCell per cell"s, cells.size(), [&] {
+            for(const auto& [pos, text] : cells)
+            {
+                sheet.SetCell(pos, text);
+            }
+        });
+    }
+    ThreadPool pool;
+    for(size_t threads : {size_t{0}, pool.GetConcurrency() - 1})
+    {
+        ThreadPool load_pool(threads);
+        std::vector<std::pair<Position, std::string>> copy = cells;
+        std::unique_ptr<Sheet> sheet;
+        Measure("BulkLoad, "s + std::to_string(threads + 1) + " thread(s)"s, cells.size(), [&] {
+            sheet = Sheet::BulkLoad(std::move(copy), load_pool);
+        });
+    }
+}
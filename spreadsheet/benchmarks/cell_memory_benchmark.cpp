@@ -0,0 +1,76 @@
+#include "benchmarks.h"
+
+#include "cell.h"
+#include "sheet.h"
+
+#include <functional>
+#include <iostream>
+#include <string>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+using namespace std::literals;
+
+namespace {
+
+const int ROWS = 12500;
+const int COLS = 8;
+const int CELLS = ROWS * COLS;
+
+size_t GetHeapBytes() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+// Память в куче на ячейку вместе с вершиной графа и хранилищем листа. В
+// столбце A лежат числа, на которые ссылаются формулы, - они не считаются.
+void Measure(const std::string& name, const std::function<std::string(int row, int col)>& make_text) {
+    Sheet sheet;
+    for(int row = 0; row < ROWS; ++row)
+    {
+        sheet.SetCell({row, 0}, std::to_string(row % 100));
+    }
+    const size_t heap_before = GetHeapBytes();
+    for(int col = 1; col <= COLS; ++col)
+    {
+        for(int row = 0; row < ROWS; ++row)
+        {
+            sheet.SetCell({row, col}, make_text(row, col));
+        }
+    }
+    const size_t heap_after = GetHeapBytes();
+    std::cerr << name << ": "s << (heap_after - heap_before) / CELLS << " bytes per cell"s << std::endl;
+}
+
+}  // namespace
+
+void BenchmarkCellMemory() {
+    if(GetHeapBytes() == 0)
+    {
+        std::cerr << "heap usage is not available"s << std::endl;
+        return;
+    }
+    std::cerr << "sizeof(Cell): "s << sizeof(Cell) << std::endl;
+    Measure("empty"s, [](int, int) {
+        return ""s;
+    });
+    Measure("short text"s, [](int row, int) {
+        return "item "s + std::to_string(row);
+    });
+    Measure("number"s, [](int row, int col) {
+        return std::to_string(row * col);
+    });
+    Measure("formula"s, [](int row, int) {
+        return "=A"s + std::to_string(row + 1) + "*2+1"s;
+    });
+    // У каждой формулы своя ссылка на пустую ячейку правее заполненных
+    // столбцов: в счёт входит и всё, что заводится ради ссылки
+    Measure("formula, absent reference"s, [](int row, int col) {
+        return "="s + Position{row, col + COLS}.ToString() + "*2+1"s;
+    });
+}
@@ -0,0 +1,81 @@
+#include "benchmarks.h"
+#include "log_duration.h"
+
+#include "common.h"
+
+#include <string>
+
+using namespace std::literals;
+
+namespace {
+
+const int CHAIN_LENGTH = 1000000;
+const int ROWS = 10000;
+const int EDITED_CHAIN_LENGTH = 100000;
+const int EDITS = 1000;
+
+Position ChainPosition(int i) {
+    return {i % ROWS, i / ROWS};
+}
+
+}  // namespace
+
+void BenchmarkDeepChain() {
+    auto sheet = CreateSheet();
+    {
+        LOG_DURATION("build 1M-cell chain"s);
+        for(int i = CHAIN_LENGTH - 1; i > 0; --i)
+        {
+            sheet->SetCell(ChainPosition(i), "="s + ChainPosition(i - 1).ToString() + "+1"s);
+        }
+        sheet->SetCell(ChainPosition(0), "1"s);
+    }
+
+    const CellInterface* last = sheet->GetCell(ChainPosition(CHAIN_LENGTH - 1));
+    {
+        LOG_DURATION("evaluate chain end"s);
+        std::cerr << "value: "s << last->GetValue() << std::endl;
+    }
+    {
+        LOG_DURATION("invalidate whole chain"s);
+        sheet->SetCell(ChainPosition(0), "2"s);
+    }
+    {
+        LOG_DURATION("re-evaluate chain end"s);
+        std::cerr << "value: "s << last->GetValue() << std::endl;
+    }
+    {
+        LOG_DURATION("reject cycle through whole chain"s);
+        try
+        {
+            sheet->SetCell(ChainPosition(0), "="s + ChainPosition(CHAIN_LENGTH - 1).ToString());
+        }
+        catch(const CircularDependencyException&)
+        {
+            std::cerr << "cycle detected"s << std::endl;
+        }
+    }
+}
+
+void BenchmarkCycleCheck() {
+    auto sheet = CreateSheet();
+    {
+        // Каждая новая формула ссылается на всю уже построенную цепочку
+        LOG_DURATION("build 100k chain in forward order"s);
+        sheet->SetCell(ChainPosition(0), "1"s);
+        for(int i = 1; i < EDITED_CHAIN_LENGTH; ++i)
+        {
+            sheet->SetCell(ChainPosition(i), "="s + ChainPosition(i - 1).ToString() + "+1"s);
+        }
+    }
+    {
+        // Полный обход проверил бы на каждой правке всю цепочку под концом
+        LOG_DURATION("edit formula at chain end 1000 times"s);
+        const Position last = ChainPosition(EDITED_CHAIN_LENGTH - 1);
+        const std::string prev = ChainPosition(EDITED_CHAIN_LENGTH - 2).ToString();
+        for(int i = 0; i < EDITS; ++i)
+        {
+            sheet->SetCell(last, "="s + prev + "+"s + std::to_string(i));
+        }
+    }
+}
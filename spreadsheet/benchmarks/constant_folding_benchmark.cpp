@@ -0,0 +1,60 @@
+#include "benchmarks.h"
+#include "log_duration.h"
+
+#include "FormulaAST.h"
+#include "formula.h"
+#include "sheet.h"
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std::literals;
+
+namespace {
+
+const int ROWS = 16000;
+const int ROUNDS = 20;
+
+// Формулы с постоянными частями, какие пишут в листах: коэффициенты,
+// пересчёт единиц, суммы констант
+const std::vector<std::string> FORMULAS = {
+    "A1*(1+0.2)"s,
+    "A1/(60*60*24)"s,
+    "(A1-32)*5/9+273.15*2/2"s,
+    "A1*SUM(1,2,3,4)/MAX(2,3)"s,
+    "-(-A1)+(1/3+2/3)*100"s,
+    "(2+3)*4/-(-2)-SUM(1,2,3)"s,
+};
+
+size_t CountInstructions(const std::string& formula) {
+    return ParseFormulaAST(formula).Compile().GetCode().size();
+}
+
+}  // namespace
+
+void BenchmarkConstantFolding() {
+    Sheet sheet;
+    for(int row = 0; row < ROWS; ++row)
+    {
+        sheet.SetCell({row, 0}, std::to_string(row % 100));
+    }
+    std::vector<FormulaInterface::Value> results(ROWS);
+    for(const std::string& text : FORMULAS)
+    {
+        const auto formula = ParseFormula(text);
+        std::cerr << text << ": "s << CountInstructions(text) << " instructions"s << std::endl;
+        {
+            LOG_DURATION("  16k rows x20, Evaluate per cell"s);
+            for(int round = 0; round < ROUNDS; ++round)
+            {
+                for(int row = 0; row < ROWS; ++row)
+                {
+                    results[row] = formula->Evaluate(sheet, nullptr, {row, 0});
+                }
+            }
+        }
+        std::cerr << "  last value: "s << std::get<double>(results[ROWS - 1]) << std::endl;
+    }
+}
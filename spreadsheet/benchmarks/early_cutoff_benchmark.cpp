@@ -0,0 +1,68 @@
+#include "benchmarks.h"
+#include "log_duration.h"
+
+#include "sheet.h"
+#include "thread_pool.h"
+
+#include <iostream>
+#include <string>
+
+using namespace std::literals;
+
+namespace {
+
+const int CHAIN_LENGTH = 100000;
+const int FAN_OUT = 100000;
+const int ROWS = 10000;
+
+// Формулы занимают столбцы начиная с C
+Position FormulaPosition(int i) {
+    return {i % ROWS, 2 + i / ROWS};
+}
+
+// Правка в ячейке A1, от которой зависят 100k формул через B1 = MIN(A1,0)
+void Measure(Sheet& sheet, const std::string& name, Position pos, const std::string& text,
+             ThreadPool& pool) {
+    const size_t saved = sheet.GetSavedEvaluations();
+    {
+        LOG_DURATION(name);
+        sheet.SetCell(pos, text);
+        sheet.Recalculate(pool);
+    }
+    std::cerr << "saved evaluations: "s << sheet.GetSavedEvaluations() - saved << std::endl;
+}
+
+}  // namespace
+
+void BenchmarkEarlyCutoff() {
+    ThreadPool pool;
+    {
+        // Цепочка C1 = B1+1, C2 = C1+1, ...
+        Sheet sheet;
+        sheet.SetCell({0, 0}, "1"s);
+        sheet.SetCell({0, 1}, "=MIN(A1,0)"s);
+        sheet.SetCell(FormulaPosition(0), "=B1+1"s);
+        for(int i = 1; i < CHAIN_LENGTH; ++i)
+        {
+            sheet.SetCell(FormulaPosition(i), "="s + FormulaPosition(i - 1).ToString() + "+1"s);
+        }
+        sheet.Recalculate(pool);
+        Measure(sheet, "100k chain: 1 -> 1.0"s, {0, 0}, "1.0"s, pool);
+        Measure(sheet, "100k chain: change absorbed by MIN"s, {0, 0}, "2"s, pool);
+        Measure(sheet, "100k chain: formula with the same value"s, {0, 1}, "=MIN(A1,0)*1"s, pool);
+        Measure(sheet, "100k chain: value changes"s, {0, 0}, "-1"s, pool);
+    }
+    {
+        // 100k формул ссылаются на B1 напрямую
+        Sheet sheet;
+        sheet.SetCell({0, 0}, "1"s);
+        sheet.SetCell({0, 1}, "=MIN(A1,0)"s);
+        for(int i = 0; i < FAN_OUT; ++i)
+        {
+            sheet.SetCell(FormulaPosition(i), "=B1+"s + std::to_string(i));
+        }
+        sheet.Recalculate(pool);
+        Measure(sheet, "100k fan-out: change absorbed by MIN"s, {0, 0}, "2"s, pool);
+        Measure(sheet, "100k fan-out: value changes"s, {0, 0}, "-1"s, pool);
+    }
+}
@@ -0,0 +1,58 @@
+#include "benchmarks.h"
+#include "log_duration.h"
+
+#include "common.h"
+
+#include <string>
+
+using namespace std::literals;
+
+namespace {
+
+const int ROWS = 10000;
+const int COLS = 10;
+const int ROUNDS = 10;
+
+// Столбец A - входы, B = 1/A, каждый следующий столбец ссылается на
+// предыдущий. Если во входах нули, ошибкой оказывается каждая формула листа.
+std::unique_ptr<SheetInterface> MakeChainSheet() {
+    auto sheet = CreateSheet();
+    for(int row = 0; row < ROWS; ++row)
+    {
+        const std::string input = Position{row, 0}.ToString();
+        sheet->SetCell({row, 1}, "=1/"s + input);
+        for(int col = 2; col < COLS; ++col)
+        {
+            sheet->SetCell({row, col}, "="s + Position{row, col - 1}.ToString() + "+1"s);
+        }
+    }
+    return sheet;
+}
+
+void RunErrorScenario(const std::string& name, const std::string& even_input, const std::string& odd_input) {
+    auto sheet = MakeChainSheet();
+    size_t errors = 0;
+    LOG_DURATION(name);
+    for(int round = 0; round < ROUNDS; ++round)
+    {
+        for(int row = 0; row < ROWS; ++row)
+        {
+            sheet->SetCell({row, 0}, round % 2 == 0 ? even_input : odd_input);
+        }
+        for(int row = 0; row < ROWS; ++row)
+        {
+            for(int col = 1; col < COLS; ++col)
+            {
+                errors += std::holds_alternative<FormulaError>(sheet->GetCell({row, col})->GetValue());
+            }
+        }
+    }
+    std::cerr << name << ": "s << errors << " error values read"s << std::endl;
+}
+
+}  // namespace
+
+void BenchmarkErrorPropagation() {
+    RunErrorScenario("no errors"s, "1"s, "2"s);
+    RunErrorScenario("every formula is #ARITHM!"s, "0"s, "0.0"s);
+}
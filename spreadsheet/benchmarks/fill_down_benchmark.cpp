@@ -0,0 +1,72 @@
+#include "benchmarks.h"
+#include "log_duration.h"
+
+#include "common.h"
+
+#include <iostream>
+#include <string>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+using namespace std::literals;
+
+namespace {
+
+// Строк в листе не больше Position::MAX_ROWS, поэтому 100k формул - это
+// FORMULA_COLS протянутых столбцов по ROWS строк. В столбцах A и B числа,
+// формула столбца k ссылается на них и на столбец слева.
+const int ROWS = 12500;
+const int FORMULA_COLS = 8;
+const int FORMULAS = ROWS * FORMULA_COLS;
+
+// Байты, занятые в куче, если библиотека умеет их считать
+size_t GetHeapBytes() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+}  // namespace
+
+void BenchmarkFillDown() {
+    auto sheet = CreateSheet();
+    for(int row = 0; row < ROWS; ++row)
+    {
+        sheet->SetCell({row, 0}, std::to_string(row % 100));
+        sheet->SetCell({row, 1}, std::to_string(row % 7));
+    }
+
+    const size_t heap_before = GetHeapBytes();
+    {
+        LOG_DURATION("100k formula fill: set"s);
+        for(int col = 2; col < 2 + FORMULA_COLS; ++col)
+        {
+            for(int row = 0; row < ROWS; ++row)
+            {
+                const std::string a = Position{row, 0}.ToString();
+                const std::string b = Position{row, 1}.ToString();
+                const std::string left = Position{row, col - 1}.ToString();
+                sheet->SetCell({row, col}, "=("s + a + "+"s + b + ")*2-"s + left + "/4"s);
+            }
+        }
+    }
+    const size_t heap_after = GetHeapBytes();
+    if(heap_after != 0)
+    {
+        std::cerr << "heap per formula cell: "s << (heap_after - heap_before) / FORMULAS << " bytes"s << std::endl;
+    }
+
+    double total = 0.0;
+    {
+        LOG_DURATION("100k formula fill: evaluate"s);
+        for(int row = 0; row < ROWS; ++row)
+        {
+            total += std::get<double>(sheet->GetCell({row, 1 + FORMULA_COLS})->GetValue());
+        }
+    }
+    std::cerr << "sum: "s << total << std::endl;
+}
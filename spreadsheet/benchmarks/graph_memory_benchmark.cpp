@@ -0,0 +1,116 @@
+#include "benchmarks.h"
+
+#include "common.h"
+#include "dependency_graph.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using namespace std::literals;
+
+namespace {
+
+const int CELLS = 100000;
+
+size_t allocated_bytes = 0;
+
+// Считает память, выделенную контейнерами прежнего представления
+template <typename T>
+struct CountingAllocator {
+    using value_type = T;
+
+    CountingAllocator() = default;
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U>&) {
+    }
+
+    T* allocate(size_t n) {
+        allocated_bytes += n * sizeof(T);
+        return std::allocator<T>{}.allocate(n);
+    }
+    void deallocate(T* p, size_t n) {
+        allocated_bytes -= n * sizeof(T);
+        std::allocator<T>{}.deallocate(p, n);
+    }
+
+    template <typename U>
+    bool operator==(const CountingAllocator<U>&) const {
+        return true;
+    }
+};
+
+using PositionSet = std::unordered_set<Position, PositionHasher, std::equal_to<Position>, CountingAllocator<Position>>;
+
+// Рёбра ячейки до переноса в общий граф: два хеш-множества в каждой ячейке
+struct PerCellEdges {
+    PositionSet parents_cells;
+    PositionSet child_cells;
+};
+
+Position CellPosition(int i) {
+    return {i / 100, i % 100};
+}
+
+// Каждая ячейка ссылается на 0-3 ячейки выше себя
+std::vector<std::vector<int>> MakeReferences() {
+    std::mt19937 generator(7);
+    std::vector<std::vector<int>> references(CELLS);
+    for(int i = 1; i < CELLS; ++i)
+    {
+        const int count = std::uniform_int_distribution<int>(0, 3)(generator);
+        for(int k = 0; k < count; ++k)
+        {
+            const int reference = std::uniform_int_distribution<int>(std::max(0, i - 1000), i - 1)(generator);
+            if(std::find(references[i].begin(), references[i].end(), reference) == references[i].end())
+            {
+                references[i].push_back(reference);
+            }
+        }
+    }
+    return references;
+}
+
+}  // namespace
+
+void BenchmarkGraphMemory() {
+    const auto references = MakeReferences();
+
+    {
+        std::vector<PerCellEdges> cells(CELLS);
+        for(int i = 0; i < CELLS; ++i)
+        {
+            for(int reference : references[i])
+            {
+                cells[i].child_cells.insert(CellPosition(reference));
+                cells[reference].parents_cells.insert(CellPosition(i));
+            }
+        }
+        const size_t bytes = sizeof(PerCellEdges) * CELLS + allocated_bytes;
+        std::cerr << "per-cell unordered_set: "s << bytes / CELLS << " bytes per cell"s << std::endl;
+    }
+
+    {
+        DependencyGraph graph;
+        std::vector<CellId> ids;
+        for(int i = 0; i < CELLS; ++i)
+        {
+            ids.push_back(graph.AddNode(nullptr, false));
+        }
+        for(int i = 0; i < CELLS; ++i)
+        {
+            std::vector<CellId> cell_references;
+            for(int reference : references[i])
+            {
+                cell_references.push_back(ids[reference]);
+            }
+            graph.SetReferences(ids[i], cell_references);
+        }
+        std::cerr << "DependencyGraph: "s << graph.GetMemoryUsage() / CELLS << " bytes per cell"s << std::endl;
+    }
+}
@@ -0,0 +1,82 @@
+#include "benchmarks.h"
+
+#include "sheet.h"
+#include "sheet_import.h"
+#include "thread_pool.h"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+using namespace std::literals;
+
+namespace {
+
+const int ROWS = 16000;
+const int COLS = 100;
+
+// Вывод PrintTexts листа из ROWS x COLS ячеек. Ячейки с формулами
+// встречаются с частотой 1 / formula_period.
+std::string MakeTexts(int formula_period) {
+    Sheet sheet;
+    for(int row = 0; row < ROWS; ++row)
+    {
+        for(int col = 0; col < COLS; ++col)
+        {
+            const int i = row * COLS + col;
+            if(formula_period != 0 && i % formula_period == 0 && col + 1 < COLS)
+            {
+                sheet.SetCell({row, col}, "="s + Position{row, col + 1}.ToString() + "*"s + std::to_string(i % 1000));
+            }
+            else
+            {
+                sheet.SetCell({row, col}, (i % 3 == 0 ? "item "s : ""s) + std::to_string(i));
+            }
+        }
+    }
+    std::ostringstream output;
+    sheet.PrintTexts(output);
+    return output.str();
+}
+
+template <typename Func>
+void Measure(const std::string& name, size_t bytes, Func func) {
+    const auto start = std::chrono::steady_clock::now();
+    func();
+    const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+    std::cerr << name << ": "s << static_cast<long long>(duration.count() * 1000) << " ms, "s
+              << static_cast<long long>(bytes / duration.count() / 1'000'000) << " MB/s"s << std::endl;
+}
+
+}  // namespace
+
+void BenchmarkImport() {
+    ThreadPool pool;
+    for(int formula_period : {0, 10})
+    {
+        const std::string texts = MakeTexts(formula_period);
+        const std::string kind = formula_period == 0 ? "text only"s : "10% formulas"s;
+        std::cerr << kind << ": "s << texts.size() / 1'000'000 << " MB, "s << ROWS * COLS << " cells"s << std::endl;
+        std::unique_ptr<Sheet> sheet;
+        Measure("ImportSheet, "s + kind, texts.size(), [&] {
+            sheet = ImportSheet(texts, TextFormat::Tsv, pool);
+        });
+        sheet.reset();
+
+        const std::string path = (std::filesystem::temp_directory_path() / "spreadsheet_import_benchmark.tsv").string();
+        {
+            std::ofstream file(path);
+            file << texts;
+        }
+        Measure("ImportSheetFile, "s + kind, texts.size(), [&] {
+            sheet = ImportSheetFile(path, TextFormat::Tsv, pool);
+        });
+        sheet.reset();
+        std::filesystem::remove(path);
+    }
+}
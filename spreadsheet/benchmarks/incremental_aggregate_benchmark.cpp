@@ -0,0 +1,60 @@
+#include "benchmarks.h"
+#include "log_duration.h"
+
+#include "common.h"
+#include "formula.h"
+
+#include <iostream>
+#include <string>
+
+using namespace std::literals;
+
+namespace {
+
+const int ROWS = 10000;
+const int COLS = 100;
+const int EDITS = 1000;
+const int FULL_SCAN_EDITS = 10;
+
+}  // namespace
+
+void BenchmarkIncrementalAggregates() {
+    auto sheet = CreateSheet();
+    for(int col = 0; col < COLS; ++col)
+    {
+        for(int row = 0; row < ROWS; ++row)
+        {
+            sheet->SetCell({row, col}, std::to_string(row % 100));
+        }
+    }
+    const std::string range = "A1:"s + Position{ROWS - 1, COLS - 1}.ToString();
+    const Position total{ROWS, 0};
+    for(const std::string& function : {"SUM"s, "AVERAGE"s, "MAX"s})
+    {
+        const std::string expression = function + "("s + range + ")"s;
+        sheet->SetCell(total, "="s + expression);
+        {
+            LOG_DURATION("1M cells, "s + function + ": first evaluation"s);
+            sheet->GetCell(total)->GetValue();
+        }
+        {
+            LOG_DURATION("1M cells, "s + function + ": 1000 edits, maintained total"s);
+            for(int i = 0; i < EDITS; ++i)
+            {
+                sheet->SetCell({(i * 7919) % ROWS, i % COLS}, std::to_string(i % 50));
+                sheet->GetCell(total)->GetValue();
+            }
+        }
+        // Прежнее поведение: каждое вычисление перечитывает весь диапазон
+        auto formula = ParseFormula(expression);
+        {
+            LOG_DURATION("1M cells, "s + function + ": 10 edits, full range scan"s);
+            for(int i = 0; i < FULL_SCAN_EDITS; ++i)
+            {
+                sheet->SetCell({(i * 7919) % ROWS, i % COLS}, std::to_string(i % 50));
+                formula->Evaluate(*sheet);
+            }
+        }
+        std::cerr << "value: "s << sheet->GetCell(total)->GetValue() << std::endl;
+    }
+}
@@ -0,0 +1,50 @@
+#include "benchmarks.h"
+
+#include <functional>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std::literals;
+
+// Запуск без аргументов выполняет все бенчмарки, иначе - только перечисленные.
+int main(int argc, char** argv) {
+    const std::vector<std::pair<std::string, std::function<void()>>> benchmarks = {
+        {"storage"s, BenchmarkStorage},
+        {"errors"s, BenchmarkErrorPropagation},
+        {"recalculation"s, BenchmarkRecalculation},
+        {"chain"s, BenchmarkDeepChain},
+        {"cycle-check"s, BenchmarkCycleCheck},
+        {"graph-memory"s, BenchmarkGraphMemory},
+        {"ranges"s, BenchmarkRanges},
+        {"aggregates"s, BenchmarkAggregates},
+        {"incremental-aggregates"s, BenchmarkIncrementalAggregates},
+        {"parser"s, BenchmarkParser},
+        {"fill-down"s, BenchmarkFillDown},
+        {"batch"s, BenchmarkBatchEvaluation},
+        {"constant-folding"s, BenchmarkConstantFolding},
+        {"reads"s, BenchmarkReads},
+        {"cell-memory"s, BenchmarkCellMemory},
+        {"early-cutoff"s, BenchmarkEarlyCutoff},
+        {"batch-edits"s, BenchmarkBatchEdits},
+        {"bulk-load"s, BenchmarkBulkLoad},
+        {"transactions"s, BenchmarkTransactions},
+        {"import"s, BenchmarkImport},
+        {"snapshot"s, BenchmarkSnapshot},
+    };
+
+    for(const auto& [name, benchmark] : benchmarks)
+    {
+        bool selected = argc == 1;
+        for(int i = 1; i < argc; ++i)
+        {
+            selected = selected || name == argv[i];
+        }
+        if(selected)
+        {
+            std::cerr << "=== "s << name << " ==="s << std::endl;
+            benchmark();
+        }
+    }
+}
@@ -0,0 +1,68 @@
+#include "benchmarks.h"
+
+#include "FormulaAST.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std::literals;
+
+namespace {
+
+const int FORMULAS = 200000;
+
+// Смесь формул, похожая на настоящие листы: короткие ссылки с арифметикой,
+// числа, диапазоны в функциях и длинные выражения
+std::vector<std::string> MakeFormulas() {
+    std::vector<std::string> formulas;
+    formulas.reserve(FORMULAS);
+    for(int i = 0; i < FORMULAS; ++i)
+    {
+        const std::string cell = Position{i % 1000, i % 26}.ToString();
+        const std::string other = Position{i % 997 + 1, (i + 7) % 52}.ToString();
+        switch(i % 4)
+        {
+            case 0:
+                formulas.push_back(cell + "+"s + other + "*2"s);
+                break;
+            case 1:
+                formulas.push_back("("s + cell + "-1.5e2)/"s + other + "-"s + std::to_string(i % 1000) + ".25"s);
+                break;
+            case 2:
+                formulas.push_back("SUM("s + cell + ":"s + other + ")/COUNT("s + cell + ":"s + other + ")"s);
+                break;
+            default:
+                formulas.push_back(cell + "*"s + other + "+-"s + cell + "/(1+"s + other + ")-MAX("s + cell + ","s
+                                   + other + ",0.5)"s);
+                break;
+        }
+    }
+    return formulas;
+}
+
+template <typename Parser>
+void Run(const std::string& name, const std::vector<std::string>& formulas, Parser parser) {
+    size_t cells = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for(const std::string& formula : formulas)
+    {
+        cells += parser(formula).GetReferencedCells().size();
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cerr << name << ": "s << static_cast<long long>(formulas.size() / elapsed.count()) << " formulas/s ("s
+              << cells << " references)"s << std::endl;
+}
+
+}  // namespace
+
+void BenchmarkParser() {
+    const auto formulas = MakeFormulas();
+    Run("descent parser"s, formulas, [](const std::string& text) {
+        return ParseFormulaAST(text);
+    });
+    Run("ANTLR parser"s, formulas, [](const std::string& text) {
+        return ParseFormulaASTWithAntlr(text);
+    });
+}
@@ -0,0 +1,55 @@
+#include "benchmarks.h"
+#include "log_duration.h"
+
+#include "common.h"
+#include "sheet.h"
+
+#include <iostream>
+#include <string>
+
+using namespace std::literals;
+
+namespace {
+
+const int VALUES = 500;
+const int FORMULAS = 1000;
+const int EDITS = 1000;
+
+// Формулы, покрывающие весь столбец значений: диапазоном или цепочкой "+"
+void RunRangeBenchmark(const std::string& name, const std::string& expression) {
+    Sheet sheet;
+    for(int row = 0; row < VALUES; ++row)
+    {
+        sheet.SetCell({row, 0}, std::to_string(row));
+    }
+    {
+        LOG_DURATION(name + ": set 1000 formulas"s);
+        for(int row = 0; row < FORMULAS; ++row)
+        {
+            sheet.SetCell({row, 2}, expression);
+        }
+    }
+    std::cerr << name << ": graph memory "s << sheet.GetDependencyGraph().GetMemoryUsage() / 1024 << " KiB"s << std::endl;
+    {
+        LOG_DURATION(name + ": 1000 writes into the column"s);
+        for(int i = 0; i < EDITS; ++i)
+        {
+            sheet.SetCell({i % VALUES, 0}, std::to_string(i));
+            // Сбрасываем кэш одной формулы, чтобы следующая запись снова
+            // обходила всех зависимых
+            sheet.GetCell({i % FORMULAS, 2})->GetValue();
+        }
+    }
+}
+
+}  // namespace
+
+void BenchmarkRanges() {
+    std::string chain = "=A1"s;
+    for(int row = 1; row < VALUES; ++row)
+    {
+        chain += "+"s + Position{row, 0}.ToString();
+    }
+    RunRangeBenchmark("A1+...+A500"s, chain);
+    RunRangeBenchmark("A1:A500"s, "=A1:A500"s);
+}
@@ -0,0 +1,123 @@
+#include "benchmarks.h"
+#include "log_duration.h"
+
+#include "sheet.h"
+
+#include <iostream>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <variant>
+
+using namespace std::literals;
+
+namespace {
+
+const int ROWS = 16000;
+const int ROUNDS = 10;
+
+// Поток, который отбрасывает вывод: меряется только чтение ячеек
+class NullBuffer : public std::streambuf {
+protected:
+    int_type overflow(int_type c) override {
+        return c;
+    }
+    std::streamsize xsputn(const char*, std::streamsize size) override {
+        return size;
+    }
+};
+
+// Столбцы: число, длинный текст, формула от них
+void Fill(Sheet& sheet) {
+    for(int row = 0; row < ROWS; ++row)
+    {
+        const std::string n = std::to_string(row + 1);
+        sheet.SetCell({row, 0}, std::to_string(row % 100));
+        sheet.SetCell({row, 1}, "imported description of row number "s + n);
+        sheet.SetCell({row, 2}, "=A"s + n + "*2+A"s + n + "/3"s);
+    }
+}
+
+}  // namespace
+
+void BenchmarkReads() {
+    Sheet sheet;
+    Fill(sheet);
+    size_t total = 0;
+    {
+        LOG_DURATION("48k cells x10, GetValue"s);
+        for(int round = 0; round < ROUNDS; ++round)
+        {
+            for(int row = 0; row < ROWS; ++row)
+            {
+                for(int col = 0; col < 3; ++col)
+                {
+                    total += sheet.GetCell({row, col})->GetValue().index();
+                }
+            }
+        }
+    }
+    {
+        LOG_DURATION("48k cells x10, GetValueView"s);
+        for(int round = 0; round < ROUNDS; ++round)
+        {
+            for(int row = 0; row < ROWS; ++row)
+            {
+                for(int col = 0; col < 3; ++col)
+                {
+                    total += sheet.GetValueView({row, col}).index();
+                }
+            }
+        }
+    }
+    {
+        LOG_DURATION("16k formulas x10, GetReferencedCells"s);
+        for(int round = 0; round < ROUNDS; ++round)
+        {
+            for(int row = 0; row < ROWS; ++row)
+            {
+                total += sheet.GetCell({row, 2})->GetReferencedCells().size();
+            }
+        }
+    }
+    {
+        LOG_DURATION("16k formulas x10, GetReferencedCellsView"s);
+        for(int round = 0; round < ROUNDS; ++round)
+        {
+            for(int row = 0; row < ROWS; ++row)
+            {
+                total += sheet.GetCell({row, 2})->GetReferencedCellsView().size();
+            }
+        }
+    }
+    NullBuffer buffer;
+    std::ostream output(&buffer);
+    {
+        LOG_DURATION("48k cells x10, output << GetText()"s);
+        for(int round = 0; round < ROUNDS; ++round)
+        {
+            for(int row = 0; row < ROWS; ++row)
+            {
+                for(int col = 0; col < 3; ++col)
+                {
+                    output << sheet.GetCell({row, col})->GetText();
+                }
+            }
+        }
+    }
+    {
+        LOG_DURATION("48k cells x10, PrintTexts"s);
+        for(int round = 0; round < ROUNDS; ++round)
+        {
+            sheet.PrintTexts(output);
+        }
+    }
+    {
+        LOG_DURATION("48k cells x10, PrintValues"s);
+        for(int round = 0; round < ROUNDS; ++round)
+        {
+            sheet.PrintValues(output);
+        }
+    }
+    std::cerr << "checksum: "s << total << std::endl;
+}
@@ -0,0 +1,67 @@
+#include "benchmarks.h"
+#include "log_duration.h"
+
+#include "sheet.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <thread>
+
+using namespace std::literals;
+
+namespace {
+
+const int ROWS = 10000;
+const int COLS = 20;
+
+// A1 - вход; под ним ROWS x COLS формул, каждая зависит от левой соседки и
+// от A1. Получается COLS уровней по ROWS независимых ячеек, всего 200k формул.
+void FillLevels(Sheet& sheet) {
+    sheet.SetCell({0, 0}, "1"s);
+    for(int row = 1; row <= ROWS; ++row)
+    {
+        sheet.SetCell({row, 0}, "=A1+"s + std::to_string(row));
+        for(int col = 1; col < COLS; ++col)
+        {
+            sheet.SetCell({row, col}, "="s + Position{row, col - 1}.ToString() + "*1.5-A1"s);
+        }
+    }
+}
+
+std::string PrintValues(const Sheet& sheet) {
+    std::ostringstream output;
+    sheet.PrintValues(output);
+    return output.str();
+}
+
+}  // namespace
+
+void BenchmarkRecalculation() {
+    Sheet sheet;
+    FillLevels(sheet);
+    std::string serial_values;
+    {
+        sheet.SetCell({0, 0}, "2"s);
+        LOG_DURATION("serial GetValue"s);
+        serial_values = PrintValues(sheet);
+    }
+
+    const size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    for(size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        // Фоновых потоков на один меньше: вызывающий поток тоже работает
+        ThreadPool pool(threads - 1);
+        sheet.SetCell({0, 0}, "1"s);
+        sheet.SetCell({0, 0}, "2"s);
+        {
+            LOG_DURATION("Recalculate, "s + std::to_string(threads) + " thread(s)"s);
+            sheet.Recalculate(pool);
+        }
+        if(PrintValues(sheet) != serial_values)
+        {
+            std::cerr << "results differ from serial evaluation"s << std::endl;
+        }
+    }
+}
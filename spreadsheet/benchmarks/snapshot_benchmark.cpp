@@ -0,0 +1,91 @@
+#include "benchmarks.h"
+
+#include "sheet.h"
+#include "sheet_import.h"
+#include "sheet_snapshot.h"
+#include "thread_pool.h"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+
+using namespace std::literals;
+
+namespace {
+
+const int ROWS = 16000;
+const int COLS = 100;
+// Каждая десятая ячейка - формула
+const int FORMULA_PERIOD = 10;
+
+std::unique_ptr<Sheet> MakeSheet(ThreadPool& pool) {
+    auto sheet = std::make_unique<Sheet>();
+    for(int row = 0; row < ROWS; ++row)
+    {
+        for(int col = 0; col < COLS; ++col)
+        {
+            const int i = row * COLS + col;
+            if(i % FORMULA_PERIOD == 0 && col + 1 < COLS)
+            {
+                sheet->SetCell({row, col}, "="s + Position{row, col + 1}.ToString() + "*"s + std::to_string(i % 1000));
+            }
+            else
+            {
+                sheet->SetCell({row, col}, (i % 3 == 0 ? "item "s : ""s) + std::to_string(i));
+            }
+        }
+    }
+    sheet->Recalculate(pool);
+    return sheet;
+}
+
+template <typename Func>
+void Measure(const std::string& name, Func func) {
+    const auto start = std::chrono::steady_clock::now();
+    func();
+    const std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+    std::cerr << name << ": "s << static_cast<long long>(duration.count() * 1000) << " ms"s << std::endl;
+}
+
+}  // namespace
+
+void BenchmarkSnapshot() {
+    ThreadPool pool;
+    std::unique_ptr<Sheet> sheet = MakeSheet(pool);
+    const auto directory = std::filesystem::temp_directory_path();
+    const std::string snapshot_path = (directory / "spreadsheet_snapshot_benchmark.bin").string();
+    const std::string texts_path = (directory / "spreadsheet_snapshot_benchmark.tsv").string();
+
+    Measure("SaveSnapshotFile"s, [&] {
+        SaveSnapshotFile(*sheet, snapshot_path);
+    });
+    Measure("PrintTexts to file"s, [&] {
+        std::ofstream file(texts_path);
+        sheet->PrintTexts(file);
+    });
+    std::cerr << "snapshot: "s << std::filesystem::file_size(snapshot_path) / 1'000'000 << " MB, TSV: "s
+              << std::filesystem::file_size(texts_path) / 1'000'000 << " MB, "s << ROWS * COLS << " cells"s << std::endl;
+    sheet.reset();
+
+    // Значения формул нужны сразу после загрузки: снимок хранит их, TSV - нет
+    Measure("LoadSnapshotFile"s, [&] {
+        sheet = LoadSnapshotFile(snapshot_path, pool);
+    });
+    Measure("Recalculate after LoadSnapshotFile"s, [&] {
+        sheet->Recalculate(pool);
+    });
+    sheet.reset();
+    Measure("ImportSheetFile"s, [&] {
+        sheet = ImportSheetFile(texts_path, TextFormat::Tsv, pool);
+    });
+    Measure("Recalculate after ImportSheetFile"s, [&] {
+        sheet->Recalculate(pool);
+    });
+    sheet.reset();
+
+    std::filesystem::remove(snapshot_path);
+    std::filesystem::remove(texts_path);
+}
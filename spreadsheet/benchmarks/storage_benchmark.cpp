@@ -0,0 +1,116 @@
+#include "benchmarks.h"
+#include "log_duration.h"
+
+#include "common.h"
+#include "tiled_storage.h"
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std::literals;
+
+namespace {
+
+// Заменитель ячейки: бенчмарк меряет только хранилище.
+struct BenchCell {
+    double value = 0.0;
+};
+
+class MapStorage {
+public:
+    BenchCell* Get(Position pos) const {
+        auto it = cells_.find(pos);
+        return it == cells_.end() ? nullptr : it->second.get();
+    }
+
+    void Set(Position pos, std::unique_ptr<BenchCell> cell) {
+        cells_[pos] = std::move(cell);
+    }
+
+private:
+    std::unordered_map<Position, std::unique_ptr<BenchCell>, PositionHasher> cells_;
+};
+
+std::vector<Position> MakePositions(int side, double density) {
+    std::vector<Position> positions;
+    std::mt19937 generator(42);
+    std::bernoulli_distribution is_set(density);
+    for(int row = 0; row < side; ++row)
+    {
+        for(int col = 0; col < side; ++col)
+        {
+            if(is_set(generator))
+            {
+                positions.push_back({row, col});
+            }
+        }
+    }
+    // Заполняем в случайном порядке, как при редактировании
+    std::shuffle(positions.begin(), positions.end(), generator);
+    return positions;
+}
+
+template <typename Storage>
+void RunScenario(const std::string& name, const std::vector<Position>& positions, int side) {
+    Storage storage;
+    {
+        LOG_DURATION(name + ": fill"s);
+        for(Position pos : positions)
+        {
+            storage.Set(pos, std::make_unique<BenchCell>(BenchCell{static_cast<double>(pos.row + pos.col)}));
+        }
+    }
+
+    double checksum = 0.0;
+    {
+        // Так читают ячейки PrintValues/PrintTexts
+        LOG_DURATION(name + ": row-major scan"s);
+        for(int row = 0; row < side; ++row)
+        {
+            for(int col = 0; col < side; ++col)
+            {
+                if(const BenchCell* cell = storage.Get({row, col}))
+                {
+                    checksum += cell->value;
+                }
+            }
+        }
+    }
+    {
+        // Так читает соседей формула вида =A1+B2+...
+        LOG_DURATION(name + ": neighbour lookups"s);
+        for(Position pos : positions)
+        {
+            for(Position neighbour : {Position{pos.row - 1, pos.col}, Position{pos.row, pos.col - 1},
+                                      Position{pos.row + 1, pos.col}, Position{pos.row, pos.col + 1}})
+            {
+                if(!neighbour.IsValid())
+                {
+                    continue;
+                }
+                if(const BenchCell* cell = storage.Get(neighbour))
+                {
+                    checksum += cell->value;
+                }
+            }
+        }
+    }
+    std::cerr << name << ": checksum "s << checksum << std::endl;
+}
+
+}  // namespace
+
+void BenchmarkStorage() {
+    const int side = 1000;  // 1M ячеек
+    const auto dense = MakePositions(side, 1.0);
+    const auto sparse = MakePositions(side, 0.01);
+
+    RunScenario<MapStorage>("unordered_map, dense"s, dense, side);
+    RunScenario<TiledStorage<BenchCell>>("tiled, dense"s, dense, side);
+    RunScenario<MapStorage>("unordered_map, 1% sparse"s, sparse, side);
+    RunScenario<TiledStorage<BenchCell>>("tiled, 1% sparse"s, sparse, side);
+}
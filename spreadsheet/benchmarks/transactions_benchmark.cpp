@@ -0,0 +1,105 @@
+#include "benchmarks.h"
+#include "log_duration.h"
+
+#include "sheet.h"
+
+#include <iostream>
+#include <string>
+
+using namespace std::literals;
+
+namespace {
+
+const int PASTE_ROWS = 5000;
+const int TOTALS = 100;
+
+std::string CellName(char col, int row) {
+    return col + std::to_string(row + 1);
+}
+
+// Столбец A - числа, столбец B - формулы по A, строка итогов под ними
+// суммирует столбец B
+void FillSheet(Sheet& sheet) {
+    for(int row = 0; row < PASTE_ROWS; ++row)
+    {
+        sheet.SetCell({row, 0}, std::to_string(row));
+        sheet.SetCell({row, 1}, "="s + CellName('A', row) + "*2"s);
+    }
+    for(int col = 0; col < TOTALS; ++col)
+    {
+        sheet.SetCell({PASTE_ROWS, col + 2}, "=SUM(B1:B"s + std::to_string(PASTE_ROWS) + ")+"s + std::to_string(col));
+    }
+    sheet.GetCell({PASTE_ROWS, 2})->GetValue();
+}
+
+// Вставка в столбец B цепочки, где каждая ячейка ссылается на следующую.
+// Старая цепочка в B шла в обратную сторону, поэтому каждая правка по
+// отдельности замыкает цикл со старой ячейкой ниже.
+template <typename Func>
+size_t PasteReversedChain(Func set_cell) {
+    size_t failed = 0;
+    for(int row = 0; row < PASTE_ROWS; ++row)
+    {
+        const std::string text = row + 1 < PASTE_ROWS ? "="s + CellName('B', row + 1) + "+1"s : "0"s;
+        try {
+            set_cell(Position{row, 1}, text);
+        }
+        catch (const CircularDependencyException&)
+        {
+            ++failed;
+        }
+    }
+    return failed;
+}
+
+}  // namespace
+
+void BenchmarkTransactions() {
+    {
+        Sheet sheet;
+        FillSheet(sheet);
+        LOG_DURATION("paste 5000 formulas with SetCell"s);
+        for(int row = 0; row < PASTE_ROWS; ++row)
+        {
+            sheet.SetCell({row, 1}, "="s + CellName('A', row) + "*3"s);
+        }
+        sheet.GetCell({PASTE_ROWS, 2})->GetValue();
+    }
+    {
+        Sheet sheet;
+        FillSheet(sheet);
+        LOG_DURATION("paste 5000 formulas in a transaction"s);
+        sheet.BeginTransaction();
+        for(int row = 0; row < PASTE_ROWS; ++row)
+        {
+            sheet.SetCell({row, 1}, "="s + CellName('A', row) + "*3"s);
+        }
+        sheet.Commit();
+        sheet.GetCell({PASTE_ROWS, 2})->GetValue();
+    }
+    for(bool transaction : {false, true})
+    {
+        Sheet sheet;
+        for(int row = 0; row < PASTE_ROWS; ++row)
+        {
+            sheet.SetCell({row, 1}, row == 0 ? "0"s : "="s + CellName('B', row - 1) + "+1"s);
+        }
+        size_t failed = 0;
+        {
+            LOG_DURATION(transaction ? "reverse a 5000-cell chain in a transaction"s
+                                     : "reverse a 5000-cell chain with SetCell"s);
+            if(transaction)
+            {
+                sheet.BeginTransaction();
+            }
+            failed = PasteReversedChain([&sheet](Position pos, const std::string& text) {
+                sheet.SetCell(pos, text);
+            });
+            if(transaction)
+            {
+                sheet.Commit();
+            }
+        }
+        std::cerr << "rejected edits: "s << failed << ", B1 = "s << sheet.GetCell({0, 1})->GetValue() << std::endl;
+    }
+}
@@ -1,229 +1,296 @@
 #include "cell.h"
+#include "sheet.h"
 
 #include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <optional>
+#include <utility>
+#include <vector>
 using namespace std::literals;
-class Cell::Impl {
-public:
-    Impl() = default;
-    virtual bool IsEmpty() const = 0;
-    virtual void Set(std::string&& str) = 0;
-    virtual std::string GetText() const = 0;
-    virtual CellInterface::Value GetValue() const = 0;
-    virtual std::vector<Position> GetReferencedCells()const = 0;
-    virtual ~Impl() = default;
-};
 
-class Cell::EmptyImpl : public Cell::Impl {
-public:
-    EmptyImpl() = default;
-    bool IsEmpty() const override{
-        return true;
-    }
-    void Set(std::string&& str) override{
-        user_defined_str_ = std::move(str);
-    }
-    std::string GetText() const override{
-        return user_defined_str_;
-    }
-    CellInterface::Value GetValue() const override{
-        return "";
-    }
-    std::vector<Position> GetReferencedCells() const override {
-        return {};
-    }
-    ~EmptyImpl() = default;
-private:
-    std::string user_defined_str_ = "";
-};
+namespace {
+// Числа совпадают вплоть до знака нуля: -0 и 0 выводятся по-разному
+bool IsSameNumber(double lhs, double rhs) {
+    return lhs == rhs && std::signbit(lhs) == std::signbit(rhs);
+}
+}  // namespace
 
-class Cell::TextImpl : public Cell::Impl {
-public:
-    TextImpl() = default;
-    ~TextImpl() = default; 
-    bool IsEmpty() const override
-    {
-        return false;
-    }
-    void Set(std::string&& str) override
+std::string_view Cell::Text::GetValue() const {
+    std::string_view value = text;
+    if(value.at(0) == ESCAPE_SIGN)
     {
-        user_defined_str_ = std::move(str);
-    }
-    std::string GetText() const override {
-        return user_defined_str_;
+        value.remove_prefix(1);
     }
-    CellInterface::Value GetValue() const override
+    return value;
+}
+
+RangeTotal* Cell::Formula::FindRangeTotal(const CellRange& range) const {
+    const std::vector<CellRange>& ranges = body->GetReferencedRanges();
+    for(size_t i = 0; i < ranges.size(); ++i)
     {
-        if(user_defined_str_.at(0) == ESCAPE_SIGN)
+        if(offset.Apply(ranges[i]) == range)
         {
-            return std::string(user_defined_str_.begin() + 1, user_defined_str_.end());
+            return &range_totals[i];
         }
-        return user_defined_str_;
     }
-    std::vector<Position> GetReferencedCells() const override {
-        return {};
+    return nullptr;
+}
+
+std::vector<CellRange> Cell::Formula::GetReferencedRanges() const {
+    std::vector<CellRange> ranges;
+    for(const CellRange& range : body->GetReferencedRanges())
+    {
+        ranges.push_back(offset.Apply(range));
     }
-private:
-    std::string user_defined_str_;
-};
+    return ranges;
+}
 
-class Cell::FormulaImpl : public Cell::Impl {
-public:
-    FormulaImpl() = default;
-    FormulaImpl(SheetInterface& sheet) : sheet_(sheet) {}
-    ~FormulaImpl() = default;
+DependencyGraph& Cell::GetGraph() const {
+    return sheet_.GetDependencyGraph();
+}
 
-    bool IsEmpty() const override {
-        return false;
-    }
-    void Set(std::string&& str) override {
-        using namespace std::literals;
-        SetImpl(str);
-        user_defined_str_ = "="s;
-        user_defined_str_ += std::move(formula_->GetExpression());
-        
-    }
-    std::string GetText() const override {
-        return user_defined_str_;
-    }
-    CellInterface::Value GetValue() const override {
-        try
-        {
-            value_ = formula_->Evaluate(sheet_);
-        }
-        catch(...)
-        {
-            value_ = FormulaError(FormulaError::Category::Arithmetic);
-        }
-        if(std::holds_alternative<double>(value_))
-        {
-            return std::get<double>(value_);
-        }
-        return std::get<FormulaError>(value_);
+int Cell::GetTopologicalOrder() const {
+    return GetGraph().GetOrder(id_);
+}
 
+std::vector<CellId> Cell::FillChildCells(PositionsView ref_cells)
+{
+    std::vector<CellId> child_cells;
+    child_cells.reserve(ref_cells.size());
+    for(Position cell_pos : ref_cells)
+    {
+        // Позиции ссылок проверены при разборе формулы
+        child_cells.push_back(sheet_.GetReferenceNode(cell_pos));
     }
+    return child_cells;
+}
 
-    std::vector<Position> GetReferencedCells() const override {
-        return ref_cells_;
+void Cell::SetFormulaImpl(std::string&& text) {
+    FormulaTable::Entry entry = sheet_.GetFormulaTable().Intern(std::string_view(text).substr(1), current_position_);
+    Content old_content = std::move(content_);
+    Formula& formula = EmplaceFormula(std::move(entry));
+    if(const Formula* old_formula = std::get_if<Formula>(&old_content))
+    {
+        // С прежним значением сравнивается значение новой формулы
+        formula.value = old_formula->value;
     }
-
-private:
-    mutable FormulaInterface::Value value_;
-    std::unique_ptr<FormulaInterface> formula_;
-    std::string user_defined_str_;
-    std::vector<Position> ref_cells_;
-    SheetInterface& sheet_;
-
-
-    FormulaInterface::Value CalculateValuesImpl(Cell* cell);
-
-    void SetImpl(std::string &str)
+    const PositionsView ref_cells = formula.body->GetReferencedCellsView(formula.offset);
+    if(std::binary_search(ref_cells.begin(), ref_cells.end(), current_position_))
     {
-        try
-        {
-            formula_ = ParseFormula(std::string(str.begin() + 1, str.end()));
-        }
-        catch(const FormulaException& exc)
+        content_ = std::move(old_content);
+        throw CircularDependencyException("There is a circular dependency");
+    }
+    DependencyGraph& graph = GetGraph();
+    const EdgeList& old_child_cells = graph.GetReferences(id_);
+    std::vector<CellId> temp_child_cells(old_child_cells.begin(), old_child_cells.end());
+    std::vector<CellId> child_cells = FillChildCells(ref_cells);
+    if(!graph.SetReferences(id_, child_cells, formula.GetReferencedRanges()))
+    {
+        content_ = std::move(old_content);
+        for(CellId cell_id : child_cells)
         {
-            throw exc;
+            //Вершины, заведённые только для отвергнутой формулы, не нужны
+            if(graph.GetCell(cell_id) == nullptr)
+            {
+                sheet_.ReleaseReferenceNode(cell_id);
+            }
         }
-        ref_cells_ = formula_->GetReferencedCells();
+        throw CircularDependencyException("There is a circular dependency");
     }
-};
-
-
-void FillChildCellsSet(std::unordered_set<Position, PositionHasher>& child_cells, SheetInterface& sheet, const std::vector<Position>& ref_cells)
-{
-    for(Position cell_pos : ref_cells)
+    for(CellId cell_id : temp_child_cells)
     {
-        if(sheet.GetCell(cell_pos) == nullptr && cell_pos.IsValid())
+        if(std::find(child_cells.begin(), child_cells.end(), cell_id) == child_cells.end())
         {
-            sheet.SetCell(cell_pos, ""s);
+            //Если ячейки нет в новой формуле, то она могла остаться пустой и никому не нужной
+            sheet_.ReleaseReferenceNode(cell_id);
         }
-        child_cells.insert(cell_pos);
     }
 }
 
-void Cell::SetFormulaImpl(std::string&& text) {
-    std::unique_ptr<Impl> temp_impl = std::move(impl_);
-    impl_ = std::make_unique<FormulaImpl>(sheet_);
+Cell::Cell(Sheet& sheet, Position pos, std::string&& text)
+    : sheet_(sheet)
+    , current_position_(pos)
+    , id_(sheet.AttachCell(this, pos, text.empty()))
+{
     try {
-        impl_->Set(std::move(text));
+        Set(std::move(text));
     }
     catch (...)
     {
-        impl_ = std::move(temp_impl);
+        // Деструктор недостроенной ячейки не вызывается
+        sheet_.DetachCell(id_);
         throw;
     }
-    std::unordered_set<Position, PositionHasher> temp_child_cell;
-    temp_child_cell = std::move(child_cells_);
-    child_cells_.clear();
-    FillChildCellsSet(child_cells_, sheet_, impl_->GetReferencedCells());
-    if(IsThereCycleDependency())
+}
+
+Cell::Cell(Sheet& sheet, Position pos, std::string&& text, FormulaTable::Entry&& entry)
+    : sheet_(sheet)
+    , current_position_(pos)
+    , id_(sheet.AttachCell(this, pos, entry.formula == nullptr))
+{
+    if(entry.formula != nullptr)
+    {
+        EmplaceFormula(std::move(entry));
+    }
+    else if(!text.empty())
     {
-        child_cells_.clear();
-        child_cells_ = std::move(temp_child_cell);
-        impl_ = std::move(temp_impl);
-        throw CircularDependencyException("There is a circular dependency");
+        SetTextCellImpl(std::move(text));
     }
-    for(Position pos : GetReferencedCells())
+}
+
+Cell::Formula& Cell::EmplaceFormula(FormulaTable::Entry&& entry) {
+    Formula& formula = content_.emplace<Formula>();
+    formula.body = std::move(entry.formula);
+    formula.offset = entry.offset;
+    const size_t ranges = formula.body->GetReferencedRanges().size();
+    if(ranges != 0)
     {
-        dynamic_cast<Cell*>(sheet_.GetCell(pos))->parents_cells_.insert(current_position_);
+        formula.range_totals = std::make_unique<RangeTotal[]>(ranges);
     }
-    for(Position pos : temp_child_cell)
+    return formula;
+}
+
+void Cell::AddLoadedReferences() {
+    const Formula* formula = GetFormula();
+    if(formula == nullptr)
     {
-        if(child_cells_.find(pos) == child_cells_.end())
-        {
-            //Если ячейки нет в новой формуле, то удалить в этой ячейке упоминание на текущую
-            EraseRefToThisCellFromChildCell(pos);
-        }
+        return;
     }
+    std::vector<CellId> child_cells = FillChildCells(formula->body->GetReferencedCellsView(formula->offset));
+    GetGraph().AddReferencesUnchecked(id_, child_cells, formula->GetReferencedRanges());
 }
 
-Cell::Cell(SheetInterface& sheet, Position pos, std::string&& text)
-    : sheet_(sheet)
-    , current_position_(pos)
-{
-    Set(std::move(text));
+void Cell::AddLoadedReferences(const std::vector<CellId>& references) {
+    if(const Formula* formula = GetFormula())
+    {
+        GetGraph().AddReferencesUnchecked(id_, references, formula->GetReferencedRanges());
+    }
 }
 
 Cell::~Cell() {
+    sheet_.DetachCell(id_);
 }
 
 void Cell::SetEmptyCellImpl() {
-    impl_ = std::make_unique<EmptyImpl>();
-    child_cells_.clear();
+    content_.emplace<std::monostate>();
 }
 
 void Cell::SetTextCellImpl(std::string&& text) {
-    impl_ = std::make_unique<TextImpl>();
-    impl_->Set(std::move(text));
-    child_cells_.clear();
-    cache_ = impl_->GetValue();
+    Text& content = content_.emplace<Text>();
+    content.text = std::move(text);
+    // Текст разбирается один раз: формулы читают уже готовое число
+    const std::string_view value = content.GetValue();
+    if(value.empty())
+    {
+        content.number_kind = CellNumberKind::Empty;
+    }
+    else
+    {
+        content.number_kind = ParseNumericText(value, content.number) ? CellNumberKind::Number : CellNumberKind::Text;
+    }
 }
 
-void Cell::Set(std::string&& text) {
-    InvalidateCache();
+Cell::OldNumber Cell::GetOldNumber() const {
+    OldNumber old;
+    old.range_number_known = GetRangeNumber(old.range_number);
+    old.was_formula = IsFormulaCell();
+    old.value = 0.0;
+    FormulaError error = FormulaError::Category::Value;
+    old.kind = old.was_formula ? CellNumberKind::Error : GetNumber(old.value, error);
+    return old;
+}
 
+void Cell::FinishSet(const OldNumber& old) {
+    if(IsFormulaCell())
+    {
+        // Значение новой формулы станет известно при вычислении. Если прежняя
+        // формула давала то же значение, зависимые вычислять не придётся.
+        InvalidateRangeTotals();
+        sheet_.MarkChanged(id_, !old.was_formula);
+    }
+    else
+    {
+        // Формулы видят текст только через GetNumber: замена "1" на "1.0"
+        // или одного нечислового текста на другой их не затрагивает
+        double new_value = 0.0;
+        FormulaError error = FormulaError::Category::Value;
+        const CellNumberKind new_kind = GetNumber(new_value, error);
+        if(old.was_formula || new_kind != old.kind
+           || (new_kind == CellNumberKind::Number && !IsSameNumber(new_value, old.value)))
+        {
+            sheet_.MarkChanged(id_, true);
+        }
+    }
+    UpdateRangeTotals(old.range_number_known, old.range_number);
+}
+
+void Cell::Set(std::string&& text) {
+    const OldNumber old = GetOldNumber();
     if(IsTextFormula(text))
     {
         SetFormulaImpl(std::move(text));
-        return;
     }
-    if(impl_ && IsTextFormula(impl_->GetText()))
+    else
     {
-        //Если формульная ячейка становится текстовой или пустой, то разрушаются зависимость этой ячейки от других
-        EraseParentCellFromAllRefferencedCells();
+        if(old.was_formula)
+        {
+            //Если формульная ячейка становится текстовой или пустой, то разрушаются зависимость этой ячейки от других
+            EraseParentCellFromAllRefferencedCells();
+        }
+        if(text.size() == 0)
+        {
+            SetEmptyCellImpl();
+        }
+        else
+        {
+            SetTextCellImpl(std::move(text));
+        }
     }
-    if(text.size() == 0)
+    FinishSet(old);
+}
+
+void Cell::SetUnlinked(std::string&& text, FormulaTable::Entry&& entry, std::vector<Position>& released) {
+    const OldNumber old = GetOldNumber();
+    if(old.was_formula)
+    {
+        DependencyGraph& graph = GetGraph();
+        for(CellId cell_id : graph.GetReferences(id_))
+        {
+            released.push_back(graph.GetPosition(cell_id));
+        }
+        graph.ClearReferences(id_);
+    }
+    if(entry.formula != nullptr)
+    {
+        Content old_content = std::move(content_);
+        Formula& formula = EmplaceFormula(std::move(entry));
+        if(const Formula* old_formula = std::get_if<Formula>(&old_content))
+        {
+            formula.value = old_formula->value;
+        }
+    }
+    else if(text.empty())
     {
         SetEmptyCellImpl();
-        return;
     }
-    SetTextCellImpl(std::move(text));
+    else
+    {
+        SetTextCellImpl(std::move(text));
+    }
+    FinishSet(old);
+}
+
+FormulaTable::Entry Cell::GetFormulaEntry() const {
+    const Formula* formula = GetFormula();
+    if(formula == nullptr)
+    {
+        return {};
+    }
+    return {formula->body, formula->offset};
 }
 
 void Cell::Clear() {
@@ -231,160 +298,371 @@ void Cell::Clear() {
 }
 
 Cell::Value Cell::GetValue() const {
-    if(!IsValidCache())
+    if(const Text* text = GetTextContent())
     {
-        if(IsTextFormula(impl_->GetText())) {
-            CalculateValuesImpl();
-        }
-        else
-        {
-            return impl_->GetValue();
-        }
+        return std::string(text->GetValue());
+    }
+    if(IsEmpty())
+    {
+        return ""s;
     }
-    return cache_.value();
+    const Formula& formula = GetCalculatedFormula();
+    if(std::holds_alternative<double>(formula.value))
+    {
+        return std::get<double>(formula.value);
+    }
+    return std::get<FormulaError>(formula.value);
 }
 
-std::string Cell::GetText() const {
-    return impl_->GetText();
+CellNumberKind Cell::GetNumber(double& number, FormulaError& error) const {
+    if(const Text* text = GetTextContent())
+    {
+        number = text->number;
+        return text->number_kind;
+    }
+    if(IsEmpty())
+    {
+        number = 0.0;
+        return CellNumberKind::Empty;
+    }
+    const Formula& formula = GetCalculatedFormula();
+    if(std::holds_alternative<double>(formula.value))
+    {
+        number = std::get<double>(formula.value);
+        return CellNumberKind::Number;
+    }
+    error = std::get<FormulaError>(formula.value);
+    return CellNumberKind::Error;
 }
 
-std::vector<Position> Cell::GetReferencedCells() const {
-    return impl_->GetReferencedCells();
+Cell::ValueView Cell::GetValueView() const {
+    if(const Text* text = GetTextContent())
+    {
+        return text->GetValue();
+    }
+    if(IsEmpty())
+    {
+        return std::string_view{};
+    }
+    const Formula& formula = GetCalculatedFormula();
+    if(std::holds_alternative<double>(formula.value))
+    {
+        return std::get<double>(formula.value);
+    }
+    return std::get<FormulaError>(formula.value);
 }
 
-bool Cell::IsValidCache() const
-{
-    if(cache_.has_value())
+void Cell::PrintText(std::ostream& output) const {
+    if(const Text* text = GetTextContent())
     {
-        return true;
+        output << text->text;
     }
-    return false;
-};
-
-void Cell::InvalidateCache()
-{
-    if(IsValidCache())
+    else if(const Formula* formula = GetFormula())
     {
-        cache_.reset();
-        InvalidateCacheImpl();
+        output << FORMULA_SIGN;
+        formula->body->PrintExpression(output, formula->offset);
     }
 }
 
-void Cell::InvalidateCacheImpl()
-{
-    if(!parents_cells_.empty())
+PositionsView Cell::GetReferencedCellsView() const {
+    if(const Formula* formula = GetFormula())
     {
-        for(auto cell_pos : parents_cells_)
-        {
-            auto cell_p = sheet_.GetCell(cell_pos);
-
-                dynamic_cast<Cell*>(cell_p)->InvalidateCache();
+        return formula->body->GetReferencedCellsView(formula->offset);
+    }
+    return {};
+}
 
-        }
+const Cell::Formula& Cell::GetCalculatedFormula() const {
+    if(!IsValidCache())
+    {
+        CalculateChildCells();
     }
+    return *GetFormula();
 }
 
-bool Cell::IsThereCycleDependency(){
-    std::unordered_set<Position, PositionHasher> visited, handling_cells;
-    return CheckCycleDependencyImpl(visited, handling_cells);
+std::string Cell::GetText() const {
+    if(const Text* text = GetTextContent())
+    {
+        return text->text;
+    }
+    if(const Formula* formula = GetFormula())
+    {
+        return "="s + formula->body->GetExpression(formula->offset);
+    }
+    return ""s;
 }
 
-bool Cell::CheckCycleDependencyImpl(std::unordered_set<Position, PositionHasher>& visited, 
-                                    std::unordered_set<Position, PositionHasher>& handling_cells) {
-    if(handling_cells.find(current_position_) != handling_cells.end())
+std::vector<Position> Cell::GetReferencedCells() const {
+    if(const Formula* formula = GetFormula())
     {
-        return true;
+        return formula->body->GetReferencedCells(formula->offset);
     }
-    if(visited.find(current_position_) != visited.end())
+    return {};
+}
+
+bool Cell::IsValidCache() const
+{
+    sheet_.ApplyPendingChanges();
+    return HasValidValue();
+};
+
+bool Cell::HasValidValue() const
+{
+    const Formula* formula = GetFormula();
+    return formula == nullptr || formula->state == CacheState::Valid;
+}
+
+void Cell::InvalidateDependents(bool value_changed) const
+{
+    // Обход зависимых ячеек идёт с явным стеком, чтобы длинные цепочки формул
+    // не переполняли стек вызовов. Ячейка с уже недействительным значением
+    // не обходится: её зависимые были помечены вместе с ней.
+    // Формулы, покрывающие ячейку диапазоном, находятся через индекс
+    // диапазонов графа. Значение помеченной формулы может измениться, поэтому
+    // итоги диапазонов, в которые она входит, сбрасываются; изменение
+    // числа в обычной ячейке учитывается в итогах по разнице в Set.
+    const DependencyGraph& graph = GetGraph();
+    std::vector<CellId> stack;
+    auto mark = [&graph, &stack](CellId id, CacheState state) {
+        Cell* cell = graph.GetCell(id);
+        const Formula* formula = cell->GetFormula();
+        const bool was_valid = formula->state == CacheState::Valid;
+        if(was_valid || state == CacheState::Dirty)
+        {
+            formula->state = state;
+        }
+        if(was_valid)
+        {
+            cell->InvalidateRangeTotals();
+            stack.push_back(id);
+        }
+    };
+    graph.ForEachDependent(id_, [&mark, value_changed](CellId id) {
+        mark(id, value_changed ? CacheState::Dirty : CacheState::Check);
+    });
+    while(!stack.empty())
     {
-        return false;
+        const CellId id = stack.back();
+        stack.pop_back();
+        graph.ForEachDependent(id, [&mark](CellId dependent) {
+            mark(dependent, CacheState::Check);
+        });
     }
-    handling_cells.insert(current_position_);
-    visited.insert(current_position_);
-    if(!child_cells_.empty())
+}
+
+void Cell::CalculateChildCells() const
+{
+    // Устаревшие формулы, от которых зависит ячейка, вычисляются обходом
+    // в глубину с явным стеком: ячейка вычисляется после всех своих ссылок.
+    // Поэтому формула при вычислении читает только готовые значения и
+    // глубина цепочки не ограничена размером стека вызовов. Ссылки всех
+    // ячеек на стеке, включая ячейки диапазонов, лежат в общем массиве
+    // children: ячейка на стеке помнит, с какого места начинаются её.
+    struct Frame {
+        const Cell* cell;
+        size_t first_child;
+    };
+    const DependencyGraph& graph = GetGraph();
+    std::vector<CellId> children;
+    std::vector<Frame> stack;
+    auto push = [&](const Cell* cell) {
+        stack.push_back({cell, children.size()});
+        cell->CollectReferencesToEvaluate(children);
+    };
+    push(this);
+    while(!stack.empty())
     {
-        for(auto cell_pos : child_cells_)
+        const Frame frame = stack.back();
+        if(children.size() == frame.first_child)
         {
-            auto cell_p = sheet_.GetCell(cell_pos);
-            if(cell_p != nullptr)
+            // Все ссылки уже вычислены; если какая-то изменила значение, она
+            // пометила ячейку как Dirty
+            if(frame.cell->ConfirmValue())
+            {
+                ++sheet_.saved_evaluations_;
+            }
+            else if(frame.cell->CalculateValue())
             {
-                bool is_cycle_dep = dynamic_cast<Cell*>(cell_p)->CheckCycleDependencyImpl(visited, handling_cells);
-                if(is_cycle_dep)
-                {
-                    return true;
-                }
+                frame.cell->MarkDependentsDirty();
             }
+            stack.pop_back();
+            continue;
+        }
+        const Cell* child = graph.GetCell(children.back());
+        children.pop_back();
+        // У ссылки на несуществующую ячейку вершина без ячейки
+        if(child != nullptr && !child->HasValidValue())
+        {
+            push(child);
         }
     }
-    handling_cells.erase(current_position_);
-    return false;
 }
 
-CellInterface::Value Cell::CalculateValuesImpl() const
+void Cell::CollectReferencesToEvaluate(std::vector<CellId>& ids) const
 {
-    if(!child_cells_.empty())
+    const DependencyGraph& graph = GetGraph();
+    const EdgeList& references = graph.GetReferences(id_);
+    ids.insert(ids.end(), references.begin(), references.end());
+    const Formula* formula = GetFormula();
+    for(const CellRange& range : graph.GetRanges(id_))
     {
-        for(Position cell_pos : child_cells_)
+        // Действительный итог диапазона означает, что все формулы диапазона
+        // уже вычислены, и перебирать его ячейки не нужно
+        const RangeTotal* total = formula != nullptr ? formula->FindRangeTotal(range) : nullptr;
+        if(total == nullptr || !total->valid)
         {
-            if(!cell_pos.IsValid())
-            {
-                cache_ = FormulaError(FormulaError::Category::Ref);
-                return cache_.value();
-            }
+            graph.CollectCellsInRange(range, ids);
         }
     }
-    cache_ = impl_->GetValue();
-    return cache_.value();
 }
 
-bool Cell::IsTextFormula(std::string_view text) const{
-    if(text.size() == 0)
+bool Cell::GetRangeNumber(std::optional<double>& number) const
+{
+    number.reset();
+    if(IsFormulaCell())
     {
         return false;
     }
-    if(text.at(0) == FORMULA_SIGN && text.size() > 1)
+    const Text* text = GetTextContent();
+    if(text != nullptr && text->number_kind == CellNumberKind::Number)
     {
-        return true;
+        number = text->number;
     }
-    return false;
+    return true;
 }
 
-void Cell::EraseParentCellFromAllRefferencedCells()
+void Cell::UpdateRangeTotals(bool old_number_known, std::optional<double> old_number)
 {
-    for(auto cell_pos : child_cells_)
+    std::optional<double> new_number;
+    const bool new_number_known = GetRangeNumber(new_number);
+    const DependencyGraph& graph = GetGraph();
+    graph.ForEachRangeDependent(id_, [&](CellId owner_id, const CellRange& range) {
+        const Formula* owner = graph.GetCell(owner_id)->GetFormula();
+        RangeTotal* total = owner != nullptr ? owner->FindRangeTotal(range) : nullptr;
+        if(total == nullptr)
+        {
+            return;
+        }
+        if(old_number_known && new_number_known)
+        {
+            total->Update(old_number, new_number);
+        }
+        else
+        {
+            total->Invalidate();
+        }
+    });
+}
+
+void Cell::InvalidateRangeTotals()
+{
+    const DependencyGraph& graph = GetGraph();
+    graph.ForEachRangeDependent(id_, [&graph](CellId owner_id, const CellRange& range) {
+        const Formula* owner = graph.GetCell(owner_id)->GetFormula();
+        if(RangeTotal* total = owner != nullptr ? owner->FindRangeTotal(range) : nullptr)
+        {
+            total->Invalidate();
+        }
+    });
+}
+
+const FormulaInterface* Cell::GetSharedFormula(PositionOffset& offset) const
+{
+    const Formula* formula = GetFormula();
+    if(formula == nullptr)
     {
-        EraseRefToThisCellFromChildCell(cell_pos);
+        return nullptr;
     }
+    offset = formula->offset;
+    return formula->body.get();
 }
 
-void Cell::EraseRefToThisCellFromChildCell(Position child_cell_pos)
+bool Cell::SetCalculatedValue(const FormulaInterface::Value& value) const
 {
-    auto cell_p = sheet_.GetCell(child_cell_pos);
-    if(cell_p != nullptr)
+    assert(IsFormulaCell());
+    const Formula* formula = GetFormula();
+    formula->state = CacheState::Valid;
+    if(std::holds_alternative<double>(value))
     {
-        Cell* point_to_cell = dynamic_cast<Cell*>(cell_p);
-        point_to_cell->parents_cells_.erase(current_position_);
-        if(cell_p->GetText().size() == 0 && point_to_cell->parents_cells_.empty())
+        const double number = std::get<double>(value);
+        if(std::holds_alternative<double>(formula->value) && IsSameNumber(std::get<double>(formula->value), number))
         {
-            //Если ячейка пустая и от неё никто не зависит, то удаляем её.
-            sheet_.ClearCell(child_cell_pos);
+            return false;
         }
+        formula->value = number;
+        return true;
     }
+    const FormulaError error = std::get<FormulaError>(value);
+    if(std::holds_alternative<FormulaError>(formula->value) && std::get<FormulaError>(formula->value) == error)
+    {
+        return false;
+    }
+    formula->value = error;
+    return true;
+}
+
+bool Cell::CalculateValue() const
+{
+    const Formula* formula = GetFormula();
+    return SetCalculatedValue(formula->body->Evaluate(sheet_, formula->range_totals.get(), formula->offset));
 }
 
-bool Cell::IsThisCellPartOfFormula() {
-    if(!parents_cells_.empty())
+bool Cell::ConfirmValue() const
+{
+    const Formula* formula = GetFormula();
+    if(formula->state != CacheState::Check)
     {
-        return true;
+        return false;
     }
-    else
+    formula->state = CacheState::Valid;
+    return true;
+}
+
+void Cell::MarkDependentsDirty() const
+{
+    const DependencyGraph& graph = GetGraph();
+    graph.ForEachDependent(id_, [&graph](CellId id) {
+        const Formula* formula = graph.GetCell(id)->GetFormula();
+        if(formula->state == CacheState::Check)
+        {
+            formula->state = CacheState::Dirty;
+        }
+    });
+}
+
+bool Cell::IsTextFormula(std::string_view text) {
+    if(text.size() == 0)
     {
         return false;
     }
+    if(text.at(0) == FORMULA_SIGN && text.size() > 1)
+    {
+        return true;
+    }
+    return false;
+}
+
+void Cell::EraseParentCellFromAllRefferencedCells()
+{
+    DependencyGraph& graph = GetGraph();
+    const EdgeList& child_cells = graph.GetReferences(id_);
+    std::vector<CellId> temp_child_cells(child_cells.begin(), child_cells.end());
+    graph.ClearReferences(id_);
+    for(CellId cell_id : temp_child_cells)
+    {
+        sheet_.ReleaseReferenceNode(cell_id);
+    }
+}
+
+bool Cell::IsFormulaCell() const {
+    return GetFormula() != nullptr;
 }
 
-bool Cell::IsFormulaCell() {
-    return IsTextFormula(GetText());
+std::ostream& operator<<(std::ostream& output, const CellInterface::ValueView& value) {
+    std::visit([&output](const auto& x) {
+        output << x;
+    }, value);
+    return output;
 }
 
 std::ostream& operator<<(std::ostream& output, const CellInterface::Value& value) {
@@ -1,62 +1,191 @@
 #pragma once
 
 #include "common.h"
+#include "dependency_graph.h"
 #include "formula.h"
+#include "formula_table.h"
+#include <cstdint>
+#include <iosfwd>
 #include <variant>
 #include <memory>
 #include <optional>
-#include <unordered_map>
-#include <unordered_set>
 #include <string>
+#include <vector>
 
-class Cell : public CellInterface {
+class Sheet;
+
+class Cell final : public CellInterface {
 public:
-    explicit Cell(SheetInterface& sheet,  Position pos, std::string&& text);
+    // Ячейка регистрируется в графе зависимостей листа при создании и
+    // удаляется из него при разрушении. Граф и таблицу формул ячейка берёт
+    // у листа.
+    explicit Cell(Sheet& sheet, Position pos, std::string&& text);
+    // Ячейка листа, загружаемого целиком (Sheet::BulkLoad). Формула уже
+    // разобрана (entry.formula == nullptr - ячейка без формулы с текстом
+    // text), а её рёбра в графе добавляет AddLoadedReferences после
+    // создания всех ячеек.
+    Cell(Sheet& sheet, Position pos, std::string&& text, FormulaTable::Entry&& entry);
     ~Cell();
 
     void Clear();
     Value GetValue() const override;
     std::string GetText() const override;
     std::vector<Position> GetReferencedCells() const override;
+    CellNumberKind GetNumber(double& number, FormulaError& error) const override;
+    ValueView GetValueView() const override;
+    void PrintText(std::ostream& output) const override;
+    PositionsView GetReferencedCellsView() const override;
 
     void Set(std::string&& text);
-
+    // Заменяет содержимое, как Set, но формула уже разобрана (entry.formula
+    // == nullptr - ячейка без формулы с текстом text), а её рёбра в графе
+    // не добавляются: их добавит AddLoadedReferences. Позиции ссылок
+    // прежней формулы дописываются в released, отпускает их лист.
+    void SetUnlinked(std::string&& text, FormulaTable::Entry&& entry, std::vector<Position>& released);
+    // Общее тело формулы ячейки и её сдвиг; пустая запись, если в ячейке
+    // не формула
+    FormulaTable::Entry GetFormulaEntry() const;
+
+    // Вычислено ли значение формулы. Значение ячейки без формулы известно
+    // всегда. Сначала применяет отложенные изменения листа.
     bool IsValidCache() const;
-    void InvalidateCache();
+    // Помечает зависимые формулы после изменения ячейки, см. CacheState.
+    // Set только сообщает листу об изменении, а помечает лист перед
+    // следующим чтением значений (Sheet::ApplyPendingChanges).
+    void InvalidateDependents(bool value_changed) const;
 
-    bool IsThereCycleDependency();
     void EraseParentCellFromAllRefferencedCells();
-    bool IsThisCellPartOfFormula();
-    bool IsFormulaCell();
+    // Добавляет в граф ссылки формулы загруженной ячейки без проверки
+    // циклов: лист ищет их сразу во всём графе
+    void AddLoadedReferences();
+    // То же с уже найденными вершинами ссылок формулы
+    void AddLoadedReferences(const std::vector<CellId>& references);
+    bool IsFormulaCell() const;
+    // Текст задаёт формулу: начинается со знака "=" и не состоит из него одного
+    static bool IsTextFormula(std::string_view text);
+    // Пустая ячейка: без текста и формулы
+    bool IsEmpty() const {
+        return std::holds_alternative<std::monostate>(content_);
+    }
+
+    // Дописывает ячейки, которые нужно вычислить до этой: ссылки формулы и
+    // ячейки диапазонов без действительного итога
+    void CollectReferencesToEvaluate(std::vector<CellId>& ids) const;
+
+    // Общее тело формулы ячейки из таблицы формул и сдвиг ячейки
+    // относительно него; nullptr, если в ячейке не формула
+    const FormulaInterface* GetSharedFormula(PositionOffset& offset) const;
+    // Запоминает значение формулы, вычисленное пачкой вместе с соседними
+    // ячейками столбца (FormulaInterface::EvaluateBatch). Возвращает true,
+    // если значение изменилось.
+    bool SetCalculatedValue(const FormulaInterface::Value& value) const;
+    // Вычисляет формулу по уже вычисленным ссылкам и запоминает значение.
+    // Возвращает true, если значение изменилось.
+    bool CalculateValue() const;
+    // Отсечение пересчёта: формула, ни одна ссылка которой не изменила
+    // значения, становится действительной без вычисления. Возвращает false,
+    // если формулу нужно вычислить. Сэкономленное вычисление считает
+    // вызывающий (Sheet::GetSavedEvaluations).
+    bool ConfirmValue() const;
+    // Значение формулы изменилось: зависящие от неё формулы нужно вычислить
+    void MarkDependentsDirty() const;
+
+    CellId GetId() const {
+        return id_;
+    }
+    Sheet& GetSheet() const {
+        return sheet_;
+    }
+    // Ячейка всегда стоит в этом порядке после всех ячеек, на которые
+    // ссылается её формула. Порядок поддерживается при каждом изменении формулы.
+    int GetTopologicalOrder() const;
 
 private:
-    class Impl;
-    class EmptyImpl;
-    class TextImpl;
-    class FormulaImpl;
-    std::unique_ptr<Impl> impl_;
-    SheetInterface& sheet_;
-
+    // Содержимое ячейки хранится в самом объекте ячейки, без отдельного
+    // выделения памяти. Пустая ячейка - std::monostate.
+    struct Text {
+        std::string text;
+        // Значение текста для формул, разобранное один раз при задании
+        double number = 0.0;
+        CellNumberKind number_kind = CellNumberKind::Text;
+
+        std::string_view GetValue() const;
+    };
+    // Состояние значения формулы. Изменение ячейки помечает прямые
+    // зависимые формулы как Dirty, если значение ячейки изменилось, остальные
+    // зависимые - как Check. Формула Check вычисляется, только если
+    // вычисление её ссылок изменило их значения, иначе значение остаётся
+    // прежним, и пересчёт дальше не идёт.
+    enum class CacheState : std::uint8_t {
+        Valid,
+        Check,
+        Dirty,
+    };
+    // Формула хранит только ссылку на общее тело из таблицы формул листа и
+    // свой сдвиг относительно него. Текст формулы и списки ссылок получаются
+    // из тела сдвигом.
+    struct Formula {
+        std::shared_ptr<const FormulaInterface> body;
+        PositionOffset offset;
+        // Итоги диапазонов в порядке GetReferencedRanges(), см. RangeTotal;
+        // заводятся, только если у формулы есть диапазоны
+        std::unique_ptr<RangeTotal[]> range_totals;
+        // Последнее вычисленное значение, с ним сравнивается новое;
+        // std::monostate - формула ещё не вычислялась
+        mutable std::variant<std::monostate, double, FormulaError> value;
+        mutable CacheState state = CacheState::Dirty;
+
+        RangeTotal* FindRangeTotal(const CellRange& range) const;
+        std::vector<CellRange> GetReferencedRanges() const;
+    };
+    using Content = std::variant<std::monostate, Text, Formula>;
+
+    Content content_;
+    Sheet& sheet_;
     Position current_position_;
+    CellId id_;
 
-    std::unordered_set<Position, PositionHasher> parents_cells_;
-    mutable std::optional<CellInterface::Value> cache_;
-
-    void InvalidateCacheImpl();
+    const Text* GetTextContent() const {
+        return std::get_if<Text>(&content_);
+    }
+    const Formula* GetFormula() const {
+        return std::get_if<Formula>(&content_);
+    }
+    DependencyGraph& GetGraph() const;
 
-    std::unordered_set<Position, PositionHasher> child_cells_;
-
-    bool CheckCycleDependencyImpl(  std::unordered_set<Position, PositionHasher>& visited, 
-                                    std::unordered_set<Position, PositionHasher>& handling_cells);
-    
     void SetFormulaImpl(std::string&& text);
+    // Заводит содержимое формулы с телом из таблицы формул, без рёбер графа
+    Formula& EmplaceFormula(FormulaTable::Entry&& entry);
 
     void SetEmptyCellImpl();
     void SetTextCellImpl(std::string&& text);
 
-    CellInterface::Value CalculateValuesImpl() const;
-
-    bool IsTextFormula(std::string_view text) const;
-
-    void EraseRefToThisCellFromChildCell(Position child_cell_pos);
-};
\ No newline at end of file
+    // Число в ячейке до замены содержимого: по нему замена обновляет итоги
+    // диапазонов и решает, изменилось ли значение для зависимых формул
+    struct OldNumber {
+        bool was_formula;
+        bool range_number_known;
+        std::optional<double> range_number;
+        CellNumberKind kind;
+        double value;
+    };
+    OldNumber GetOldNumber() const;
+    // Сообщает листу об изменении содержимого и обновляет итоги диапазонов
+    void FinishSet(const OldNumber& old);
+
+    // То же, что IsValidCache, без применения отложенных изменений листа
+    bool HasValidValue() const;
+    // Вычисляет значение формулы, если оно устарело
+    const Formula& GetCalculatedFormula() const;
+    void CalculateChildCells() const;
+
+    // Итоги диапазонов (RangeTotal) формул, покрывающих ячейку. Число в
+    // обычной ячейке известно всегда, у формулы - нет: её изменение
+    // сбрасывает итоги, изменение числа обновляет их по разнице.
+    bool GetRangeNumber(std::optional<double>& number) const;
+    void UpdateRangeTotals(bool old_number_known, std::optional<double> old_number);
+    void InvalidateRangeTotals();
+
+
+    std::vector<CellId> FillChildCells(PositionsView ref_cells);
+};
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <cstddef>
 #include <iosfwd>
+#include <iterator>
 #include <memory>
+#include <span>
 #include <stdexcept>
 #include <string>
 #include <string_view>
@@ -32,6 +35,111 @@ struct PositionHasher {
     }
 };
 
+// Прямоугольный диапазон ячеек first:last, включая границы.
+// first - левый верхний угол, last - правый нижний.
+struct CellRange {
+    Position first;
+    Position last;
+
+    bool operator==(const CellRange& rhs) const;
+
+    bool IsValid() const;
+    bool Contains(Position pos) const;
+    std::string ToString() const;
+
+    // Диапазон по двум противоположным углам в любом порядке
+    static CellRange FromCorners(Position lhs, Position rhs);
+};
+
+// Сдвиг между позициями. Формула, скопированная из ячейки from в ячейку to,
+// ссылается на те же ячейки, сдвинутые на Between(from, to).
+struct PositionOffset {
+    int rows = 0;
+    int cols = 0;
+
+    static PositionOffset Between(Position from, Position to) {
+        return {to.row - from.row, to.col - from.col};
+    }
+
+    Position Apply(Position pos) const {
+        return {pos.row + rows, pos.col + cols};
+    }
+
+    CellRange Apply(const CellRange& range) const {
+        return {Apply(range.first), Apply(range.last)};
+    }
+};
+
+// Позиции из непрерывного массива, сдвинутые на offset, без копирования.
+// Так формула ячейки отдаёт свои ссылки, не собирая их в новый вектор:
+// массив принадлежит общему телу формулы (см. PositionOffset). Список
+// действителен, пока ячейка не изменится.
+class PositionsView {
+public:
+    class Iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Position;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = Position;
+
+        Iterator(const Position* pos, PositionOffset offset)
+            : pos_(pos)
+            , offset_(offset) {
+        }
+
+        Position operator*() const {
+            return offset_.Apply(*pos_);
+        }
+        Iterator& operator++() {
+            ++pos_;
+            return *this;
+        }
+        Iterator operator++(int) {
+            Iterator old = *this;
+            ++pos_;
+            return old;
+        }
+        bool operator==(const Iterator& rhs) const {
+            return pos_ == rhs.pos_;
+        }
+        bool operator!=(const Iterator& rhs) const {
+            return pos_ != rhs.pos_;
+        }
+
+    private:
+        const Position* pos_;
+        PositionOffset offset_;
+    };
+
+    PositionsView() = default;
+    PositionsView(std::span<const Position> positions, PositionOffset offset = {})
+        : positions_(positions)
+        , offset_(offset) {
+    }
+
+    Iterator begin() const {
+        return {positions_.data(), offset_};
+    }
+    Iterator end() const {
+        return {positions_.data() + positions_.size(), offset_};
+    }
+    size_t size() const {
+        return positions_.size();
+    }
+    bool empty() const {
+        return positions_.empty();
+    }
+    Position operator[](size_t index) const {
+        return offset_.Apply(positions_[index]);
+    }
+
+private:
+    std::span<const Position> positions_;
+    PositionOffset offset_;
+};
+
 struct Size {
     int rows = 0;
     int cols = 0;
@@ -66,6 +174,14 @@ private:
 
 std::ostream& operator<<(std::ostream& output, FormulaError fe);
 
+// Значение ячейки так, как его читает формула (CellInterface::GetNumber)
+enum class CellNumberKind {
+    Empty,   // пустая ячейка или пустой текст
+    Number,  // значение формулы или текст, целиком записывающий число
+    Text,    // текст, который не является числом
+    Error,   // ошибка вычисления формулы
+};
+
 // Исключение, выбрасываемое при попытке передать в метод некорректную позицию
 class InvalidPositionException : public std::out_of_range {
 public:
@@ -86,11 +202,21 @@ public:
     using std::runtime_error::runtime_error;
 };
 
+// Исключение, выбрасываемое при вызове Commit или Rollback вне транзакции и
+// при попытке начать транзакцию внутри другой
+class TransactionException : public std::logic_error {
+public:
+    using std::logic_error::logic_error;
+};
+
 class CellInterface {
 public:
     // Либо текст ячейки, либо значение формулы, либо сообщение об ошибке из
     // формулы
     using Value = std::variant<std::string, double, FormulaError>;
+    // То же значение без копирования: текст ссылается на строку в ячейке и
+    // действителен, пока ячейка не изменится
+    using ValueView = std::variant<std::string_view, double, FormulaError>;
 
     virtual ~CellInterface() = default;
 
@@ -107,10 +233,23 @@ public:
     // формуле. Список отсортирован по возрастанию и не содержит повторяющихся
     // ячеек. В случае текстовой ячейки список пуст.
     virtual std::vector<Position> GetReferencedCells() const = 0;
+
+    // Читает значение ячейки так, как его видят формулы, не копируя текст:
+    // число записывается в number, ошибка формулы - в error. Текст ячейки
+    // разбирается один раз, когда он задаётся.
+    virtual CellNumberKind GetNumber(double& number, FormulaError& error) const = 0;
+
+    // Методы ниже - варианты GetValue(), GetText() и GetReferencedCells(),
+    // которые не выделяют память. Ими пользуются вычисление и печать листа.
+    virtual ValueView GetValueView() const = 0;
+    // Выводит текст ячейки в поток, не собирая его в строку
+    virtual void PrintText(std::ostream& output) const = 0;
+    virtual PositionsView GetReferencedCellsView() const = 0;
 };
 
 //std::ostream& operator<<(std::ostream& output, CellInterface::Value value);
 std::ostream& operator<<(std::ostream& output, const CellInterface::Value& value);
+std::ostream& operator<<(std::ostream& output, const CellInterface::ValueView& value);
 
 inline constexpr char FORMULA_SIGN = '=';
 inline constexpr char ESCAPE_SIGN = '\'';
@@ -140,6 +279,11 @@ public:
     virtual const CellInterface* GetCell(Position pos) const = 0;
     virtual CellInterface* GetCell(Position pos) = 0;
 
+    // Читает значение ячейки так, как его видят формулы (см.
+    // CellInterface::GetNumber); у несуществующей ячейки - Empty. Позиция не
+    // проверяется: формулы передают только ссылки, проверенные при разборе.
+    virtual CellNumberKind GetNumber(Position pos, double& number, FormulaError& error) const = 0;
+
     // Очищает ячейку.
     // Последующий вызов GetCell() для этой ячейки вернёт либо nullptr, либо
     // объект с пустым текстом.
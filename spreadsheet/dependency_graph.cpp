@@ -0,0 +1,559 @@
+#include "dependency_graph.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+EdgeList::EdgeList(EdgeList&& other) noexcept {
+    *this = std::move(other);
+}
+
+EdgeList& EdgeList::operator=(EdgeList&& other) noexcept {
+    if(this == &other)
+    {
+        return *this;
+    }
+    Clear();
+    size_ = other.size_;
+    capacity_ = other.capacity_;
+    if(other.IsInline())
+    {
+        std::copy(other.inline_, other.inline_ + other.size_, inline_);
+    }
+    else
+    {
+        heap_ = other.heap_;
+        other.capacity_ = INLINE_CAPACITY;
+    }
+    other.size_ = 0;
+    return *this;
+}
+
+EdgeList::~EdgeList() {
+    Clear();
+}
+
+void EdgeList::PushBack(CellId id) {
+    if(size_ == capacity_)
+    {
+        const std::uint32_t new_capacity = capacity_ * 2;
+        CellId* new_data = new CellId[new_capacity];
+        std::copy(begin(), end(), new_data);
+        if(!IsInline())
+        {
+            delete[] heap_;
+        }
+        heap_ = new_data;
+        capacity_ = new_capacity;
+    }
+    Data()[size_++] = id;
+}
+
+bool EdgeList::Erase(CellId id) {
+    CellId* data = Data();
+    CellId* it = std::find(data, data + size_, id);
+    if(it == data + size_)
+    {
+        return false;
+    }
+    *it = data[--size_];
+    if(!IsInline() && size_ <= INLINE_CAPACITY)
+    {
+        // Короткий список возвращается внутрь объекта
+        CellId* heap_data = heap_;
+        std::copy(heap_data, heap_data + size_, inline_);
+        delete[] heap_data;
+        capacity_ = INLINE_CAPACITY;
+    }
+    return true;
+}
+
+void EdgeList::Clear() {
+    if(!IsInline())
+    {
+        delete[] heap_;
+        capacity_ = INLINE_CAPACITY;
+    }
+    size_ = 0;
+}
+
+CellId DependencyGraph::AddNode(Cell* cell, bool place_first, Position pos) {
+    CellId id;
+    if(!free_ids_.empty())
+    {
+        id = free_ids_.back();
+        free_ids_.pop_back();
+    }
+    else
+    {
+        id = static_cast<CellId>(cells_.size());
+        cells_.emplace_back();
+        references_.emplace_back();
+        dependents_.emplace_back();
+        orders_.emplace_back();
+        positions_.emplace_back();
+        visit_marks_.emplace_back();
+    }
+    cells_[id] = cell;
+    positions_[id] = pos;
+    if(pos.IsValid() && range_index_.Covers(pos))
+    {
+        place_first = true;
+    }
+    orders_[id] = place_first ? --min_order_ : ++max_order_;
+    return id;
+}
+
+void DependencyGraph::RemoveNode(CellId id) {
+    ClearReferences(id);
+    for(CellId dependent : dependents_[id])
+    {
+        references_[dependent].Erase(id);
+    }
+    dependents_[id].Clear();
+    cells_[id] = nullptr;
+    positions_[id] = Position::NONE;
+    free_ids_.push_back(id);
+}
+
+void DependencyGraph::SetCell(CellId id, Cell* cell) {
+    // Диапазоны видят только вершины с ячейками, поэтому вершина без ячейки
+    // могла оказаться в порядке после формулы, диапазон которой её
+    // покрывает. Ссылок у такой вершины нет, и в начале порядка она ничего
+    // не нарушает.
+    if(cells_[id] == nullptr && cell != nullptr && range_index_.Covers(positions_[id]))
+    {
+        assert(references_[id].Empty());
+        orders_[id] = --min_order_;
+    }
+    cells_[id] = cell;
+}
+
+const std::vector<CellRange>& DependencyGraph::GetRanges(CellId id) const {
+    static const std::vector<CellRange> no_ranges;
+    auto it = range_owners_.find(id);
+    return it == range_owners_.end() ? no_ranges : it->second;
+}
+
+bool DependencyGraph::SetReferences(CellId dependent, const std::vector<CellId>& references,
+                                    const std::vector<CellRange>& ranges) {
+    // Проверка и перестановка порядка идут при старых рёбрах: они порядок
+    // не нарушают, а новый цикл обязан пройти через новую ссылку
+    for(CellId reference : references)
+    {
+        if(reference == dependent || !UpdateOrderForEdge(reference, dependent))
+        {
+            return false;
+        }
+    }
+    std::vector<CellId> range_cells;
+    for(const CellRange& range : ranges)
+    {
+        if(range.Contains(positions_[dependent]))
+        {
+            return false;
+        }
+        range_cells.clear();
+        if(collect_range_cells_)
+        {
+            collect_range_cells_(range, range_cells);
+        }
+        for(CellId reference : range_cells)
+        {
+            if(!UpdateOrderForEdge(reference, dependent))
+            {
+                return false;
+            }
+        }
+    }
+    ClearReferences(dependent);
+    for(CellId reference : references)
+    {
+        references_[dependent].PushBack(reference);
+        dependents_[reference].PushBack(dependent);
+    }
+    if(!ranges.empty())
+    {
+        for(const CellRange& range : ranges)
+        {
+            range_index_.Add(range, dependent);
+        }
+        range_owners_[dependent] = ranges;
+    }
+    return true;
+}
+
+void DependencyGraph::ClearReferences(CellId dependent) {
+    for(CellId reference : references_[dependent])
+    {
+        dependents_[reference].Erase(dependent);
+    }
+    references_[dependent].Clear();
+    auto it = range_owners_.find(dependent);
+    if(it != range_owners_.end())
+    {
+        for(const CellRange& range : it->second)
+        {
+            range_index_.Remove(range, dependent);
+        }
+        range_owners_.erase(it);
+    }
+}
+
+void DependencyGraph::Reserve(size_t nodes) {
+    cells_.reserve(nodes);
+    references_.reserve(nodes);
+    dependents_.reserve(nodes);
+    orders_.reserve(nodes);
+    positions_.reserve(nodes);
+    visit_marks_.reserve(nodes);
+}
+
+void DependencyGraph::AddReferencesUnchecked(CellId dependent, const std::vector<CellId>& references,
+                                             const std::vector<CellRange>& ranges) {
+    assert(references_[dependent].Empty() && range_owners_.count(dependent) == 0);
+    for(CellId reference : references)
+    {
+        references_[dependent].PushBack(reference);
+        dependents_[reference].PushBack(dependent);
+    }
+    if(!ranges.empty())
+    {
+        for(const CellRange& range : ranges)
+        {
+            range_index_.Add(range, dependent);
+        }
+        range_owners_[dependent] = ranges;
+    }
+}
+
+std::vector<CellId> DependencyGraph::RebuildOrder() {
+    // Итеративный обход в глубину по ссылкам. Компонента снимается со стека,
+    // когда пройдены все её ссылки, поэтому компоненты выходят в
+    // топологическом порядке: ячейки раньше ссылающихся на них формул.
+    constexpr std::uint32_t UNVISITED = 0;
+    std::vector<std::uint32_t> index(cells_.size(), UNVISITED);
+    std::vector<std::uint32_t> low_link(cells_.size());
+    std::vector<char> on_stack(cells_.size());
+    // Вершина ссылается сама на себя, явно или через свой диапазон
+    std::vector<char> self_reference(cells_.size());
+    std::vector<CellId> component_stack;
+    std::vector<CellId> order;
+    order.reserve(cells_.size());
+    std::vector<CellId> cycle_cells;
+    std::uint32_t next_index = 1;
+
+    struct Frame {
+        CellId id;
+        // Ссылки вершины - общий буфер edges от begin до конца: ссылки
+        // вершин выше по стеку к её возвращению уже сняты
+        size_t begin;
+        size_t next;
+    };
+    std::vector<Frame> frames;
+    std::vector<CellId> edges;
+    auto enter = [&](CellId id) {
+        index[id] = low_link[id] = next_index++;
+        component_stack.push_back(id);
+        on_stack[id] = true;
+        const size_t begin = edges.size();
+        ForEachReference(id, [&edges](CellId reference) {
+            edges.push_back(reference);
+        });
+        frames.push_back({id, begin, begin});
+    };
+
+    for(CellId root = 0; root < cells_.size(); ++root)
+    {
+        if(index[root] != UNVISITED || (cells_[root] == nullptr && !positions_[root].IsValid()))
+        {
+            continue;
+        }
+        if(references_[root].Empty() && range_owners_.count(root) == 0)
+        {
+            // Вершина без ссылок - отдельная компонента, её место - сразу
+            index[root] = next_index++;
+            order.push_back(root);
+            continue;
+        }
+        enter(root);
+        while(!frames.empty())
+        {
+            Frame& frame = frames.back();
+            if(frame.next != edges.size())
+            {
+                const CellId reference = edges[frame.next++];
+                if(reference == frame.id)
+                {
+                    self_reference[reference] = true;
+                }
+                else if(index[reference] == UNVISITED)
+                {
+                    enter(reference);
+                }
+                else if(on_stack[reference])
+                {
+                    low_link[frame.id] = std::min(low_link[frame.id], index[reference]);
+                }
+                continue;
+            }
+            const CellId id = frame.id;
+            edges.resize(frame.begin);
+            frames.pop_back();
+            if(!frames.empty())
+            {
+                const CellId parent = frames.back().id;
+                low_link[parent] = std::min(low_link[parent], low_link[id]);
+            }
+            if(low_link[id] != index[id])
+            {
+                continue;
+            }
+            // id - корень компоненты: она лежит на стеке от id до вершины
+            const auto first = std::find(component_stack.rbegin(), component_stack.rend(), id).base() - 1;
+            if(component_stack.end() - first > 1 || self_reference[id])
+            {
+                cycle_cells.insert(cycle_cells.end(), first, component_stack.end());
+            }
+            for(auto it = first; it != component_stack.end(); ++it)
+            {
+                on_stack[*it] = false;
+                order.push_back(*it);
+            }
+            component_stack.erase(first, component_stack.end());
+        }
+    }
+    if(!cycle_cells.empty())
+    {
+        return cycle_cells;
+    }
+
+    min_order_ = 0;
+    max_order_ = -1;
+    for(CellId id : order)
+    {
+        orders_[id] = ++max_order_;
+    }
+    return {};
+}
+
+bool DependencyGraph::UpdateOrder(const std::vector<CellId>& changed) {
+    // Переезжающие вершины замкнуты по зависимым: ссылок на них у остальных
+    // вершин нет, и в конце порядка их достаточно упорядочить между собой.
+    // Старые рёбра циклов не образуют, поэтому цикл проходит через ссылку,
+    // нарушившую порядок, и целиком лежит среди переезжающих вершин.
+    // Метки обхода: moved - вершина переезжает, entered - она на пути обхода
+    // в глубину, placed - её место в порядке найдено.
+    if(visit_generation_ > std::numeric_limits<std::uint32_t>::max() - 3)
+    {
+        std::fill(visit_marks_.begin(), visit_marks_.end(), 0);
+        visit_generation_ = 0;
+    }
+    const std::uint32_t moved = ++visit_generation_;
+    const std::uint32_t entered = ++visit_generation_;
+    const std::uint32_t placed = ++visit_generation_;
+
+    std::vector<CellId> moved_ids;
+    for(CellId id : changed)
+    {
+        bool violated = false;
+        ForEachReference(id, [this, id, &violated](CellId reference) {
+            violated |= orders_[reference] >= orders_[id];
+        });
+        if(violated && visit_marks_[id] != moved)
+        {
+            visit_marks_[id] = moved;
+            moved_ids.push_back(id);
+        }
+    }
+    for(size_t i = 0; i < moved_ids.size(); ++i)
+    {
+        ForEachDependent(moved_ids[i], [this, moved, &moved_ids](CellId dependent) {
+            if(visit_marks_[dependent] != moved)
+            {
+                visit_marks_[dependent] = moved;
+                moved_ids.push_back(dependent);
+            }
+        });
+    }
+
+    // Итеративный обход в глубину по ссылкам внутри переезжающих вершин:
+    // вершина получает место после всех своих ссылок
+    struct Frame {
+        CellId id;
+        // Ссылки вершины - общий буфер edges от begin до конца
+        size_t begin;
+        size_t next;
+    };
+    std::vector<Frame> frames;
+    std::vector<CellId> edges;
+    std::vector<CellId> order;
+    order.reserve(moved_ids.size());
+    auto enter = [&](CellId id) {
+        visit_marks_[id] = entered;
+        const size_t begin = edges.size();
+        ForEachReference(id, [&](CellId reference) {
+            if(visit_marks_[reference] == moved || visit_marks_[reference] == entered)
+            {
+                edges.push_back(reference);
+            }
+        });
+        frames.push_back({id, begin, begin});
+    };
+    for(CellId root : moved_ids)
+    {
+        if(visit_marks_[root] != moved)
+        {
+            continue;
+        }
+        enter(root);
+        while(!frames.empty())
+        {
+            Frame& frame = frames.back();
+            if(frame.next != edges.size())
+            {
+                const CellId reference = edges[frame.next++];
+                if(visit_marks_[reference] == entered)
+                {
+                    return false;
+                }
+                if(visit_marks_[reference] == moved)
+                {
+                    enter(reference);
+                }
+                continue;
+            }
+            visit_marks_[frame.id] = placed;
+            order.push_back(frame.id);
+            edges.resize(frame.begin);
+            frames.pop_back();
+        }
+    }
+    for(CellId id : order)
+    {
+        orders_[id] = ++max_order_;
+    }
+    return true;
+}
+
+void DependencyGraph::CollectRangeCells(CellId id, std::vector<CellId>& ids) const {
+    for(const CellRange& range : GetRanges(id))
+    {
+        CollectCellsInRange(range, ids);
+    }
+}
+
+size_t DependencyGraph::GetMemoryUsage() const {
+    size_t bytes = cells_.capacity() * sizeof(Cell*)
+                   + references_.capacity() * sizeof(EdgeList)
+                   + dependents_.capacity() * sizeof(EdgeList)
+                   + orders_.capacity() * sizeof(int)
+                   + positions_.capacity() * sizeof(Position)
+                   + free_ids_.capacity() * sizeof(CellId)
+                   + visit_marks_.capacity() * sizeof(std::uint32_t)
+                   + range_index_.GetMemoryUsage();
+    for(CellId id = 0; id < cells_.size(); ++id)
+    {
+        bytes += references_[id].GetHeapBytes() + dependents_[id].GetHeapBytes();
+    }
+    return bytes;
+}
+
+bool DependencyGraph::Visit(CellId id) {
+    if(visit_marks_[id] == visit_generation_)
+    {
+        return false;
+    }
+    visit_marks_[id] = visit_generation_;
+    return true;
+}
+
+bool DependencyGraph::UpdateOrderForEdge(CellId reference, CellId dependent) {
+    // Инкрементальная топологическая сортировка Пирса-Келли. Если ребро
+    // reference -> dependent нарушает порядок, переставляются только вершины
+    // между ними: зависящие от dependent (forward) и те, от которых зависит
+    // reference (backward). Если forward доходит до reference, ребро
+    // замыкает цикл.
+    const int lower_bound = orders_[dependent];
+    const int upper_bound = orders_[reference];
+    if(upper_bound < lower_bound)
+    {
+        return true;
+    }
+
+    if(++visit_generation_ == 0)
+    {
+        std::fill(visit_marks_.begin(), visit_marks_.end(), 0);
+        visit_generation_ = 1;
+    }
+
+    std::vector<CellId> forward;
+    std::vector<CellId> stack = {dependent};
+    Visit(dependent);
+    while(!stack.empty())
+    {
+        CellId id = stack.back();
+        stack.pop_back();
+        forward.push_back(id);
+        bool cycle = false;
+        ForEachDependent(id, [&](CellId next) {
+            if(next == reference)
+            {
+                cycle = true;
+            }
+            else if(orders_[next] < upper_bound && Visit(next))
+            {
+                stack.push_back(next);
+            }
+        });
+        if(cycle)
+        {
+            return false;
+        }
+    }
+
+    std::vector<CellId> backward;
+    stack = {reference};
+    Visit(reference);
+    while(!stack.empty())
+    {
+        CellId id = stack.back();
+        stack.pop_back();
+        backward.push_back(id);
+        ForEachReference(id, [&](CellId next) {
+            if(orders_[next] > lower_bound && Visit(next))
+            {
+                stack.push_back(next);
+            }
+        });
+    }
+
+    // Занятые участком места раздаются заново: сначала backward, затем
+    // forward, с сохранением порядка внутри каждой группы
+    auto by_order = [this](CellId lhs, CellId rhs) {
+        return orders_[lhs] < orders_[rhs];
+    };
+    std::sort(forward.begin(), forward.end(), by_order);
+    std::sort(backward.begin(), backward.end(), by_order);
+    std::vector<int> orders;
+    orders.reserve(forward.size() + backward.size());
+    for(CellId id : backward)
+    {
+        orders.push_back(orders_[id]);
+    }
+    for(CellId id : forward)
+    {
+        orders.push_back(orders_[id]);
+    }
+    std::sort(orders.begin(), orders.end());
+    size_t next_order = 0;
+    for(CellId id : backward)
+    {
+        orders_[id] = orders[next_order++];
+    }
+    for(CellId id : forward)
+    {
+        orders_[id] = orders[next_order++];
+    }
+    return true;
+}
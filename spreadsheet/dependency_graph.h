@@ -0,0 +1,230 @@
+#pragma once
+
+#include "common.h"
+#include "range_index.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+class Cell;
+
+// Плотный номер ячейки в графе зависимостей
+using CellId = std::uint32_t;
+
+// Список соседей вершины. До INLINE_CAPACITY номеров хранится в самом
+// объекте, больший список переезжает в массив в куче. У большинства ячеек
+// 0-3 ссылки, поэтому обычно память под рёбра не выделяется вовсе.
+class EdgeList {
+public:
+    static constexpr std::uint32_t INLINE_CAPACITY = 3;
+
+    EdgeList() = default;
+    EdgeList(EdgeList&& other) noexcept;
+    EdgeList& operator=(EdgeList&& other) noexcept;
+    EdgeList(const EdgeList&) = delete;
+    EdgeList& operator=(const EdgeList&) = delete;
+    ~EdgeList();
+
+    const CellId* begin() const {
+        return IsInline() ? inline_ : heap_;
+    }
+    const CellId* end() const {
+        return begin() + size_;
+    }
+    size_t Size() const {
+        return size_;
+    }
+    bool Empty() const {
+        return size_ == 0;
+    }
+
+    // Добавляет номер без проверки на повтор: следить за этим должен граф
+    void PushBack(CellId id);
+    // Удаляет номер, меняя порядок остальных. Возвращает false, если номера нет.
+    bool Erase(CellId id);
+    void Clear();
+
+    // Память, выделенная в куче под длинный список
+    size_t GetHeapBytes() const {
+        return IsInline() ? 0 : capacity_ * sizeof(CellId);
+    }
+
+private:
+    std::uint32_t size_ = 0;
+    std::uint32_t capacity_ = INLINE_CAPACITY;
+    union {
+        CellId inline_[INLINE_CAPACITY];
+        CellId* heap_;
+    };
+
+    bool IsInline() const {
+        return capacity_ == INLINE_CAPACITY;
+    }
+    CellId* Data() {
+        return IsInline() ? inline_ : heap_;
+    }
+};
+
+// Граф зависимостей между ячейками листа. Вершины - плотные номера ячеек,
+// освобождённые номера переиспользуются. Для каждой вершины хранятся
+// ссылки её формулы (references), зависящие от неё формулы (dependents) и
+// место в топологическом порядке: формула всегда стоит после всех ячеек,
+// на которые ссылается.
+//
+// Диапазонные ссылки (A1:B10) в рёбра не раскрываются: формула хранит сами
+// диапазоны, а RangeIndex по позиции ячейки находит формулы, диапазоны
+// которых её покрывают. Такие неявные рёбра учитываются и в порядке, и при
+// поиске циклов. Существующие ячейки диапазона граф получает от листа через
+// RangeCellsCollector.
+class DependencyGraph {
+public:
+    // Дописывает в ids номера существующих ячеек диапазона
+    using RangeCellsCollector = std::function<void(const CellRange& range, std::vector<CellId>& ids)>;
+
+    void SetRangeCellsCollector(RangeCellsCollector collector) {
+        collect_range_cells_ = std::move(collector);
+    }
+
+    // Добавляет изолированную вершину. Вершина без ссылок может встать в
+    // любое место порядка: в начало - если на неё будут только ссылаться,
+    // в конец - если она сама будет ссылаться на другие. Вершина внутри
+    // чьего-то диапазона всегда встаёт в начало: от неё уже зависит формула.
+    CellId AddNode(Cell* cell, bool place_first, Position pos = Position::NONE);
+    // Удаляет вершину вместе со всеми её рёбрами
+    void RemoveNode(CellId id);
+
+    // Ячейка вершины. У вершины несуществующей ячейки, на которую ссылаются
+    // формулы, ячейки нет: nullptr. Такая вершина получает ячейку, когда в
+    // её позицию что-то записывают, со всеми рёбрами и местом в порядке.
+    Cell* GetCell(CellId id) const {
+        return cells_[id];
+    }
+    void SetCell(CellId id, Cell* cell);
+    const EdgeList& GetReferences(CellId id) const {
+        return references_[id];
+    }
+    const EdgeList& GetDependents(CellId id) const {
+        return dependents_[id];
+    }
+    int GetOrder(CellId id) const {
+        return orders_[id];
+    }
+    Position GetPosition(CellId id) const {
+        return positions_[id];
+    }
+    const std::vector<CellRange>& GetRanges(CellId id) const;
+
+    // Вызывает func(id) для всех формул, зависящих от вершины: по явным
+    // ссылкам и через диапазоны. Формула может встретиться несколько раз.
+    template <typename Func>
+    void ForEachDependent(CellId id, Func func) const {
+        for(CellId dependent : dependents_[id])
+        {
+            func(dependent);
+        }
+        if(positions_[id].IsValid())
+        {
+            range_index_.ForEachCovering(positions_[id], func);
+        }
+    }
+
+    // Вызывает func(id, range) для формул, диапазон range которых покрывает
+    // вершину
+    template <typename Func>
+    void ForEachRangeDependent(CellId id, Func func) const {
+        if(positions_[id].IsValid())
+        {
+            range_index_.ForEachCoveringRange(positions_[id], func);
+        }
+    }
+
+    // Дописывает в ids номера существующих ячеек диапазона
+    void CollectCellsInRange(const CellRange& range, std::vector<CellId>& ids) const {
+        if(collect_range_cells_)
+        {
+            collect_range_cells_(range, ids);
+        }
+    }
+
+    // Вызывает func(id) для всех вершин, на которые ссылается формула
+    // вершины: явно и через существующие ячейки её диапазонов.
+    template <typename Func>
+    void ForEachReference(CellId id, Func func) const {
+        for(CellId reference : references_[id])
+        {
+            func(reference);
+        }
+        if(!range_owners_.empty() && range_owners_.count(id) != 0)
+        {
+            std::vector<CellId> range_cells;
+            CollectRangeCells(id, range_cells);
+            for(CellId reference : range_cells)
+            {
+                func(reference);
+            }
+        }
+    }
+
+    // Граница номеров вершин: все номера меньше неё
+    size_t GetIdBound() const {
+        return cells_.size();
+    }
+
+    // Заменяет ссылки формулы вершины dependent. Если новые ссылки или
+    // диапазоны замыкают цикл, возвращает false и оставляет рёбра графа без
+    // изменений. Проверка диапазона перебирает его существующие ячейки.
+    bool SetReferences(CellId dependent, const std::vector<CellId>& references,
+                       const std::vector<CellRange>& ranges = {});
+    void ClearReferences(CellId dependent);
+
+    // Резервирует место под nodes вершин: добавление вершин не перекладывает
+    // массивы графа
+    void Reserve(size_t nodes);
+
+    // Построение графа целиком, при загрузке листа. Ссылки вершин
+    // добавляются без проверки циклов и без поддержки порядка, после чего
+    // RebuildOrder один раз ищет циклы и расставляет порядок заново.
+    void AddReferencesUnchecked(CellId dependent, const std::vector<CellId>& references,
+                                const std::vector<CellRange>& ranges);
+    // Находит компоненты сильной связности графа (алгоритм Тарьяна) и
+    // возвращает все вершины, входящие в циклы. Если циклов нет, вершины
+    // получают новый топологический порядок.
+    std::vector<CellId> RebuildOrder();
+    // Порядок после пакетной замены ссылок (транзакция листа): ссылки
+    // вершин changed добавлены AddReferencesUnchecked, а рёбра остальных
+    // вершин порядок не нарушают. Ищет циклы через новые ссылки и при цикле
+    // возвращает false, не меняя порядка. Иначе вершины changed, ссылки
+    // которых стоят не раньше них, вместе со всеми зависящими от них
+    // формулами переезжают в конец порядка.
+    bool UpdateOrder(const std::vector<CellId>& changed);
+
+    // Память, занятая графом, в байтах
+    size_t GetMemoryUsage() const;
+
+private:
+    std::vector<Cell*> cells_;
+    std::vector<EdgeList> references_;
+    std::vector<EdgeList> dependents_;
+    std::vector<int> orders_;
+    std::vector<Position> positions_;
+    std::vector<CellId> free_ids_;
+
+    // Диапазоны есть у немногих формул, поэтому они хранятся отдельно
+    std::unordered_map<CellId, std::vector<CellRange>> range_owners_;
+    RangeIndex range_index_;
+    RangeCellsCollector collect_range_cells_;
+
+    int min_order_ = 0;
+    int max_order_ = 0;
+
+    // Метки обхода: вершина посещена, если её метка равна текущему поколению
+    std::vector<std::uint32_t> visit_marks_;
+    std::uint32_t visit_generation_ = 0;
+
+    void CollectRangeCells(CellId id, std::vector<CellId>& ids) const;
+    bool UpdateOrderForEdge(CellId reference, CellId dependent);
+    bool Visit(CellId id);
+};
@@ -4,8 +4,9 @@
 
 #include <algorithm>
 #include <cassert>
-#include <cctype>
-#include <sstream>
+#include <charconv>
+#include <cmath>
+#include <limits>
 #include <sstream>
 
 using namespace std::literals;
@@ -22,45 +23,144 @@ std::ostream& operator<<(std::ostream& output, FormulaError fe) {
     return output << "#REF!";
 }
 
+namespace {
+// Допустимая относительная погрешность суммы, обновлённой по разнице.
+// Обычный вывод значений показывает 6 значащих цифр, так что расхождение
+// с полным пересчётом остаётся невидимым.
+const double MAX_RELATIVE_ROUNDING_ERROR = 1e-10;
+
+// Пробельные символы локали "C", которые пропускает std::strtod
+bool IsSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+}  // namespace
+
+void RangeTotal::Update(std::optional<double> old_value, std::optional<double> new_value) {
+    if(!valid)
+    {
+        return;
+    }
+    const double delta = new_value.value_or(0.0) - old_value.value_or(0.0);
+    count = count - (old_value ? 1 : 0) + (new_value ? 1 : 0);
+    sum += delta;
+    // Каждое сложение ошибается не больше чем на половину ulp результата
+    rounding_error += std::numeric_limits<double>::epsilon() * (std::abs(sum) + std::abs(delta));
+    if(std::isinf(sum) || rounding_error > MAX_RELATIVE_ROUNDING_ERROR * std::abs(sum))
+    {
+        Invalidate();
+        return;
+    }
+
+    if(!extrema_valid)
+    {
+        return;
+    }
+    if(old_value && count > 0 && (*old_value == min || *old_value == max))
+    {
+        // Ушло крайнее значение: новое крайнее без перечитывания не найти
+        extrema_valid = false;
+        return;
+    }
+    if(new_value)
+    {
+        const bool first = count == 1;
+        min = first ? *new_value : std::min(min, *new_value);
+        max = first ? *new_value : std::max(max, *new_value);
+    }
+}
+
+bool ParseNumericText(std::string_view text, double& out) {
+    // std::from_chars не смотрит на локаль, но в отличие от std::strtod не
+    // пропускает пробелы в начале, знак "+" и префикс "0x" - они снимаются
+    // здесь
+    while(!text.empty() && IsSpace(text.front()))
+    {
+        text.remove_prefix(1);
+    }
+    const bool negative = !text.empty() && text.front() == '-';
+    if(!text.empty() && (text.front() == '+' || text.front() == '-'))
+    {
+        text.remove_prefix(1);
+    }
+    std::chars_format format = std::chars_format::general;
+    if(text.size() > 1 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X'))
+    {
+        format = std::chars_format::hex;
+        text.remove_prefix(2);
+    }
+    if(text.empty() || text.front() == '+' || text.front() == '-')
+    {
+        return false;
+    }
+    const char* end = text.data() + text.size();
+    const auto [ptr, ec] = std::from_chars(text.data(), end, out, format);
+    if(ec != std::errc() || ptr != end)
+    {
+        return false;
+    }
+    if(negative)
+    {
+        out = -out;
+    }
+    return true;
+}
+
+std::string FormulaInterface::GetExpression(PositionOffset offset) const {
+    std::ostringstream str_stream;
+    PrintExpression(str_stream, offset);
+    return str_stream.str();
+}
+
 namespace {
 class Formula : public FormulaInterface {
 public:
     explicit Formula(std::string expression) 
     try
-        : ast_(ParseFormulaAST(expression)) {
+        : ast_(ParseFormulaAST(expression))
+        , program_(ast_.Compile()) {
+        // Ячейки упорядочиваются один раз: сдвиг порядок не меняет
+        for(Position pos : ast_.GetCells())
+        {
+            cells_.push_back(pos);
+        }
+        std::sort(cells_.begin(), cells_.end());
+        cells_.erase(std::unique(cells_.begin(), cells_.end()), cells_.end());
     } catch (...) {
         throw FormulaException ("The formula is incorrect");
     }
     Value Evaluate(const SheetInterface& sheet) const override {
-        Value val;
-        try
-        {
-            val = ast_.Execute(sheet);
-        }
-        catch(const FormulaError& e)
-        {
-            val = e;
-        }
-        return val;
-    } 
-    std::string GetExpression() const override {
-        std::stringstream str_stream;
-        ast_.PrintFormula(str_stream);
-        return str_stream.str();
+        return program_.Execute(sheet);
+    }
+    Value Evaluate(const SheetInterface& sheet, RangeTotal* totals,
+                   PositionOffset offset) const override {
+        return program_.Execute(sheet, totals, offset);
+    }
+    bool IsBatchable() const override {
+        return program_.IsBatchable();
+    }
+    void EvaluateBatch(const SheetInterface& sheet, PositionOffset offset, size_t count,
+                       Value* results) const override {
+        program_.ExecuteBatch(sheet, offset, count, results);
+    }
+    void PrintExpression(std::ostream& output, PositionOffset offset) const override {
+        ast_.PrintFormula(output, offset);
+    }
+
+    PositionsView GetReferencedCellsView(PositionOffset offset) const override {
+        return {cells_, offset};
     }
 
-    std::vector<Position> GetReferencedCells() const override {
-        std::vector<Position> ref_cells = ast_.GetReferencedCells();
-        std::sort(ref_cells.begin(), ref_cells.end(), [](const Position& lhs, const Position& rhs) {
-                                                            return lhs < rhs;
-        });
-        auto last = std::unique(ref_cells.begin(), ref_cells.end());
-        ref_cells.erase(last, ref_cells.end());
-        return ref_cells;
+    const std::vector<CellRange>& GetReferencedRanges() const override {
+        // Порядок совпадает с таблицей диапазонов программы, по нему
+        // нумеруются итоги диапазонов
+        return program_.GetRanges();
     }
 
 private:
     FormulaAST ast_;
+    FormulaProgram program_;
+    // Ячейки формулы без повторов, по возрастанию
+    std::vector<Position> cells_;
 };
 }  // namespace
 
@@ -3,19 +3,66 @@
 #include "common.h"
 
 #include <memory>
+#include <optional>
+#include <string_view>
 #include <vector>
 
 // Формула, позволяющая вычислять и обновлять арифметическое выражение.
 // Поддерживаемые возможности:
 // * Простые бинарные операции и числа, скобки: 1+2*3, 2.5*(2+3.5/7)
 // * Значения ячеек в качестве переменных: A1+B2*C3
+// * Диапазоны ячеек: A1:B10. Вне функций диапазон из одной ячейки даёт её
+//   значение, а больший диапазон - ошибку #VALUE!
+// * Агрегатные функции SUM, AVERAGE, MIN, MAX, COUNT от чисел и диапазонов:
+//   SUM(A1:A10,B1*2). В диапазонах пустые ячейки и нечисловой текст
+//   пропускаются, ошибки ячеек распространяются. AVERAGE без чисел даёт
+//   #ARITHM!, MIN и MAX без чисел - ноль.
 // Ячейки, указанные в формуле, могут быть как формулами, так и текстом. Если это
 // текст, но он представляет число, тогда его нужно трактовать как число. Пустая
 // ячейка или ячейка с пустым текстом трактуется как число ноль.
+// Итог чисел одного диапазона формулы: сумма, количество и крайние
+// значения. Итог хранит ячейка с формулой и при записи числа в ячейку
+// диапазона обновляет его по разнице старого и нового значения, не
+// перечитывая диапазон. Минимум и максимум по разнице обновляются не всегда:
+// если заменено крайнее значение, они считаются заново при вычислении.
+// Сумма пересчитывается целиком и тогда, когда накопленная погрешность
+// обновлений становится заметной.
+struct RangeTotal {
+    double sum = 0.0;
+    double min = 0.0;
+    double max = 0.0;
+    size_t count = 0;
+    // Оценка сверху погрешности суммы, накопленной обновлениями
+    double rounding_error = 0.0;
+    bool valid = false;
+    bool extrema_valid = false;
+
+    // Число в ячейке диапазона сменилось с old_value на new_value;
+    // nullopt - ячейка не число и в итог не входит.
+    void Update(std::optional<double> old_value, std::optional<double> new_value);
+
+    void Invalidate() {
+        valid = false;
+        extrema_valid = false;
+    }
+};
+
+// Разбирает текст ячейки как число по правилам формул: весь текст должен
+// быть числом в формате std::strtod, но без учёта локали. Исключения не
+// бросает.
+bool ParseNumericText(std::string_view text, double& out);
+
+// Все ссылки формулы относительные: формула, скопированная в другую ячейку,
+// ссылается на ячейки, сдвинутые так же. Поэтому одна разобранная формула
+// служит всем своим копиям: методы с параметром offset работают с копией,
+// сдвинутой на offset (см. FormulaTable).
 class FormulaInterface {
 public:
     using Value = std::variant<double, FormulaError>;
 
+    // Наибольшее число копий формулы в EvaluateBatch
+    static constexpr size_t BATCH_SIZE = 64;
+
     virtual ~FormulaInterface() = default;
 
     // Обратите внимание, что в метод Evaluate() ссылка на таблицу передаётся 
@@ -26,14 +73,51 @@ public:
     // любая.
     virtual Value Evaluate(const SheetInterface& sheet) const = 0;
 
+    // То же для копии формулы, сдвинутой на offset, но агрегатные функции
+    // берут числа диапазонов из сохранённых итогов totals, если те
+    // действительны, и сохраняют туда итоги прочитанных диапазонов. totals -
+    // массив по одному итогу на диапазон в порядке GetReferencedRanges()
+    // либо nullptr, тогда диапазоны читаются целиком.
+    virtual Value Evaluate(const SheetInterface& sheet, RangeTotal* totals,
+                           PositionOffset offset) const = 0;
+
+    // Можно ли вычислять копии формулы пачкой. Формулы с диапазонами и
+    // агрегатными функциями вычисляются только по одной.
+    virtual bool IsBatchable() const = 0;
+
+    // Вычисляет count <= BATCH_SIZE копий формулы в соседних ячейках
+    // столбца: со сдвигами offset, offset и ещё одна строка и т.д. Результат
+    // копии i записывается в results[i] и совпадает с результатом Evaluate.
+    // Только для IsBatchable().
+    virtual void EvaluateBatch(const SheetInterface& sheet, PositionOffset offset, size_t count,
+                               Value* results) const = 0;
+
     // Возвращает выражение, которое описывает формулу.
     // Не содержит пробелов и лишних скобок.
-    virtual std::string GetExpression() const = 0;
+    std::string GetExpression() const {
+        return GetExpression(PositionOffset{});
+    }
+    std::string GetExpression(PositionOffset offset) const;
+    // Выводит выражение в поток, не собирая его в строку
+    virtual void PrintExpression(std::ostream& output, PositionOffset offset) const = 0;
 
     // Возвращает список ячеек, которые непосредственно задействованы в вычислении
     // формулы. Список отсортирован по возрастанию и не содержит повторяющихся
-    // ячеек.
-    virtual std::vector<Position> GetReferencedCells() const = 0;
+    // ячеек. Ячейки диапазонов в него не входят.
+    std::vector<Position> GetReferencedCells() const {
+        return GetReferencedCells(PositionOffset{});
+    }
+    std::vector<Position> GetReferencedCells(PositionOffset offset) const {
+        const PositionsView cells = GetReferencedCellsView(offset);
+        return {cells.begin(), cells.end()};
+    }
+    // Тот же список без копирования: ячейки упорядочены один раз при разборе
+    // формулы, сдвиг порядок не меняет
+    virtual PositionsView GetReferencedCellsView(PositionOffset offset) const = 0;
+
+    // Возвращает диапазоны формулы в порядке записи, без повторов. Диапазоны
+    // копии формулы получаются сдвигом на её offset.
+    virtual const std::vector<CellRange>& GetReferencedRanges() const = 0;
 };
 
 // Парсит переданное выражение и возвращает объект формулы.
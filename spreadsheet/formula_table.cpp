@@ -0,0 +1,93 @@
+#include "formula_table.h"
+
+#include "FormulaAST.h"
+
+FormulaTable::Entry FormulaTable::Intern(std::string_view expression, Position anchor) {
+    if(!MakeRelativeKey(expression, anchor, key_))
+    {
+        throw FormulaException("The formula is incorrect");
+    }
+    auto it = bodies_.find(key_);
+    if(it != bodies_.end())
+    {
+        return {it->second.formula.lock(), PositionOffset::Between(it->second.anchor, anchor)};
+    }
+
+    return {AddBody(key_, anchor, ParseFormula(std::string(expression))), {}};
+}
+
+std::vector<FormulaTable::Entry> FormulaTable::InternAll(
+    const std::vector<std::pair<std::string_view, Position>>& formulas, ThreadPool& pool) {
+    std::vector<std::string> keys(formulas.size());
+    std::vector<char> valid(formulas.size());
+    pool.ParallelFor(formulas.size(), [&](size_t i) {
+        valid[i] = MakeRelativeKey(formulas[i].first, formulas[i].second, keys[i]);
+    });
+
+    // Формулы с одинаковым ключом разбираются один раз, в первой ячейке
+    std::vector<Entry> entries(formulas.size());
+    std::unordered_map<std::string_view, size_t> first_by_key;
+    std::vector<size_t> to_parse;
+    for(size_t i = 0; i < formulas.size(); ++i)
+    {
+        if(!valid[i])
+        {
+            continue;
+        }
+        auto it = bodies_.find(keys[i]);
+        if(it != bodies_.end())
+        {
+            entries[i] = {it->second.formula.lock(), PositionOffset::Between(it->second.anchor, formulas[i].second)};
+        }
+        else if(first_by_key.try_emplace(keys[i], i).second)
+        {
+            to_parse.push_back(i);
+        }
+    }
+    std::vector<std::unique_ptr<FormulaInterface>> parsed(to_parse.size());
+    pool.ParallelFor(to_parse.size(), [&](size_t i) {
+        try {
+            parsed[i] = ParseFormula(std::string(formulas[to_parse[i]].first));
+        }
+        catch (const FormulaException&)
+        {
+            valid[to_parse[i]] = false;
+        }
+    });
+    for(size_t i = 0; i < to_parse.size(); ++i)
+    {
+        if(parsed[i] != nullptr)
+        {
+            entries[to_parse[i]] = {AddBody(keys[to_parse[i]], formulas[to_parse[i]].second, std::move(parsed[i])), {}};
+        }
+    }
+
+    for(size_t i = 0; i < formulas.size(); ++i)
+    {
+        if(entries[i].formula != nullptr)
+        {
+            continue;
+        }
+        auto it = first_by_key.find(keys[i]);
+        if(!valid[i] || it == first_by_key.end() || entries[it->second].formula == nullptr)
+        {
+            throw FormulaException("The formula in " + formulas[i].second.ToString() + " is incorrect");
+        }
+        entries[i] = {entries[it->second].formula, PositionOffset::Between(formulas[it->second].second, formulas[i].second)};
+    }
+    return entries;
+}
+
+std::shared_ptr<const FormulaInterface> FormulaTable::AddBody(const std::string& key, Position anchor,
+                                                              std::unique_ptr<FormulaInterface> parsed) {
+    auto it = bodies_.emplace(key, Body{{}, anchor}).first;
+    // Последняя ячейка, отпустившая тело, удаляет его из таблицы. Адрес
+    // ключа в узле не меняется при перестройке таблицы.
+    const std::string* key_address = &it->first;
+    std::shared_ptr<const FormulaInterface> formula(parsed.release(), [this, key_address](const FormulaInterface* body) {
+        bodies_.erase(bodies_.find(*key_address));
+        delete body;
+    });
+    it->second.formula = formula;
+    return formula;
+}
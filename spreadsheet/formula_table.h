@@ -0,0 +1,62 @@
+#pragma once
+
+#include "common.h"
+#include "formula.h"
+#include "thread_pool.h"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Таблица формул листа. Формулы, совпадающие с точностью до сдвига ссылок
+// (протянутый столбец: =B2*C2, =B3*C3, ...), разбираются и компилируются
+// один раз: ячейки получают общее тело и сдвиг относительно ячейки, в
+// которой тело было разобрано. Формулы сравниваются по относительной записи
+// MakeRelativeKey, поэтому повторная формула даже не разбирается.
+//
+// Тело живёт, пока на него ссылается хотя бы одна ячейка, и удаляется из
+// таблицы вместе с последней. Таблица должна пережить все выданные тела.
+class FormulaTable {
+public:
+    struct Entry {
+        std::shared_ptr<const FormulaInterface> formula;
+        // Сдвиг ячейки относительно ячейки, в которой разобрано тело
+        PositionOffset offset;
+    };
+
+    FormulaTable() = default;
+    FormulaTable(const FormulaTable&) = delete;
+    FormulaTable& operator=(const FormulaTable&) = delete;
+
+    // Возвращает формулу expression (без знака "="), заданную в ячейке
+    // anchor. Бросает FormulaException, если формула некорректна.
+    Entry Intern(std::string_view expression, Position anchor);
+    // То же для многих формул сразу, с результатами в порядке formulas.
+    // Ключи считаются и разные тела разбираются параллельно на пуле. Если
+    // некорректных формул несколько, исключение называет первую из них.
+    std::vector<Entry> InternAll(const std::vector<std::pair<std::string_view, Position>>& formulas,
+                                 ThreadPool& pool);
+
+    // Число разных тел формул
+    size_t Size() const {
+        return bodies_.size();
+    }
+
+private:
+    struct Body {
+        std::weak_ptr<const FormulaInterface> formula;
+        Position anchor;
+    };
+
+    std::unordered_map<std::string, Body> bodies_;
+    // Буфер для записи ключа, чтобы не выделять память на каждую формулу
+    std::string key_;
+
+    // Заводит тело parsed под ключом key
+    std::shared_ptr<const FormulaInterface> AddBody(const std::string& key, Position anchor,
+                                                    std::unique_ptr<FormulaInterface> parsed);
+};
@@ -1,8 +1,23 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <limits>
+#include <random>
 
+#include "FormulaAST.h"
+#include "aggregate_kernels.h"
+#include "allocation_counter.h"
+#include "cell.h"
 #include "common.h"
+#include "dependency_graph.h"
 #include "formula.h"
+#include "sheet.h"
+#include "sheet_import.h"
+#include "sheet_snapshot.h"
 #include "test_runner_p.h"
+#include "thread_pool.h"
 
 inline std::ostream& operator<<(std::ostream& output, Position pos) {
     return output << "(" << pos.row << ", " << pos.col << ")";
@@ -25,6 +40,15 @@ inline std::ostream& operator<<(std::ostream& output, const CellInterface::Value
     return output;
 }
 
+inline std::ostream& operator<<(std::ostream& output, const FormulaInterface::Value& value) {
+    std::visit(
+        [&](const auto& x) {
+            output << x;
+        },
+        value);
+    return output;
+}
+
 namespace {
 
 void TestPositionAndStringConversion() {
@@ -147,6 +171,20 @@ void TestFormulaArithmetic() {
     ASSERT_EQUAL(evaluate("(12+13) * (14+(13-24/(1+1))*55-46)"), 575);
 }
 
+void TestFormulaDeepExpression() {
+    auto sheet = CreateSheet();
+    sheet->SetCell("A1"_pos, "2");
+
+    // Правоассоциативная цепочка держит на стеке вычисления все операнды сразу
+    std::string expr = "A1";
+    for (int i = 0; i < 100; ++i) {
+        expr = "1+(A1-(" + expr + "))";
+    }
+    auto formula = ParseFormula(expr);
+    ASSERT_EQUAL(std::get<double>(formula->Evaluate(*sheet)), 2);
+    ASSERT_EQUAL(formula->GetReferencedCells(), std::vector{"A1"_pos});
+}
+
 void TestFormulaReferences() {
     auto sheet = CreateSheet();
     auto evaluate = [&](std::string expr) {
@@ -246,6 +284,22 @@ void TestErrorArithmetic() {
     }
 }
 
+void TestFormulaErrorsAsValues() {
+    auto sheet = CreateSheet();
+    auto evaluate = [&](std::string expr) {
+        return ParseFormula(std::move(expr))->Evaluate(*sheet);
+    };
+
+    // Ошибки приходят из Evaluate значением, а не исключением
+    ASSERT_EQUAL(evaluate("1/0"), FormulaInterface::Value(FormulaError::Category::Arithmetic));
+    sheet->SetCell("A1"_pos, "text");
+    ASSERT_EQUAL(evaluate("A1+1"), FormulaInterface::Value(FormulaError::Category::Value));
+    sheet->SetCell("A2"_pos, "=1/0");
+    ASSERT_EQUAL(evaluate("1+A2*2"), FormulaInterface::Value(FormulaError::Category::Arithmetic));
+    sheet->SetCell("A3"_pos, "1e999");
+    ASSERT_EQUAL(evaluate("A3"), FormulaInterface::Value(FormulaError::Category::Value));
+}
+
 void TestEmptyCellTreatedAsZero() {
     auto sheet = CreateSheet();
     sheet->SetCell("A1"_pos, "=B2");
@@ -298,9 +352,9 @@ void TestCellReferences() {
     ASSERT_EQUAL(sheet->GetCell("A2"_pos)->GetReferencedCells(), std::vector{"A1"_pos});
     ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetReferencedCells(), std::vector{"A1"_pos});
 
-    // Ссылка на пустую ячейку
+    // Ссылка на пустую ячейку: сама ячейка ради ссылки не создаётся
     sheet->SetCell("B2"_pos, "=B1");
-    ASSERT(sheet->GetCell("B1"_pos)->GetReferencedCells().empty());
+    ASSERT(sheet->GetCell("B1"_pos) == nullptr);
     ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetReferencedCells(), std::vector{"B1"_pos});
 
     sheet->SetCell("A2"_pos, "");
@@ -346,6 +400,1242 @@ void TestCellCircularReferences() {
     ASSERT(caught);
     ASSERT_EQUAL(sheet->GetCell("M6"_pos)->GetText(), "Ready");
 }
+
+void TestDeepDependencyChain() {
+    // Цепочка длиннее, чем выдержал бы рекурсивный обход
+    const int length = 50000;
+    const int rows = 10000;
+    auto chain_pos = [rows](int i) {
+        return Position{i % rows, i / rows};
+    };
+
+    auto sheet = CreateSheet();
+    // Заполняем с конца, чтобы каждая проверка на цикл видела пустую ссылку
+    for (int i = length - 1; i > 0; --i) {
+        sheet->SetCell(chain_pos(i), "=" + chain_pos(i - 1).ToString() + "+1");
+    }
+    sheet->SetCell(chain_pos(0), "1");
+
+    const CellInterface* last = sheet->GetCell(chain_pos(length - 1));
+    ASSERT_EQUAL(std::get<double>(last->GetValue()), length);
+
+    sheet->SetCell(chain_pos(0), "2");
+    ASSERT_EQUAL(std::get<double>(last->GetValue()), length + 1);
+
+    bool caught = false;
+    try {
+        sheet->SetCell(chain_pos(0), "=" + chain_pos(length - 1).ToString());
+    } catch (const CircularDependencyException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+    ASSERT_EQUAL(sheet->GetCell(chain_pos(0))->GetText(), "2");
+}
+
+void TestReferencedEmptyCellUpdate() {
+    auto sheet = CreateSheet();
+    sheet->SetCell("B1"_pos, "=A1*2");
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(0.0));
+
+    // A1 существовала как пустая ячейка без кэша
+    sheet->SetCell("A1"_pos, "5");
+    ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(10.0));
+}
+
+void TestTopologicalOrderMaintained() {
+    Sheet sheet;
+    auto check_order = [&sheet]() {
+        for (int row = 0; row < 6; ++row) {
+            for (int col = 0; col < 6; ++col) {
+                const Cell* cell = dynamic_cast<const Cell*>(sheet.GetCell({row, col}));
+                if (cell == nullptr) {
+                    continue;
+                }
+                // Ссылки на несуществующие ячейки - вершины графа без ячеек
+                const DependencyGraph& graph = sheet.GetDependencyGraph();
+                const EdgeList& references = graph.GetReferences(cell->GetId());
+                ASSERT_EQUAL(references.Size(), cell->GetReferencedCells().size());
+                for (CellId child : references) {
+                    ASSERT(graph.GetOrder(child) < cell->GetTopologicalOrder());
+                }
+            }
+        }
+    };
+
+    // Формулы задаются вразнобой, в том числе против текущего порядка
+    unsigned seed = 17;
+    auto next_random = [&seed](int bound) {
+        seed = seed * 1103515245 + 12345;
+        return static_cast<int>((seed >> 16) % bound);
+    };
+    int cycles = 0;
+    for (int step = 0; step < 300; ++step) {
+        Position target{next_random(6), next_random(6)};
+        std::string formula = "=1";
+        for (int i = next_random(3); i >= 0; --i) {
+            formula += "+" + Position{next_random(6), next_random(6)}.ToString();
+        }
+        try {
+            sheet.SetCell(target, formula);
+        } catch (const CircularDependencyException&) {
+            ++cycles;
+        }
+        check_order();
+    }
+    ASSERT(cycles > 0);
+}
+
+void TestDependencyGraphEdges() {
+    DependencyGraph graph;
+    std::vector<CellId> ids;
+    for (int i = 0; i < 6; ++i) {
+        ids.push_back(graph.AddNode(nullptr, false));
+    }
+
+    // Больше трёх рёбер - список переезжает в кучу и обратно
+    ASSERT(graph.SetReferences(ids[5], {ids[0], ids[1], ids[2], ids[3], ids[4]}));
+    ASSERT_EQUAL(graph.GetReferences(ids[5]).Size(), 5u);
+    ASSERT_EQUAL(graph.GetDependents(ids[0]).Size(), 1u);
+    ASSERT(graph.SetReferences(ids[5], {ids[4]}));
+    ASSERT_EQUAL(graph.GetReferences(ids[5]).Size(), 1u);
+    ASSERT(graph.GetDependents(ids[0]).Empty());
+
+    // Ссылка против порядка переставляет вершины, цикл отвергается
+    ASSERT(graph.SetReferences(ids[0], {ids[5]}));
+    ASSERT(graph.GetOrder(ids[4]) < graph.GetOrder(ids[5]));
+    ASSERT(graph.GetOrder(ids[5]) < graph.GetOrder(ids[0]));
+    ASSERT(!graph.SetReferences(ids[4], {ids[0]}));
+    ASSERT(graph.GetReferences(ids[4]).Empty());
+
+    graph.RemoveNode(ids[5]);
+    ASSERT(graph.GetReferences(ids[0]).Empty());
+    ASSERT(graph.GetDependents(ids[4]).Empty());
+    ASSERT_EQUAL(graph.AddNode(nullptr, true), ids[5]);
+}
+
+void TestParallelRecalculation() {
+    auto fill = [](SheetInterface& sheet) {
+        sheet.SetCell("A1"_pos, "1");
+        sheet.SetCell("B1"_pos, "2");
+        for (int row = 1; row < 200; ++row) {
+            const std::string prev = std::to_string(row);
+            sheet.SetCell({row, 0}, "=A" + prev + "+B1");
+            sheet.SetCell({row, 1}, "=A" + prev + "*2-B" + prev);
+            sheet.SetCell({row, 2}, "=A" + std::to_string(row + 1) + "/B" + std::to_string(row + 1));
+        }
+    };
+    auto check_equal = [](SheetInterface& expected, SheetInterface& actual) {
+        std::ostringstream expected_values, actual_values;
+        expected.PrintValues(expected_values);
+        actual.PrintValues(actual_values);
+        ASSERT_EQUAL(expected_values.str(), actual_values.str());
+    };
+
+    Sheet serial;
+    Sheet parallel;
+    ThreadPool pool(3);
+    fill(serial);
+    fill(parallel);
+    parallel.Recalculate(pool);
+    check_equal(serial, parallel);
+
+    serial.SetCell("B1"_pos, "-3");
+    parallel.SetCell("B1"_pos, "-3");
+    parallel.Recalculate(pool);
+    for (int row = 1; row < 200; ++row) {
+        ASSERT(dynamic_cast<Cell*>(parallel.GetCell({row, 2}))->IsValidCache());
+    }
+    check_equal(serial, parallel);
+}
+
+void TestRangeReferences() {
+    auto sheet = CreateSheet();
+    sheet->SetCell("E5"_pos, "=B3:A1");
+    ASSERT_EQUAL(sheet->GetCell("E5"_pos)->GetText(), "=A1:B3");
+    sheet->ClearCell("E5"_pos);
+
+    sheet->SetCell("D1"_pos, "=A1:A1*2");
+    sheet->SetCell("D2"_pos, "=A1:B3");
+    ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(), CellInterface::Value(0.0));
+    ASSERT_EQUAL(sheet->GetCell("D2"_pos)->GetValue(),
+                 CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+    // Ячейки диапазона не создаются и в список ссылок не попадают
+    ASSERT(sheet->GetCell("D1"_pos)->GetReferencedCells().empty());
+    ASSERT(sheet->GetCell("B2"_pos) == nullptr);
+
+    // Запись в ячейку диапазона сбрасывает только покрывающие её формулы
+    sheet->SetCell("A1"_pos, "5");
+    ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(), CellInterface::Value(10.0));
+    sheet->GetCell("D2"_pos)->GetValue();
+    sheet->SetCell("B2"_pos, "1");
+    ASSERT(dynamic_cast<Cell*>(sheet->GetCell("D1"_pos))->IsValidCache());
+    ASSERT(!dynamic_cast<Cell*>(sheet->GetCell("D2"_pos))->IsValidCache());
+    sheet->SetCell("C1"_pos, "1");
+    sheet->GetCell("D2"_pos)->GetValue();
+    ASSERT(dynamic_cast<Cell*>(sheet->GetCell("D2"_pos))->IsValidCache());
+
+    sheet->ClearCell("A1"_pos);
+    ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(), CellInterface::Value(0.0));
+
+    // Формула, вычисляемая через диапазон, стоит после ячеек диапазона,
+    // даже если они появились позже неё
+    sheet->SetCell("A1"_pos, "=C1+1");
+    ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(), CellInterface::Value(4.0));
+    sheet->SetCell("C1"_pos, "2");
+    ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(), CellInterface::Value(6.0));
+    auto* a1 = dynamic_cast<Cell*>(sheet->GetCell("A1"_pos));
+    auto* d1 = dynamic_cast<Cell*>(sheet->GetCell("D1"_pos));
+    ASSERT(a1->GetTopologicalOrder() < d1->GetTopologicalOrder());
+
+    // Циклы через диапазоны
+    try {
+        sheet->SetCell("B1"_pos, "=A1:C3");
+        ASSERT(false);
+    } catch (const CircularDependencyException&) {
+    }
+    try {
+        sheet->SetCell("C1"_pos, "=D1");
+        ASSERT(false);
+    } catch (const CircularDependencyException&) {
+    }
+    ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetText(), "2");
+    ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(), CellInterface::Value(6.0));
+}
+
+void TestAggregateFunctions() {
+    auto sheet = CreateSheet();
+    for (int row = 0; row < 10; ++row) {
+        sheet->SetCell({row, 0}, std::to_string(row + 1));
+    }
+    sheet->SetCell("B1"_pos, "text");
+    sheet->SetCell("B2"_pos, "'7");
+    sheet->SetCell("B3"_pos, "=A1*10");
+    auto value = [&](std::string_view cell) {
+        return sheet->GetCell(Position::FromString(cell))->GetValue();
+    };
+
+    sheet->SetCell("C1"_pos, "=SUM(A1:A10)");
+    sheet->SetCell("C2"_pos, "=AVERAGE(A1:A10)");
+    sheet->SetCell("C3"_pos, "=MIN(A3:A10,B3)");
+    sheet->SetCell("C4"_pos, "=MAX(A1:B10)");
+    sheet->SetCell("C5"_pos, "=COUNT(A1:B10,1,2)");
+    sheet->SetCell("C6"_pos, "=SUM(A1,A2:A3)*2+MAX(1,SUM(A1:A2))");
+    ASSERT_EQUAL(value("C1"), CellInterface::Value(55.0));
+    ASSERT_EQUAL(value("C2"), CellInterface::Value(5.5));
+    ASSERT_EQUAL(value("C3"), CellInterface::Value(3.0));
+    ASSERT_EQUAL(value("C4"), CellInterface::Value(10.0));
+    ASSERT_EQUAL(value("C5"), CellInterface::Value(14.0));
+    ASSERT_EQUAL(value("C6"), CellInterface::Value(15.0));
+    ASSERT_EQUAL(sheet->GetCell("C6"_pos)->GetText(), "=SUM(A1,A2:A3)*2+MAX(1,SUM(A1:A2))");
+    ASSERT_EQUAL(ParseFormula("SUM((1+2),A1:B2)")->GetExpression(), "SUM(1+2,A1:B2)");
+
+    // Изменение ячейки диапазона пересчитывает функцию
+    sheet->SetCell("A10"_pos, "100");
+    ASSERT_EQUAL(value("C1"), CellInterface::Value(145.0));
+    ASSERT_EQUAL(value("C4"), CellInterface::Value(100.0));
+
+    // Пустые диапазоны и ошибки
+    sheet->SetCell("D1"_pos, "=AVERAGE(E1:E5)");
+    sheet->SetCell("D2"_pos, "=MIN(E1:E5)+COUNT(E1:E5)");
+    ASSERT_EQUAL(value("D1"), CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+    ASSERT_EQUAL(value("D2"), CellInterface::Value(0.0));
+    sheet->SetCell("E3"_pos, "=1/0");
+    ASSERT_EQUAL(value("D2"), CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+    ASSERT_EQUAL(value("D1"), CellInterface::Value(FormulaError(FormulaError::Category::Arithmetic)));
+
+    try {
+        sheet->SetCell("D3"_pos, "=FOO(A1)");
+        ASSERT(false);
+    } catch (const FormulaException&) {
+    }
+    try {
+        sheet->SetCell("A5"_pos, "=SUM(C1:C2)");
+        ASSERT(false);
+    } catch (const CircularDependencyException&) {
+    }
+}
+
+void TestAggregateKernels() {
+    std::mt19937 generator(7);
+    std::uniform_real_distribution<double> distribution(-1e6, 1e6);
+    for (size_t size : {1u, 3u, 4u, 5u, 17u, 1000u, 1003u}) {
+        std::vector<double> values(size);
+        for (double& value : values) {
+            value = distribution(generator);
+        }
+        // Порядок сложения одинаков, поэтому суммы совпадают побитово
+        ASSERT_EQUAL(aggregate::Sum(values.data(), size), aggregate::SumScalar(values.data(), size));
+        ASSERT_EQUAL(aggregate::Min(values.data(), size), *std::min_element(values.begin(), values.end()));
+        ASSERT_EQUAL(aggregate::Max(values.data(), size), *std::max_element(values.begin(), values.end()));
+    }
+    ASSERT_EQUAL(aggregate::Sum(nullptr, 0), 0.0);
+}
+
+void TestIncrementalAggregates() {
+    // Итоги, обновляемые по разнице, сверяются с полным перечитыванием
+    // диапазона формулой без сохранённых итогов
+    const std::vector<std::string> formulas = {"SUM(A1:B20)", "AVERAGE(A1:B20)", "MIN(A1:B20)",
+                                               "MAX(A1:B20)", "COUNT(A1:B20)", "SUM(A1:A10,B5:B20)*2+MAX(A1:B20)"};
+    auto sheet = CreateSheet();
+    for (size_t i = 0; i < formulas.size(); ++i) {
+        sheet->SetCell({static_cast<int>(i), 3}, "=" + formulas[i]);
+    }
+
+    uint32_t seed = 13;
+    auto next_random = [&seed](int bound) {
+        seed = seed * 1103515245 + 12345;
+        return static_cast<int>((seed >> 8) % bound);
+    };
+    for (int step = 0; step < 2000; ++step) {
+        Position pos{next_random(20), next_random(3)};
+        switch (next_random(8)) {
+            case 0:
+                sheet->ClearCell(pos);
+                break;
+            case 1:
+                sheet->SetCell(pos, "text");
+                break;
+            case 2:
+                if (pos.col < 2) {
+                    // Формула внутри диапазона, ссылается на ячейку вне его
+                    sheet->SetCell(pos, "=C" + std::to_string(pos.row + 1) + "/2");
+                }
+                break;
+            default:
+                sheet->SetCell(pos, std::to_string(next_random(1000) - 500));
+                break;
+        }
+        if (step % 7 != 0) {
+            continue;
+        }
+        for (size_t i = 0; i < formulas.size(); ++i) {
+            auto expected = ParseFormula(formulas[i])->Evaluate(*sheet);
+            auto actual = sheet->GetCell({static_cast<int>(i), 3})->GetValue();
+            if (std::holds_alternative<double>(expected)) {
+                ASSERT(std::holds_alternative<double>(actual));
+                ASSERT(std::abs(std::get<double>(expected) - std::get<double>(actual)) < 1e-9);
+            } else {
+                ASSERT_EQUAL(actual, CellInterface::Value(std::get<FormulaError>(expected)));
+            }
+        }
+    }
+}
+
+void TestDescentParserMatchesAntlr() {
+    // Рукописный разборщик сверяется с ANTLR: одинаковые дерево, печать и
+    // ссылки либо ошибка у обоих
+    const std::vector<std::string> formulas = {
+        "1", "1.5", ".5", "1e3", "1.5E-2", ".5e+1", "1e-999", "1e999", "1.", ".", "1e", "1EA", "1.2.3",
+        "A1", "ZZZ1", "A0", "XFE1", "A16385", "a1", "A1+B2*C3", "(A1+B2)*C3", "1-2-3", "1/2/3",
+        "-1", "+-1", "--A1*2", "-(1+2)", "2*-3", "1 + \t2\n", "A1:B3", "B3:A1", "A1:A1",
+        "SUM(A1:B3)", "SUM(A1:B3,C1,2*3)", "MAX(A1:B3)-MIN(B3:A1)", "AVERAGE(A1, A1:A2, A1)",
+        "COUNT(A1:C10)+SUM(A1:C10)", "FOO(1)", "SUM()", "SUM(1,)", "SUM(1", "SUM 1", "A1:", ":A1",
+        "A1:B", "1+", "*1", "(1", "1)", "()", "1 2", "", "   ", "$A1", "1,2", "A1:B2:C3",
+        "((((1))))", "1+2*3-4/5", "A1*(B2-C3)/-(D4+E5)"};
+
+    auto parse = [](auto parser, const std::string& formula) {
+        try {
+            FormulaAST ast = parser(formula);
+            std::ostringstream out;
+            ast.PrintFormula(out);
+            out << '|';
+            ast.Print(out);
+            out << '|';
+            ast.PrintCells(out);
+            for (const CellRange& range : ast.GetRanges()) {
+                out << '|' << range.ToString();
+            }
+            return out.str();
+        } catch (...) {
+            // ANTLR сообщает о синтаксических ошибках своими исключениями,
+            // Formula всё равно превращает любую ошибку в FormulaException
+            return std::string("error");
+        }
+    };
+    for (const std::string& formula : formulas) {
+        auto descent = formula + " -> " + parse([](const std::string& text) { return ParseFormulaAST(text); }, formula);
+        auto antlr = formula + " -> " + parse([](const std::string& text) { return ParseFormulaASTWithAntlr(text); }, formula);
+        ASSERT_EQUAL(descent, antlr);
+    }
+}
+
+void TestFormulaInterning() {
+    // Протянутый столбец разделяет одно тело формулы, текст и ссылки каждой
+    // ячейки получаются сдвигом
+    Sheet sheet;
+    for (int row = 0; row < 10; ++row) {
+        const std::string n = std::to_string(row + 1);
+        sheet.SetCell({row, 0}, std::to_string(row));
+        const std::string next = std::to_string(row + 2);
+        sheet.SetCell({row, 1}, "=A" + n + " * 2 + SUM(A" + n + ":A" + next + ")");
+        sheet.SetCell({row, 2}, "=B" + n + "+1");
+    }
+    ASSERT_EQUAL(sheet.GetFormulaTable().Size(), 2u);
+    for (int row = 0; row < 10; ++row) {
+        const std::string n = std::to_string(row + 1);
+        const std::string next = std::to_string(row + 2);
+        ASSERT_EQUAL(sheet.GetCell({row, 1})->GetText(), "=A" + n + "*2+SUM(A" + n + ":A" + next + ")");
+        const std::vector<Position> expected_refs = {Position{row, 0}};
+        ASSERT_EQUAL(sheet.GetCell({row, 1})->GetReferencedCells(), expected_refs);
+        ASSERT_EQUAL(std::get<double>(sheet.GetCell({row, 2})->GetValue()), 3 * row + (row < 9 ? row + 1 : 0) + 1);
+    }
+    sheet.SetCell("A10"_pos, "100");
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("C10"_pos)->GetValue()), 301);
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("C9"_pos)->GetValue()), 24 + 100 + 1);
+
+    // Та же формула с другими сдвигами ссылок - другое тело; разные записи
+    // одной формулы делят тело, если совпадают лексемы
+    sheet.SetCell("D1"_pos, "=A1*2+SUM(A1:A1)");
+    ASSERT_EQUAL(sheet.GetFormulaTable().Size(), 3u);
+    sheet.SetCell("D2"_pos, "=C2 + 1");
+    ASSERT_EQUAL(sheet.GetFormulaTable().Size(), 3u);
+    ASSERT_EQUAL(sheet.GetCell("D2"_pos)->GetText(), "=C2+1");
+
+    // Ошибки разбора не оставляют следов в таблице
+    for (std::string formula : {"=A1+", "=A1+ZZZZ1", "=A1 1"}) {
+        try {
+            sheet.SetCell("E1"_pos, formula);
+            ASSERT(false);
+        } catch (const FormulaException&) {
+        }
+    }
+    ASSERT_EQUAL(sheet.GetFormulaTable().Size(), 3u);
+
+    // Тело удаляется вместе с последней ячейкой
+    for (int row = 0; row < 10; ++row) {
+        sheet.ClearCell({row, 2});
+    }
+    sheet.ClearCell("D2"_pos);
+    ASSERT_EQUAL(sheet.GetFormulaTable().Size(), 2u);
+    sheet.SetCell("D1"_pos, "text");
+    for (int row = 0; row < 10; ++row) {
+        sheet.SetCell({row, 1}, "");
+    }
+    ASSERT_EQUAL(sheet.GetFormulaTable().Size(), 0u);
+}
+
+void TestBatchEvaluation() {
+    // Пачка даёт те же значения и ошибки, что вычисление каждой копии
+    // формулы по отдельности
+    Sheet sheet;
+    const int rows = 150;
+    for (int row = 0; row < rows; ++row) {
+        const std::string n = std::to_string(row + 1);
+        switch (row % 7) {
+            case 0:
+                sheet.SetCell({row, 0}, "0");
+                break;
+            case 1:
+                sheet.SetCell({row, 0}, "text");
+                break;
+            case 2:
+                sheet.SetCell({row, 0}, "=1/0");
+                break;
+            case 3:
+                break;
+            case 4:
+                sheet.SetCell({row, 0}, "1e308");
+                break;
+            default:
+                sheet.SetCell({row, 0}, std::to_string(row * 3 - 200));
+                break;
+        }
+        sheet.SetCell({row, 1}, std::to_string(row % 5));
+    }
+    const std::vector<std::string> formulas = {"A1*B1+C1", "A1/B1", "-A1-(B1*2)/7", "B1/A1+1", "A1*10+B1",
+                                               "(B1-2)*(B1+2)/(B1-1)", "1/0+A1", "B1+A1+ZZ1",
+                                               "A1*SUM(2,3)", "A1*MAX(1,3)-2"};
+    for (const std::string& text : formulas) {
+        auto formula = ParseFormula(text);
+        ASSERT(formula->IsBatchable());
+        std::vector<FormulaInterface::Value> batch(FormulaInterface::BATCH_SIZE);
+        for (int first = 0; first < rows; first += FormulaInterface::BATCH_SIZE) {
+            const size_t count = std::min<size_t>(FormulaInterface::BATCH_SIZE, rows - first);
+            formula->EvaluateBatch(sheet, {first, 0}, count, batch.data());
+            for (size_t i = 0; i < count; ++i) {
+                auto expected = formula->Evaluate(sheet, nullptr, {first + static_cast<int>(i), 0});
+                ASSERT_EQUAL(std::holds_alternative<double>(batch[i]), std::holds_alternative<double>(expected));
+                if (std::holds_alternative<double>(expected)) {
+                    ASSERT_EQUAL(std::get<double>(batch[i]), std::get<double>(expected));
+                } else {
+                    ASSERT_EQUAL(std::get<FormulaError>(batch[i]), std::get<FormulaError>(expected));
+                }
+            }
+        }
+    }
+    ASSERT(!ParseFormula("SUM(A1:A3)+1")->IsBatchable());
+
+    // Пересчёт листа собирает протянутые столбцы в пачки
+    auto fill = [&](Sheet& target) {
+        for (int row = 0; row < rows; ++row) {
+            const std::string n = std::to_string(row + 1);
+            target.SetCell({row, 0}, std::to_string(row % 11 - 3));
+            target.SetCell({row, 1}, row % 13 == 0 ? "x" : std::to_string(row % 4));
+            target.SetCell({row, 2}, "=A" + n + "/B" + n);
+            target.SetCell({row, 3}, "=C" + n + "*2-A" + n);
+            target.SetCell({row, 4}, row % 2 == 0 ? "=D" + n + "+1" : "=SUM(A" + n + ":B" + n + ")");
+        }
+    };
+    Sheet serial;
+    Sheet batched;
+    fill(serial);
+    fill(batched);
+    ThreadPool pool(2);
+    batched.Recalculate(pool);
+    std::ostringstream expected_values, actual_values;
+    serial.PrintValues(expected_values);
+    batched.PrintValues(actual_values);
+    ASSERT_EQUAL(expected_values.str(), actual_values.str());
+}
+
+void TestConstantFolding() {
+    // Выражения без ссылок сворачиваются в одну инструкцию
+    for (std::string formula : {"(2+3)*4/-(-2)", "SUM(1,2,3)*2", "1/0", "MAX(1,1/0)+2", "-(-(-1))"}) {
+        ASSERT_EQUAL(formula + " -> " + std::to_string(ParseFormulaAST(formula).Compile().GetCode().size()),
+                     formula + " -> 1");
+    }
+    ASSERT_EQUAL(std::get<double>(ParseFormula("(2+3)*4/-(-2)")->Evaluate(Sheet{})), 10.0);
+    ASSERT_EQUAL(std::get<double>(ParseFormula("AVERAGE(1,2,3)*2")->Evaluate(Sheet{})), 4.0);
+    ASSERT_EQUAL(std::get<FormulaError>(ParseFormula("1e308*10")->Evaluate(Sheet{})),
+                 FormulaError(FormulaError::Category::Arithmetic));
+
+    // Свёрнутая часть не меняет ни текст формулы, ни порядок ошибок
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "text");
+    sheet.SetCell("B1"_pos, "=1/0+A1");
+    sheet.SetCell("C1"_pos, "=A1+1/0");
+    sheet.SetCell("D1"_pos, "=A1*(2+3)/10");
+    sheet.SetCell("E1"_pos, "=--A1");
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetText(), "=1/0+A1");
+    ASSERT_EQUAL(std::get<FormulaError>(sheet.GetCell("B1"_pos)->GetValue()),
+                 FormulaError(FormulaError::Category::Arithmetic));
+    ASSERT_EQUAL(std::get<FormulaError>(sheet.GetCell("C1"_pos)->GetValue()),
+                 FormulaError(FormulaError::Category::Value));
+    ASSERT_EQUAL(sheet.GetCell("D1"_pos)->GetText(), "=A1*(2+3)/10");
+    ASSERT_EQUAL(sheet.GetCell("E1"_pos)->GetText(), "=--A1");
+    sheet.SetCell("A1"_pos, "4");
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("D1"_pos)->GetValue()), 2.0);
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("E1"_pos)->GetValue()), 4.0);
+
+    // Вызов от констант больше не мешает вычислению пачкой
+    ASSERT(ParseFormula("A1*SUM(1,2)")->IsBatchable());
+    ASSERT(!ParseFormula("SUM(A1,2)")->IsBatchable());
+}
+
+void TestNumericText() {
+    // Текст ячейки разбирается как число при задании, формулы читают готовое
+    // число по тем же правилам, что и раньше
+    Sheet sheet;
+    auto value_of = [&sheet](const std::string& text) {
+        sheet.SetCell("A1"_pos, text);
+        sheet.SetCell("B1"_pos, "=A1*2");
+        sheet.SetCell("C1"_pos, "=SUM(A1:A2)");
+        std::ostringstream out;
+        out << text << " -> " << sheet.GetCell("B1"_pos)->GetValue() << ", " << sheet.GetCell("C1"_pos)->GetValue();
+        return out.str();
+    };
+    ASSERT_EQUAL(value_of("12.5"), "12.5 -> 25, 12.5");
+    ASSERT_EQUAL(value_of(" -3"), " -3 -> -6, -3");
+    ASSERT_EQUAL(value_of("+1e2"), "+1e2 -> 200, 100");
+    ASSERT_EQUAL(value_of("0x10"), "0x10 -> 32, 16");
+    ASSERT_EQUAL(value_of("'7"), "'7 -> 14, 7");
+    ASSERT_EQUAL(value_of("'"), "' -> 0, 0");
+    ASSERT_EQUAL(value_of("1,5"), "1,5 -> #VALUE!, 0");
+    ASSERT_EQUAL(value_of("3 "), "3  -> #VALUE!, 0");
+    ASSERT_EQUAL(value_of("+-3"), "+-3 -> #VALUE!, 0");
+    ASSERT_EQUAL(value_of("1e999"), "1e999 -> #VALUE!, 0");
+    ASSERT_EQUAL(value_of("inf"), "inf -> #ARITHM!, #ARITHM!");
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetText(), "inf");
+    ASSERT_EQUAL(std::get<std::string>(sheet.GetCell("A1"_pos)->GetValue()), "inf");
+
+    double number = 0.0;
+    FormulaError error(FormulaError::Category::Ref);
+    sheet.SetCell("A1"_pos, "'42");
+    ASSERT(sheet.GetCell("A1"_pos)->GetNumber(number, error) == CellNumberKind::Number);
+    ASSERT_EQUAL(number, 42.0);
+    sheet.SetCell("A1"_pos, "abc");
+    ASSERT(sheet.GetCell("A1"_pos)->GetNumber(number, error) == CellNumberKind::Text);
+    sheet.SetCell("A1"_pos, "=1/0");
+    ASSERT(sheet.GetCell("A1"_pos)->GetNumber(number, error) == CellNumberKind::Error);
+    ASSERT_EQUAL(error, FormulaError(FormulaError::Category::Arithmetic));
+    sheet.SetCell("A1"_pos, "");
+    ASSERT(sheet.GetCell("A1"_pos)->GetNumber(number, error) == CellNumberKind::Empty);
+}
+
+// Поток, который только считает выведенные символы
+class CountingBuffer : public std::streambuf {
+public:
+    size_t GetCount() const {
+        return count_;
+    }
+
+protected:
+    int_type overflow(int_type c) override {
+        ++count_;
+        return c;
+    }
+    std::streamsize xsputn(const char*, std::streamsize size) override {
+        count_ += size;
+        return size;
+    }
+
+private:
+    size_t count_ = 0;
+};
+
+void TestAllocationFreeReads() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "12");
+    sheet.SetCell("A2"_pos, "'text that is too long for the small string buffer");
+    sheet.SetCell("B1"_pos, "=A1*2+A2");
+    sheet.SetCell("B2"_pos, "=A1/4+SUM(A1:A3)");
+    sheet.SetCell("C3"_pos, "=B2-(A1+1)");
+    const auto formula = ParseFormula("B2*A1-A3");
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("C3"_pos)->GetValue()), 2.0);
+    ASSERT_EQUAL(std::get<FormulaError>(sheet.GetCell("B1"_pos)->GetValue()),
+                 FormulaError(FormulaError::Category::Value));
+    CountingBuffer buffer;
+    std::ostream output(&buffer);
+
+    // Число выделений памяти за операцию. Проверки стоят вне операций: сами
+    // макросы проверок выделяют память под подсказку.
+    auto count = [](auto operation) {
+        AllocationCounter counter;
+        operation();
+        return counter.GetCount();
+    };
+    CellInterface::ValueView text, number, empty;
+    ASSERT_EQUAL(count([&] {
+                     text = sheet.GetValueView("A2"_pos);
+                     number = sheet.GetValueView("B2"_pos);
+                     empty = sheet.GetValueView("Z9"_pos);
+                 }),
+                 0u);
+    ASSERT_EQUAL(std::get<std::string_view>(text), "text that is too long for the small string buffer");
+    ASSERT_EQUAL(std::get<double>(number), 15.0);
+    ASSERT_EQUAL(std::get<std::string_view>(empty), "");
+
+    std::vector<CellNumberKind> kinds;
+    kinds.reserve(3);
+    ASSERT_EQUAL(count([&] {
+                     double value = 0.0;
+                     FormulaError error(FormulaError::Category::Ref);
+                     for (Position pos : {"A1"_pos, "A2"_pos, "B1"_pos}) {
+                         kinds.push_back(sheet.GetNumber(pos, value, error));
+                     }
+                 }),
+                 0u);
+    ASSERT(kinds == (std::vector<CellNumberKind>{CellNumberKind::Number, CellNumberKind::Text, CellNumberKind::Error}));
+
+    size_t rows = 0;
+    ASSERT_EQUAL(count([&] {
+                     for (Position pos : sheet.GetCell("C3"_pos)->GetReferencedCellsView()) {
+                         rows += pos.row + 1;
+                     }
+                 }),
+                 0u);
+    ASSERT_EQUAL(rows, 3u);
+
+    FormulaInterface::Value result = 0.0;
+    ASSERT_EQUAL(count([&] {
+                     result = formula->Evaluate(sheet, nullptr, {});
+                 }),
+                 0u);
+    ASSERT_EQUAL(std::get<double>(result), 180.0);
+
+    ASSERT_EQUAL(count([&] {
+                     sheet.GetCell("B2"_pos)->PrintText(output);
+                     sheet.PrintValues(output);
+                 }),
+                 0u);
+    ASSERT(buffer.GetCount() > 0);
+
+    // Для сравнения: копирующие методы выделяют память
+    ASSERT(count([&] {
+               sheet.GetCell("A2"_pos)->GetValue();
+           }) > 0);
+    ASSERT(count([&] {
+               sheet.GetCell("C3"_pos)->GetReferencedCells();
+           }) > 0);
+    ASSERT_EQUAL(sheet.GetCell("C3"_pos)->GetReferencedCells(), (std::vector<Position>{"A1"_pos, "B2"_pos}));
+}
+
+void TestCellContentKinds() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "4");
+    sheet.SetCell("A2"_pos, "=A1*2");
+    sheet.SetCell("A3"_pos, "=SUM(A1:A2)");
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("A3"_pos)->GetValue()), 12.0);
+
+    // Ячейка проходит через все виды содержимого, зависимые пересчитываются
+    const Cell* a1 = sheet.GetCell("A1"_pos);
+    sheet.SetCell("A1"_pos, "=1+2");
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("A3"_pos)->GetValue()), 9.0);
+    sheet.SetCell("A1"_pos, "'5");
+    ASSERT_EQUAL(std::get<std::string>(a1->GetValue()), "5");
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("A3"_pos)->GetValue()), 15.0);
+    sheet.SetCell("A1"_pos, "");
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("A3"_pos)->GetValue()), 0.0);
+    sheet.SetCell("A1"_pos, "2");
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("A3"_pos)->GetValue()), 6.0);
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos), a1);
+
+    // Отвергнутая формула оставляет прежнее содержимое вместе с итогами
+    // диапазонов
+    try {
+        sheet.SetCell("A3"_pos, "=SUM(A1:A3)");
+        ASSERT(false);
+    } catch (const CircularDependencyException&) {
+    }
+    try {
+        sheet.SetCell("A1"_pos, "=A3");
+        ASSERT(false);
+    } catch (const CircularDependencyException&) {
+    }
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetText(), "2");
+    ASSERT_EQUAL(sheet.GetCell("A3"_pos)->GetText(), "=SUM(A1:A2)");
+    sheet.SetCell("A1"_pos, "3");
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("A3"_pos)->GetValue()), 9.0);
+
+    // Новая ячейка с формулой на себя не создаётся, а её место в пуле
+    // достаётся следующей
+    try {
+        sheet.SetCell("B1"_pos, "=B1+1");
+        ASSERT(false);
+    } catch (const CircularDependencyException&) {
+    }
+    ASSERT(sheet.GetCell("B1"_pos) == nullptr);
+    sheet.SetCell("B2"_pos, "=A3+1");
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("B2"_pos)->GetValue()), 10.0);
+
+    // Слот удалённой ячейки используется повторно
+    const Cell* b2 = sheet.GetCell("B2"_pos);
+    sheet.ClearCell("B2"_pos);
+    sheet.SetCell("C7"_pos, "text");
+    ASSERT_EQUAL(sheet.GetCell("C7"_pos), b2);
+    ASSERT_EQUAL(sheet.GetCell("C7"_pos)->GetText(), "text");
+}
+
+void TestReferencesToAbsentCells() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "=ZZ9999+1");
+    ASSERT(sheet.GetCell("ZZ9999"_pos) == nullptr);
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{1, 1}));
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("A1"_pos)->GetValue()), 1.0);
+
+    // Запись в позицию ссылки создаёт ячейку и сбрасывает значения формул
+    sheet.SetCell("ZZ9999"_pos, "5");
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("A1"_pos)->GetValue()), 6.0);
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{9999, 702}));
+    sheet.ClearCell("ZZ9999"_pos);
+    ASSERT(sheet.GetCell("ZZ9999"_pos) == nullptr);
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("A1"_pos)->GetValue()), 1.0);
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{1, 1}));
+
+    // Ссылка остаётся и после повторной записи ячейки
+    sheet.SetCell("ZZ9999"_pos, "=2*3");
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("A1"_pos)->GetValue()), 7.0);
+    sheet.SetCell("ZZ9999"_pos, "");
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("A1"_pos)->GetValue()), 1.0);
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{1, 1}));
+    try {
+        sheet.SetCell("ZZ9999"_pos, "=A1");
+        ASSERT(false);
+    } catch (const CircularDependencyException&) {
+    }
+    sheet.SetCell("A1"_pos, "text");
+    sheet.ClearCell("ZZ9999"_pos);
+
+    // Вершины ссылок освобождаются вместе с формулами и не копятся
+    const size_t id_bound = sheet.GetDependencyGraph().GetIdBound();
+    for (int i = 0; i < 100; ++i) {
+        sheet.SetCell("B2"_pos, "=C" + std::to_string(i + 1) + "+D1");
+    }
+    sheet.ClearCell("B2"_pos);
+    ASSERT(sheet.GetDependencyGraph().GetIdBound() <= id_bound + 3);
+
+    // Печатная область считается по ячейкам с непустым текстом, сколько бы
+    // раз они ни менялись
+    sheet.SetCell("C3"_pos, "x");
+    sheet.SetCell("C3"_pos, "y");
+    sheet.SetCell("E5"_pos, "");
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{3, 3}));
+    sheet.ClearCell("C3"_pos);
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{1, 1}));
+    sheet.ClearCell("A1"_pos);
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{0, 0}));
+}
+
+void TestEarlyCutoff() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "1");
+    sheet.SetCell("B1"_pos, "=A1*2");
+    sheet.SetCell("B2"_pos, "=B1+1");
+    sheet.SetCell("B3"_pos, "=SUM(B1:B2)");
+    sheet.SetCell("C1"_pos, "=MIN(A1,0)");
+    sheet.SetCell("C2"_pos, "=C1+1");
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("B3"_pos)->GetValue()), 5.0);
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("C2"_pos)->GetValue()), 1.0);
+    auto is_valid = [&sheet](Position pos) {
+        return sheet.GetCell(pos)->IsValidCache();
+    };
+
+    // Запись того же числа другим текстом зависимые не трогает
+    sheet.SetCell("A1"_pos, "1.0");
+    sheet.SetCell("A1"_pos, "'1");
+    ASSERT(is_valid("B1"_pos) && is_valid("B3"_pos) && is_valid("C2"_pos));
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("B3"_pos)->GetValue()), 5.0);
+
+    // Новая формула с тем же значением: B2 и B3 не вычисляются
+    size_t saved = sheet.GetSavedEvaluations();
+    sheet.SetCell("B1"_pos, "=A1+A1");
+    ASSERT(!is_valid("B2"_pos) && !is_valid("B3"_pos));
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("B3"_pos)->GetValue()), 5.0);
+    ASSERT_EQUAL(sheet.GetSavedEvaluations(), saved + 2);
+
+    // Значение C1 не меняется, C2 не вычисляется; B1-B3 меняются
+    saved = sheet.GetSavedEvaluations();
+    sheet.SetCell("A1"_pos, "3");
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("C2"_pos)->GetValue()), 1.0);
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("B3"_pos)->GetValue()), 13.0);
+    ASSERT_EQUAL(sheet.GetSavedEvaluations(), saved + 1);
+
+    // То же при пересчёте на пуле потоков
+    ThreadPool pool(2);
+    saved = sheet.GetSavedEvaluations();
+    sheet.SetCell("A1"_pos, "5");
+    sheet.Recalculate(pool);
+    ASSERT(is_valid("B3"_pos) && is_valid("C2"_pos));
+    ASSERT_EQUAL(sheet.GetSavedEvaluations(), saved + 1);
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("C2"_pos)->GetValue()), 1.0);
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("B3"_pos)->GetValue()), 21.0);
+
+    // Ошибки сравниваются так же, как числа
+    sheet.SetCell("D1"_pos, "=1/0");
+    sheet.SetCell("D2"_pos, "=D1+1");
+    ASSERT_EQUAL(std::get<FormulaError>(sheet.GetCell("D2"_pos)->GetValue()),
+                 FormulaError(FormulaError::Category::Arithmetic));
+    saved = sheet.GetSavedEvaluations();
+    sheet.SetCell("D1"_pos, "=2/0");
+    sheet.GetCell("D2"_pos)->GetValue();
+    ASSERT_EQUAL(sheet.GetSavedEvaluations(), saved + 1);
+    sheet.SetCell("D1"_pos, "=-0");
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("D2"_pos)->GetValue()), 1.0);
+
+    // Ячейка, на которую ссылались до её появления, встаёт перед
+    // формулами, диапазоны которых её покрывают: иначе цикл через диапазоны
+    // не был бы найден
+    Sheet ranges;
+    ranges.SetCell("D6"_pos, "=SUM(B1:C4)");
+    ranges.SetCell("A2"_pos, "=A5*0");
+    ranges.SetCell("C1"_pos, "=SUM(A5:A6)");
+    try {
+        ranges.SetCell("A5"_pos, "=SUM(A1:C1)");
+        ASSERT(false);
+    } catch (const CircularDependencyException&) {
+    }
+}
+
+void TestLazyInvalidation() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "1");
+    sheet.SetCell("B1"_pos, "=A1+1");
+    sheet.SetCell("B2"_pos, "=SUM(A1:A3)");
+    sheet.SetCell("B3"_pos, "=B1+B2");
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("B3"_pos)->GetValue()), 3.0);
+    ASSERT_EQUAL(sheet.GetPendingChangeCount(), 0u);
+
+    // Повторные правки одной ячейки запоминаются один раз
+    for (int i = 0; i < 100; ++i) {
+        sheet.SetCell("A1"_pos, std::to_string(i));
+    }
+    sheet.SetCell("A2"_pos, "10");
+    sheet.SetCell("A3"_pos, "=A2*2");
+    ASSERT_EQUAL(sheet.GetPendingChangeCount(), 3u);
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("B3"_pos)->GetValue()), 100.0 + 129.0);
+    ASSERT_EQUAL(sheet.GetPendingChangeCount(), 0u);
+
+    // Изменённая ячейка удаляется до пометки зависимых
+    sheet.SetCell("A1"_pos, "5");
+    sheet.ClearCell("A1"_pos);
+    sheet.ClearCell("A3"_pos);
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("B1"_pos)->GetValue()), 1.0);
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("B3"_pos)->GetValue()), 11.0);
+
+    // Пересчёт тоже применяет отложенные изменения
+    ThreadPool pool(2);
+    sheet.SetCell("A2"_pos, "20");
+    sheet.SetCell("A1"_pos, "2");
+    sheet.Recalculate(pool);
+    ASSERT_EQUAL(sheet.GetPendingChangeCount(), 0u);
+    ASSERT(sheet.GetCell("B3"_pos)->IsValidCache());
+    ASSERT_EQUAL(std::get<double>(sheet.GetCell("B3"_pos)->GetValue()), 25.0);
+
+    // Неконстантный GetCell применяет изменения сам, а ячейка, полученная
+    // до изменения, применяет их при чтении значения
+    sheet.SetCell("A1"_pos, "3");
+    ASSERT_EQUAL(sheet.GetPendingChangeCount(), 1u);
+    const Cell* b1 = sheet.GetCell("B1"_pos);
+    ASSERT_EQUAL(sheet.GetPendingChangeCount(), 0u);
+    const Sheet& const_sheet = sheet;
+    const Cell* b3 = const_sheet.GetCell("B3"_pos);
+    sheet.SetCell("A2"_pos, "30");
+    ASSERT_EQUAL(const_sheet.GetPendingChangeCount(), 1u);
+    ASSERT_EQUAL(std::get<double>(b3->GetValue()), 4.0 + 33.0);
+    ASSERT_EQUAL(std::get<double>(b1->GetValue()), 4.0);
+    ASSERT_EQUAL(const_sheet.GetPendingChangeCount(), 0u);
+}
+
+void TestBulkLoad() {
+    std::vector<std::pair<Position, std::string>> cells = {
+        {"A1"_pos, "1"},
+        {"A2"_pos, "=A1+1"},
+        {"A3"_pos, "=A2+1"},
+        {"B1"_pos, "=SUM(A1:A3)+Z9"},
+        {"B2"_pos, "=B1*2"},
+        {"C3"_pos, "meow"},
+        {"A1"_pos, "10"},
+        {"D1"_pos, ""},
+        {"B3"_pos, "=B2/0"},
+    };
+    ThreadPool pool(2);
+    std::unique_ptr<Sheet> loaded = Sheet::BulkLoad(cells, pool);
+    Sheet expected;
+    for (const auto& [pos, text] : cells) {
+        expected.SetCell(pos, text);
+    }
+    auto print = [](const Sheet& sheet) {
+        std::ostringstream output;
+        sheet.PrintTexts(output);
+        sheet.PrintValues(output);
+        return output.str();
+    };
+    ASSERT_EQUAL(loaded->GetPrintableSize(), expected.GetPrintableSize());
+    ASSERT_EQUAL(print(*loaded), print(expected));
+    ASSERT(loaded->GetCell("D1"_pos) != nullptr && loaded->GetCell("Z9"_pos) == nullptr);
+    ASSERT_EQUAL(loaded->GetFormulaTable().Size(), 4u);
+
+    // Загруженный лист изменяется как обычный
+    ASSERT(loaded->GetCell("A3"_pos)->GetTopologicalOrder() > loaded->GetCell("A2"_pos)->GetTopologicalOrder());
+    loaded->SetCell("Z9"_pos, "=A3");
+    ASSERT_EQUAL(std::get<double>(loaded->GetCell("B2"_pos)->GetValue()), 2.0 * (10 + 11 + 12 + 12));
+    bool caught = false;
+    try {
+        loaded->SetCell("A1"_pos, "=B2");
+    } catch (const CircularDependencyException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+
+    // Ошибки называют ячейки; лист при ошибке не создаётся
+    auto load_error = [&pool](std::vector<std::pair<Position, std::string>> cells) -> std::string {
+        try {
+            Sheet::BulkLoad(std::move(cells), pool);
+        } catch (const CircularDependencyException& e) {
+            return e.what();
+        } catch (const FormulaException& e) {
+            return e.what();
+        }
+        return "";
+    };
+    ASSERT_EQUAL(load_error({{"A1"_pos, "=B1"}, {"B1"_pos, "=A1"}, {"C1"_pos, "=C1+1"},
+                             {"D2"_pos, "=SUM(D1:D3)"}, {"E1"_pos, "=A1"}}),
+                 "There is a circular dependency: A1 B1 C1 D2");
+    ASSERT_EQUAL(load_error({{"A1"_pos, "=1"}, {"B2"_pos, "=1+"}, {"C3"_pos, "=)"}}),
+                 "The formula in B2 is incorrect");
+    ASSERT_EQUAL(load_error({{"A1"_pos, "=B1"}, {"B1"_pos, "=A1"}, {"B1"_pos, "1"}}), "");
+    caught = false;
+    try {
+        Sheet::BulkLoad({{"A1"_pos, "1"}, {Position{-1, 0}, "2"}}, pool);
+    } catch (const InvalidPositionException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+}
+
+void TestTransactions() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "1");
+    sheet.SetCell("B1"_pos, "=A1+1");
+    sheet.SetCell("C1"_pos, "=SUM(A1:B1)");
+    auto value = [&sheet](Position pos) {
+        return std::get<double>(sheet.GetCell(pos)->GetValue());
+    };
+
+    // Правки видны только после Commit; A1 = B1 и B1 = A1+1 - цикл
+    // лишь до следующей правки
+    sheet.BeginTransaction();
+    sheet.SetCell("A1"_pos, "=B1");
+    sheet.SetCell("B1"_pos, "=A1+1");
+    sheet.SetCell("B1"_pos, "5");
+    sheet.SetCell("D4"_pos, "text");
+    ASSERT(sheet.IsInTransaction());
+    ASSERT_EQUAL(value("C1"_pos), 3.0);
+    ASSERT(sheet.GetCell("D4"_pos) == nullptr);
+    sheet.Commit();
+    ASSERT(!sheet.IsInTransaction());
+    ASSERT_EQUAL(value("A1"_pos), 5.0);
+    ASSERT_EQUAL(value("C1"_pos), 10.0);
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{4, 4}));
+
+    // Цикл в итоговом листе: ни одна правка не применяется
+    sheet.BeginTransaction();
+    sheet.SetCell("B1"_pos, "=E1");
+    sheet.SetCell("E1"_pos, "=C1*2");
+    sheet.ClearCell("D4"_pos);
+    bool caught = false;
+    try {
+        sheet.Commit();
+    } catch (const CircularDependencyException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+    ASSERT(!sheet.IsInTransaction());
+    ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetText(), "5");
+    ASSERT(sheet.GetCell("E1"_pos) == nullptr);
+    ASSERT_EQUAL(sheet.GetCell("D4"_pos)->GetText(), "text");
+    ASSERT_EQUAL(value("C1"_pos), 10.0);
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{4, 4}));
+
+    // Некорректная формула отвергается сразу; Rollback отбрасывает правки
+    sheet.BeginTransaction();
+    sheet.ClearCell("D4"_pos);
+    sheet.SetCell("A1"_pos, "7");
+    caught = false;
+    try {
+        sheet.SetCell("B1"_pos, "=1+");
+    } catch (const FormulaException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+    sheet.Rollback();
+    ASSERT(!sheet.IsInTransaction());
+    ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetText(), "=B1");
+    ASSERT_EQUAL(sheet.GetCell("D4"_pos)->GetText(), "text");
+
+    sheet.BeginTransaction();
+    sheet.ClearCell("D4"_pos);
+    sheet.SetCell("B1"_pos, "=A2");
+    sheet.Commit();
+    ASSERT(sheet.GetCell("D4"_pos) == nullptr);
+    ASSERT_EQUAL(value("C1"_pos), 0.0);
+    ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{1, 3}));
+
+    // Правки, переставляющие цепочку, и цикл через саму ячейку
+    sheet.BeginTransaction();
+    sheet.SetCell("A2"_pos, "=A3+1");
+    sheet.SetCell("A3"_pos, "=A4+1");
+    sheet.SetCell("A4"_pos, "2");
+    sheet.Commit();
+    ASSERT_EQUAL(value("C1"_pos), 8.0);
+    sheet.BeginTransaction();
+    sheet.SetCell("A4"_pos, "=SUM(A3:A5)");
+    caught = false;
+    try {
+        sheet.Commit();
+    } catch (const CircularDependencyException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+    ASSERT_EQUAL(sheet.GetCell("A4"_pos)->GetText(), "2");
+    ASSERT_EQUAL(value("C1"_pos), 8.0);
+
+    // Пустая ячейка вне правок, на которую ссылалась только переписанная
+    // формула, остаётся на месте после отвергнутого Commit
+    sheet.SetCell("F1"_pos, "=F2+1");
+    sheet.SetCell("F2"_pos, "");
+    ASSERT(sheet.GetCell("F2"_pos) != nullptr);
+    sheet.BeginTransaction();
+    sheet.SetCell("F1"_pos, "=F3");
+    sheet.SetCell("F3"_pos, "=F1");
+    caught = false;
+    try {
+        sheet.Commit();
+    } catch (const CircularDependencyException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+    ASSERT(sheet.GetCell("F2"_pos) != nullptr);
+    ASSERT(sheet.GetCell("F3"_pos) == nullptr);
+    ASSERT_EQUAL(sheet.GetCell("F1"_pos)->GetText(), "=F2+1");
+    ASSERT_EQUAL(value("F1"_pos), 1.0);
+    sheet.SetCell("F2"_pos, "4");
+    ASSERT_EQUAL(value("F1"_pos), 5.0);
+
+    // Commit и Rollback вне транзакции, вложенная транзакция
+    auto throws = [](auto func) {
+        try {
+            func();
+        } catch (const TransactionException&) {
+            return true;
+        }
+        return false;
+    };
+    ASSERT(throws([&sheet] { sheet.Commit(); }));
+    ASSERT(throws([&sheet] { sheet.Rollback(); }));
+    sheet.BeginTransaction();
+    sheet.SetCell("A4"_pos, "3");
+    ASSERT(throws([&sheet] { sheet.BeginTransaction(); }));
+    ASSERT(sheet.IsInTransaction());
+    sheet.Commit();
+    ASSERT_EQUAL(value("C1"_pos), 10.0);
+}
+
+void TestImportSheet() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "meow");
+    sheet.SetCell("C1"_pos, "=A2*2");
+    sheet.SetCell("A2"_pos, "'=1");
+    sheet.SetCell("B3"_pos, "=SUM(A2:C2)+B5");
+    sheet.SetCell("D4"_pos, "1.5");
+    sheet.SetCell("D2"_pos, "=");
+    auto print_texts = [](const Sheet& sheet) {
+        std::ostringstream output;
+        sheet.PrintTexts(output);
+        return output.str();
+    };
+    const std::string texts = print_texts(sheet);
+
+    ThreadPool pool(2);
+    std::unique_ptr<Sheet> imported = ImportSheet(texts, TextFormat::Tsv, pool);
+    ASSERT_EQUAL(print_texts(*imported), texts);
+    ASSERT_EQUAL(imported->GetPrintableSize(), sheet.GetPrintableSize());
+    ASSERT(imported->GetCell("B1"_pos) == nullptr);
+
+    // Большой текст делится на куски, номера строк сквозные
+    Sheet large;
+    for (int row = 0; row < 4000; ++row) {
+        for (int col = 0; col < 30; ++col) {
+            large.SetCell({row, col}, col % 3 == 0 ? "=" + Position{row, col + 1}.ToString() + "+1"
+                                                   : "text " + std::to_string(row * col));
+        }
+    }
+    const std::string large_texts = print_texts(large);
+    ASSERT(large_texts.size() > 1'200'000);
+    ASSERT_EQUAL(print_texts(*ImportSheet(large_texts, TextFormat::Tsv, pool)), large_texts);
+
+    // CSV: кавычки, запятые и переводы строк внутри поля, CRLF
+    imported = ImportSheet("a,\"b,\"\"c\"\"\",=A1\r\n,,\"x\ny\"\n\"\"\n3,=A4*2", TextFormat::Csv, pool);
+    ASSERT_EQUAL(imported->GetCell("B1"_pos)->GetText(), "b,\"c\"");
+    ASSERT_EQUAL(imported->GetCell("C1"_pos)->GetText(), "=A1");
+    ASSERT_EQUAL(imported->GetCell("C2"_pos)->GetText(), "x\ny");
+    ASSERT(imported->GetCell("A3"_pos) == nullptr);
+    ASSERT_EQUAL(std::get<double>(imported->GetCell("B4"_pos)->GetValue()), 6.0);
+    ASSERT_EQUAL(imported->GetPrintableSize(), (Size{4, 3}));
+
+    // Кавычка не в начале поля - обычный символ и при делении на куски
+    std::string stray_quote_csv = "5\" screen,x\n";
+    for (int row = 0; row < 10000; ++row) {
+        stray_quote_csv += std::string(110, 'a') + '\n';
+    }
+    stray_quote_csv += "\"p\nq\",z\n";
+    ASSERT(stray_quote_csv.size() > 1'100'000);
+    imported = ImportSheet(stray_quote_csv, TextFormat::Csv, pool);
+    ASSERT_EQUAL(imported->GetPrintableSize(), (Size{10002, 2}));
+    ASSERT_EQUAL(imported->GetCell("A1"_pos)->GetText(), "5\" screen");
+    ASSERT_EQUAL(imported->GetCell({10001, 0})->GetText(), "p\nq");
+    ASSERT_EQUAL(imported->GetCell({10001, 1})->GetText(), "z");
+
+    // Загрузка из файла
+    const std::string path = (std::filesystem::temp_directory_path() / "spreadsheet_import_test.tsv").string();
+    {
+        std::ofstream file(path);
+        file << texts;
+    }
+    ASSERT_EQUAL(print_texts(*ImportSheetFile(path, TextFormat::Tsv, pool)), texts);
+    std::filesystem::remove(path);
+    bool caught = false;
+    try {
+        ImportSheetFile(path, TextFormat::Tsv, pool);
+    } catch (const std::system_error&) {
+        caught = true;
+    }
+    ASSERT(caught);
+}
+
+void TestSnapshot() {
+    Sheet sheet;
+    sheet.SetCell("A1"_pos, "1");
+    sheet.SetCell("A2"_pos, "'=text");
+    sheet.SetCell("A3"_pos, "=");
+    for (int row = 0; row < 10; ++row) {
+        sheet.SetCell({row, 1}, "=A1+" + std::to_string(row) + "*A1");
+        sheet.SetCell({row, 2}, "=B" + std::to_string(row + 1) + "*2");
+    }
+    sheet.SetCell("D1"_pos, "=SUM(B1:C10)");
+    sheet.SetCell("D2"_pos, "=1/0");
+    sheet.SetCell("D3"_pos, "=A2");
+    // Ссылка на несуществующую ячейку
+    sheet.SetCell("D4"_pos, "=Z100+A1");
+    ThreadPool pool(2);
+    sheet.Recalculate(pool);
+    // Формула без вычисленного значения
+    sheet.SetCell("E1"_pos, "=D1+1");
+    auto print = [](const Sheet& sheet) {
+        std::ostringstream output;
+        sheet.PrintTexts(output);
+        output << '\n';
+        sheet.PrintValues(output);
+        return output.str();
+    };
+
+    std::ostringstream snapshot;
+    SaveSnapshot(sheet, snapshot);
+    std::unique_ptr<Sheet> loaded = LoadSnapshot(snapshot.str(), pool);
+    // Сохранённые значения действительны без пересчёта
+    ASSERT(loaded->GetCell("D1"_pos)->IsValidCache());
+    ASSERT(loaded->GetCell("C10"_pos)->IsValidCache());
+    ASSERT(!loaded->GetCell("E1"_pos)->IsValidCache());
+    ASSERT(std::get<FormulaError>(loaded->GetCell("D2"_pos)->GetValue())
+           == FormulaError(FormulaError::Category::Arithmetic));
+    ASSERT_EQUAL(print(*loaded), print(sheet));
+    ASSERT_EQUAL(loaded->GetPrintableSize(), sheet.GetPrintableSize());
+    // Зависимости восстановлены
+    loaded->SetCell("A1"_pos, "2");
+    sheet.SetCell("A1"_pos, "2");
+    loaded->SetCell("Z100"_pos, "3");
+    sheet.SetCell("Z100"_pos, "3");
+    ASSERT_EQUAL(print(*loaded), print(sheet));
+    bool caught = false;
+    try {
+        loaded->SetCell("A1"_pos, "=E1");
+    } catch (const CircularDependencyException&) {
+        caught = true;
+    }
+    ASSERT(caught);
+
+    // Загрузка из файла
+    const std::string path = (std::filesystem::temp_directory_path() / "spreadsheet_snapshot_test.bin").string();
+    SaveSnapshotFile(sheet, path);
+    ASSERT_EQUAL(print(*LoadSnapshotFile(path, pool)), print(sheet));
+    std::filesystem::remove(path);
+
+    // Повреждённые снимки не загружаются
+    std::ostringstream saved;
+    SaveSnapshot(sheet, saved);
+    const std::string data = saved.str();
+    auto is_rejected = [&pool](std::string_view data) {
+        try {
+            LoadSnapshot(data, pool);
+        } catch (const SnapshotException&) {
+            return true;
+        }
+        return false;
+    };
+    ASSERT(is_rejected(std::string_view(data).substr(0, 10)));
+    ASSERT(is_rejected(std::string_view(data).substr(0, data.size() - 1)));
+    std::string wrong_magic = data;
+    wrong_magic[0] = 'X';
+    ASSERT(is_rejected(wrong_magic));
+    // Ссылки формул не совпадают с их телами: все ведут на первую вершину.
+    // Последняя секция заголовка - номера вершин ссылок.
+    std::string wrong_references = data;
+    std::uint64_t references[2];
+    std::memcpy(references, data.data() + sizeof(std::uint64_t) * 3 + sizeof(references) * 8, sizeof(references));
+    std::fill_n(wrong_references.begin() + references[0], references[1], '\0');
+    ASSERT(is_rejected(wrong_references));
+}
+
 }  // namespace
 
 int main() {
@@ -358,17 +1648,42 @@ int main() {
     RUN_TEST(tr, TestSetCellPlainText);
     RUN_TEST(tr, TestClearCell);
     RUN_TEST(tr, TestFormulaArithmetic);
+    RUN_TEST(tr, TestFormulaDeepExpression);
     RUN_TEST(tr, TestFormulaReferences);
     RUN_TEST(tr, TestFormulaExpressionFormatting);
     RUN_TEST(tr, TestFormulaReferencedCells);
     RUN_TEST(tr, TestErrorValue);
     RUN_TEST(tr, TestErrorArithmetic);
+    RUN_TEST(tr, TestFormulaErrorsAsValues);
     RUN_TEST(tr, TestEmptyCellTreatedAsZero);
     RUN_TEST(tr, TestFormulaInvalidPosition);
     RUN_TEST(tr, TestPrint);
     RUN_TEST(tr, TestCellReferences);
     RUN_TEST(tr, TestFormulaIncorrect);
     RUN_TEST(tr, TestCellCircularReferences);
+    RUN_TEST(tr, TestDeepDependencyChain);
+    RUN_TEST(tr, TestReferencedEmptyCellUpdate);
+    RUN_TEST(tr, TestTopologicalOrderMaintained);
+    RUN_TEST(tr, TestDependencyGraphEdges);
+    RUN_TEST(tr, TestParallelRecalculation);
+    RUN_TEST(tr, TestRangeReferences);
+    RUN_TEST(tr, TestAggregateFunctions);
+    RUN_TEST(tr, TestAggregateKernels);
+    RUN_TEST(tr, TestIncrementalAggregates);
+    RUN_TEST(tr, TestDescentParserMatchesAntlr);
+    RUN_TEST(tr, TestFormulaInterning);
+    RUN_TEST(tr, TestBatchEvaluation);
+    RUN_TEST(tr, TestConstantFolding);
+    RUN_TEST(tr, TestNumericText);
+    RUN_TEST(tr, TestAllocationFreeReads);
+    RUN_TEST(tr, TestCellContentKinds);
+    RUN_TEST(tr, TestReferencesToAbsentCells);
+    RUN_TEST(tr, TestEarlyCutoff);
+    RUN_TEST(tr, TestLazyInvalidation);
+    RUN_TEST(tr, TestBulkLoad);
+    RUN_TEST(tr, TestTransactions);
+    RUN_TEST(tr, TestImportSheet);
+    RUN_TEST(tr, TestSnapshot);
 
     auto sheet = CreateSheet();
     sheet->SetCell("A1"_pos, "=A2 + A3 + A4");
@@ -0,0 +1,131 @@
+#include "mapped_file.h"
+
+#include <system_error>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <cerrno>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std::literals;
+
+#ifdef _WIN32
+
+namespace {
+
+// Ошибка последнего вызова Windows API
+[[noreturn]] void ThrowLastError(const std::string& message) {
+    throw std::system_error(static_cast<int>(::GetLastError()), std::system_category(), message);
+}
+
+// Закрывает описатель при выходе из конструктора: отображение держит файл
+// само, пока не снято
+class HandleCloser {
+public:
+    explicit HandleCloser(HANDLE handle)
+        : handle_(handle)
+    {
+    }
+    HandleCloser(const HandleCloser&) = delete;
+    HandleCloser& operator=(const HandleCloser&) = delete;
+    ~HandleCloser() {
+        ::CloseHandle(handle_);
+    }
+
+private:
+    HANDLE handle_;
+};
+
+}  // namespace
+
+MappedFile::MappedFile(const std::string& path) {
+    const HANDLE file = ::CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                      FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if(file == INVALID_HANDLE_VALUE)
+    {
+        ThrowLastError("Cannot open "s + path);
+    }
+    const HandleCloser file_closer(file);
+    LARGE_INTEGER size;
+    if(!::GetFileSizeEx(file, &size))
+    {
+        ThrowLastError("Cannot stat "s + path);
+    }
+    size_ = static_cast<size_t>(size.QuadPart);
+    // Пустой файл отобразить нельзя, и он не нужен
+    if(size_ != 0)
+    {
+        const HANDLE mapping = ::CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if(mapping == nullptr)
+        {
+            ThrowLastError("Cannot map "s + path);
+        }
+        const HandleCloser mapping_closer(mapping);
+        const void* data = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if(data == nullptr)
+        {
+            ThrowLastError("Cannot map "s + path);
+        }
+        data_ = static_cast<const char*>(data);
+    }
+}
+
+MappedFile::~MappedFile() {
+    if(data_ != nullptr)
+    {
+        ::UnmapViewOfFile(data_);
+    }
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& path) {
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        throw std::system_error(errno, std::generic_category(), "Cannot open "s + path);
+    }
+    struct stat info;
+    if(::fstat(fd, &info) != 0)
+    {
+        const int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), "Cannot stat "s + path);
+    }
+    size_ = static_cast<size_t>(info.st_size);
+    if(size_ != 0)
+    {
+        void* data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data == MAP_FAILED)
+        {
+            const int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "Cannot map "s + path);
+        }
+        data_ = static_cast<const char*>(data);
+        // Файл читается подряд
+        ::madvise(data, size_, MADV_SEQUENTIAL);
+    }
+    ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if(data_ != nullptr)
+    {
+        ::munmap(const_cast<char*>(data_), size_);
+    }
+}
+
+#endif
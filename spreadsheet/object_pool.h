@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Пул объектов одного типа. Объекты размещаются в слотах блоков по
+// CHUNK_SIZE штук, а не отдельными выделениями памяти: у каждого объекта
+// нет служебного заголовка кучи, и объекты, созданные подряд, лежат рядом.
+// Слоты удалённых объектов связываются в список свободных и используются
+// повторно. Память блоков возвращается только при разрушении пула, поэтому
+// все объекты пула должны быть удалены раньше него.
+template <typename T>
+class ObjectPool {
+public:
+    static constexpr size_t CHUNK_SIZE = 256;
+
+    ObjectPool() = default;
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+
+    // Создаёт объект в свободном слоте. Если конструктор бросает исключение,
+    // слот возвращается в пул.
+    template <typename... Args>
+    T* New(Args&&... args) {
+        Slot* slot = AllocateSlot();
+        try {
+            return new (slot->storage) T(std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            FreeSlot(slot);
+            throw;
+        }
+    }
+
+    // Разрушает объект, созданный New, и освобождает его слот
+    void Delete(T* object) {
+        if(object == nullptr)
+        {
+            return;
+        }
+        object->~T();
+        FreeSlot(reinterpret_cast<Slot*>(object));
+    }
+
+    // Память всех блоков пула в байтах
+    size_t GetMemoryUsage() const {
+        return chunks_.size() * CHUNK_SIZE * sizeof(Slot);
+    }
+
+private:
+    union Slot {
+        Slot* next;
+        alignas(T) std::byte storage[sizeof(T)];
+    };
+
+    std::vector<std::unique_ptr<Slot[]>> chunks_;
+    // Число занятых слотов последнего блока; слоты дальше ещё не выдавались
+    size_t chunk_used_ = CHUNK_SIZE;
+    Slot* free_list_ = nullptr;
+
+    Slot* AllocateSlot() {
+        if(free_list_ != nullptr)
+        {
+            Slot* slot = free_list_;
+            free_list_ = slot->next;
+            return slot;
+        }
+        if(chunk_used_ == CHUNK_SIZE)
+        {
+            chunks_.push_back(std::make_unique_for_overwrite<Slot[]>(CHUNK_SIZE));
+            chunk_used_ = 0;
+        }
+        return &chunks_.back()[chunk_used_++];
+    }
+
+    void FreeSlot(Slot* slot) {
+        slot->next = free_list_;
+        free_list_ = slot;
+    }
+};
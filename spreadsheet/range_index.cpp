@@ -0,0 +1,72 @@
+#include "range_index.h"
+
+#include <algorithm>
+
+template <typename Func>
+void RangeIndex::ForEachNode(const CellRange& range, Func func) {
+    // Каноническое разбиение отрезка строк [first, last] снизу вверх
+    size_t left = LEAF_COUNT + range.first.row;
+    size_t right = LEAF_COUNT + range.last.row + 1;
+    for(; left < right; left /= 2, right /= 2)
+    {
+        if(left % 2 == 1)
+        {
+            func(nodes_[left++]);
+        }
+        if(right % 2 == 1)
+        {
+            func(nodes_[--right]);
+        }
+    }
+}
+
+void RangeIndex::Add(const CellRange& range, Dependent dependent) {
+    if(nodes_.empty())
+    {
+        nodes_.resize(2 * LEAF_COUNT);
+    }
+    ForEachNode(range, [&](std::vector<Entry>& node) {
+        node.push_back({range, dependent});
+    });
+    ++size_;
+}
+
+void RangeIndex::Remove(const CellRange& range, Dependent dependent) {
+    if(nodes_.empty())
+    {
+        return;
+    }
+    bool removed = false;
+    ForEachNode(range, [&](std::vector<Entry>& node) {
+        auto it = std::find_if(node.begin(), node.end(), [&](const Entry& entry) {
+            return entry.dependent == dependent && entry.range == range;
+        });
+        if(it != node.end())
+        {
+            *it = node.back();
+            node.pop_back();
+            removed = true;
+        }
+    });
+    if(removed)
+    {
+        --size_;
+    }
+}
+
+bool RangeIndex::Covers(Position pos) const {
+    bool covered = false;
+    ForEachCovering(pos, [&covered](Dependent) {
+        covered = true;
+    });
+    return covered;
+}
+
+size_t RangeIndex::GetMemoryUsage() const {
+    size_t bytes = nodes_.capacity() * sizeof(std::vector<Entry>);
+    for(const std::vector<Entry>& node : nodes_)
+    {
+        bytes += node.capacity() * sizeof(Entry);
+    }
+    return bytes;
+}
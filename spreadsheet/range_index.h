@@ -0,0 +1,73 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Индекс диапазонных ссылок формул: отвечает, какие формулы ссылаются на
+// ячейку через диапазон, не раскрывая диапазоны в рёбра на каждую ячейку.
+// Это дерево отрезков по строкам листа: диапазон хранится в O(log R) узлах,
+// покрывающих его строки, а запрос для ячейки проходит путь от листа её
+// строки к корню и проверяет столбцы найденных диапазонов. Запрос стоит
+// O(log R + k), где k - число диапазонов, задевающих строку ячейки.
+class RangeIndex {
+public:
+    using Dependent = std::uint32_t;
+
+    void Add(const CellRange& range, Dependent dependent);
+    // Удаляет ранее добавленную пару. Пары, которой нет в индексе, не трогает.
+    void Remove(const CellRange& range, Dependent dependent);
+
+    // Вызывает func(dependent) для каждой пары, диапазон которой содержит
+    // pos. Формула с несколькими такими диапазонами передаётся несколько раз.
+    template <typename Func>
+    void ForEachCovering(Position pos, Func func) const {
+        ForEachCoveringRange(pos, [&func](Dependent dependent, const CellRange&) {
+            func(dependent);
+        });
+    }
+
+    // То же, но func(dependent, range) получает и сам диапазон
+    template <typename Func>
+    void ForEachCoveringRange(Position pos, Func func) const {
+        if(nodes_.empty())
+        {
+            return;
+        }
+        for(size_t node = LEAF_COUNT + pos.row; node > 0; node /= 2)
+        {
+            for(const Entry& entry : nodes_[node])
+            {
+                if(pos.col >= entry.range.first.col && pos.col <= entry.range.last.col)
+                {
+                    func(entry.dependent, entry.range);
+                }
+            }
+        }
+    }
+
+    bool Covers(Position pos) const;
+
+    size_t Size() const {
+        return size_;
+    }
+    size_t GetMemoryUsage() const;
+
+private:
+    static constexpr size_t LEAF_COUNT = Position::MAX_ROWS;
+
+    struct Entry {
+        CellRange range;
+        Dependent dependent;
+    };
+
+    // Узел i покрывает строки узлов 2i и 2i+1, листья начинаются с LEAF_COUNT.
+    // Массив узлов выделяется при первом добавлении диапазона.
+    std::vector<std::vector<Entry>> nodes_;
+    size_t size_ = 0;
+
+    template <typename Func>
+    void ForEachNode(const CellRange& range, Func func);
+};
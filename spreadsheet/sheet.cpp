@@ -4,33 +4,338 @@
 #include "common.h"
 
 #include <algorithm>
+#include <array>
+#include <cassert>
 #include <functional>
 #include <iostream>
 #include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
 
 using namespace std::literals;
 
-Sheet::~Sheet() {}
+namespace {
+// Задача пересчёта уровня: одна ячейка или пачка идущих подряд ячеек
+// протянутого столбца с общим телом формулы
+struct RecalculationTask {
+    // Общее тело пачки; nullptr у одиночной ячейки
+    const FormulaInterface* formula = nullptr;
+    // Сдвиг первой ячейки пачки относительно тела
+    PositionOffset offset;
+    // Ячейки задачи - [first, first + count) упорядоченного уровня
+    size_t first = 0;
+    size_t count = 0;
+};
 
-void Sheet::SetCell(Position pos, std::string text) {
-    if(pos.col >= Position::MAX_COLS || pos.col < 0 || pos.row >= Position::MAX_ROWS || pos.row < 0)
+// Упорядочивает ячейки уровня так, что ячейки с общим телом формулы идут по
+// столбцам сверху вниз, и нарезает их на пачки не длиннее BATCH_SIZE.
+// Формулы, которые нельзя вычислить пачкой, становятся одиночными задачами.
+std::vector<RecalculationTask> MakeRecalculationTasks(std::vector<Cell*>& level) {
+    struct Entry {
+        const FormulaInterface* formula;
+        PositionOffset offset;
+        Cell* cell;
+    };
+    std::vector<Entry> entries;
+    entries.reserve(level.size());
+    for(Cell* cell : level)
+    {
+        Entry entry{nullptr, {}, cell};
+        const FormulaInterface* formula = cell->GetSharedFormula(entry.offset);
+        if(formula != nullptr && formula->IsBatchable())
+        {
+            entry.formula = formula;
+        }
+        entries.push_back(entry);
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry& lhs, const Entry& rhs) {
+        if(lhs.formula != rhs.formula)
+        {
+            return std::less<const FormulaInterface*>{}(lhs.formula, rhs.formula);
+        }
+        return std::tie(lhs.offset.cols, lhs.offset.rows) < std::tie(rhs.offset.cols, rhs.offset.rows);
+    });
+
+    std::vector<RecalculationTask> tasks;
+    for(size_t i = 0; i < entries.size(); ++i)
+    {
+        const Entry& entry = entries[i];
+        level[i] = entry.cell;
+        if(entry.formula != nullptr && !tasks.empty())
+        {
+            RecalculationTask& last = tasks.back();
+            if(last.formula == entry.formula && last.offset.cols == entry.offset.cols
+               && last.offset.rows + static_cast<int>(last.count) == entry.offset.rows
+               && last.count < FormulaInterface::BATCH_SIZE)
+            {
+                ++last.count;
+                continue;
+            }
+        }
+        tasks.push_back({entry.formula, entry.offset, i, 1});
+    }
+    return tasks;
+}
+void CheckPosition(Position pos) {
+    if(!pos.IsValid())
     {
         throw InvalidPositionException("Invalid position");
     }
-    if(GetCell(pos) == nullptr)
+}
+}  // namespace
+
+Sheet::Sheet() {
+    // Граф хранит диапазоны формул целиком, а ячейки внутри них берёт у листа
+    graph_.SetRangeCellsCollector([this](const CellRange& range, std::vector<CellId>& ids) {
+        for(int row = range.first.row; row <= range.last.row; ++row)
+        {
+            sheet_.ForEachInRow(row, range.first.col, range.last.col + 1, [&ids](int, const Cell* cell) {
+                ids.push_back(cell->GetId());
+            });
+        }
+    });
+}
+
+Sheet::~Sheet() {
+    destroying_ = true;
+}
+
+void Sheet::CellDeleter::operator()(Cell* cell) const {
+    cell->GetSheet().cell_pool_.Delete(cell);
+}
+
+Cell* Sheet::CreateCell(Position pos, std::string&& text) {
+    return sheet_.Set(pos, TiledStorage<Cell, CellDeleter>::Pointer(cell_pool_.New(*this, pos, std::move(text))));
+}
+
+void Sheet::SetCell(Position pos, std::string text) {
+    CheckPosition(pos);
+    if(transaction_)
+    {
+        Edit edit;
+        if(Cell::IsTextFormula(text))
+        {
+            edit.formula = formulas_.Intern(std::string_view(text).substr(1), pos);
+        }
+        edit.text = std::move(text);
+        (*transaction_)[pos] = std::move(edit);
+        return;
+    }
+    Cell* cell = sheet_.Get(pos);
+    const bool has_text = !text.empty();
+    bool had_text = false;
+    if(cell == nullptr)
     {
-        sheet_[pos] = std::make_unique<Cell>(*this, pos, std::move(text));
+        CreateCell(pos, std::move(text));
     }
-    else if(sheet_[pos]->GetText() == text)
+    else if(cell->GetText() == text)
     {
         return;
     }
     else
     {
-        dynamic_cast<Cell*>(sheet_[pos].get())->Set(std::move(text));
+        had_text = !cell->IsEmpty();
+        cell->Set(std::move(text));
+    }
+    if(has_text != had_text)
+    {
+        UpdateSize(pos, has_text);
+    }
+}
+
+std::unique_ptr<Sheet> Sheet::BulkLoad(std::vector<std::pair<Position, std::string>> cells, ThreadPool& pool) {
+    for(const auto& [pos, text] : cells)
+    {
+        CheckPosition(pos);
+    }
+    // Из повторяющихся позиций остаётся последняя запись. Ячейки по порядку
+    // позиций к тому же ложатся в хранилище подряд. Выгрузка листа обычно
+    // уже идёт по строкам без повторов, и тогда сортировать нечего.
+    auto by_position = [](const auto& lhs, const auto& rhs) {
+        return std::tie(lhs.first.row, lhs.first.col) < std::tie(rhs.first.row, rhs.first.col);
+    };
+    auto not_before = [&by_position](const auto& lhs, const auto& rhs) {
+        return !by_position(lhs, rhs);
+    };
+    if(std::adjacent_find(cells.begin(), cells.end(), not_before) != cells.end())
+    {
+        std::stable_sort(cells.begin(), cells.end(), by_position);
+        auto last = std::unique(cells.rbegin(), cells.rend(), [](const auto& lhs, const auto& rhs) {
+            return lhs.first == rhs.first;
+        });
+        cells.erase(cells.begin(), last.base());
+    }
+
+    std::vector<std::pair<std::string_view, Position>> formulas;
+    for(const auto& [pos, text] : cells)
+    {
+        if(Cell::IsTextFormula(text))
+        {
+            formulas.emplace_back(std::string_view(text).substr(1), pos);
+        }
+    }
+    Loader loader(cells.size());
+    std::vector<FormulaTable::Entry> entries = loader.GetFormulaTable().InternAll(formulas, pool);
+    size_t next_entry = 0;
+    for(auto& [pos, text] : cells)
+    {
+        FormulaTable::Entry entry;
+        if(Cell::IsTextFormula(text))
+        {
+            entry = std::move(entries[next_entry++]);
+        }
+        loader.AddCell(pos, std::move(text), std::move(entry));
+    }
+    return loader.Finish();
+}
+
+Sheet::Loader::Loader(size_t cells)
+    : sheet_(std::make_unique<Sheet>())
+    , row_counts_(Position::MAX_ROWS)
+    , col_counts_(Position::MAX_COLS)
+{
+    sheet_->graph_.Reserve(cells);
+}
+
+Cell* Sheet::Loader::AddCell(Position pos, std::string&& text, FormulaTable::Entry&& formula) {
+    assert(sheet_->sheet_.Get(pos) == nullptr);
+    if(!text.empty() || formula.formula != nullptr)
+    {
+        ++row_counts_[pos.row];
+        ++col_counts_[pos.col];
+    }
+    Cell* cell = sheet_->sheet_.Set(pos, TiledStorage<Cell, CellDeleter>::Pointer(
+        sheet_->cell_pool_.New(*sheet_, pos, std::move(text), std::move(formula))));
+    if(cell->IsFormulaCell())
+    {
+        formula_cells_.push_back(cell);
+    }
+    return cell;
+}
+
+void Sheet::Loader::FillPrintableSize() {
+    auto fill_counts = [](const std::vector<int>& counts, std::map<int, int>& elements) {
+        for(int i = 0; i < static_cast<int>(counts.size()); ++i)
+        {
+            if(counts[i] != 0)
+            {
+                elements.emplace_hint(elements.end(), i, counts[i]);
+            }
+        }
+    };
+    fill_counts(row_counts_, sheet_->rows_number_of_elements);
+    fill_counts(col_counts_, sheet_->cols_number_of_elements);
+}
+
+bool Sheet::Loader::IsOrdered() const {
+    const DependencyGraph& graph = sheet_->graph_;
+    for(const Cell* cell : formula_cells_)
+    {
+        const int order = graph.GetOrder(cell->GetId());
+        bool ordered = true;
+        graph.ForEachReference(cell->GetId(), [&graph, order, &ordered](CellId reference) {
+            ordered &= graph.GetOrder(reference) < order;
+        });
+        if(!ordered)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::unique_ptr<Sheet> Sheet::Loader::FinishOrdered() {
+    FillPrintableSize();
+    return std::move(sheet_);
+}
+
+std::unique_ptr<Sheet> Sheet::Loader::Finish() {
+    FillPrintableSize();
+    // Ссылки добавляются, когда все ячейки уже на местах: вершины без ячеек
+    // заводятся только для позиций, где ячеек действительно нет
+    for(Cell* cell : formula_cells_)
+    {
+        cell->AddLoadedReferences();
+    }
+
+    const std::vector<CellId> cycle_cells = sheet_->graph_.RebuildOrder();
+    if(!cycle_cells.empty())
+    {
+        std::vector<Position> positions;
+        for(CellId id : cycle_cells)
+        {
+            positions.push_back(sheet_->graph_.GetPosition(id));
+        }
+        std::sort(positions.begin(), positions.end());
+        std::string message = "There is a circular dependency:"s;
+        for(Position pos : positions)
+        {
+            message += ' ' + pos.ToString();
+        }
+        throw CircularDependencyException(message);
+    }
+    return std::move(sheet_);
+}
+
+CellId Sheet::GetReferenceNode(Position pos) {
+    if(const Cell* cell = sheet_.Get(pos))
+    {
+        return cell->GetId();
+    }
+    auto [it, inserted] = reference_nodes_.try_emplace(pos);
+    if(inserted)
+    {
+        it->second = graph_.AddNode(nullptr, true, pos);
+    }
+    return it->second;
+}
+
+void Sheet::ReleaseReferenceNode(CellId id) {
+    if(!graph_.GetDependents(id).Empty())
+    {
+        return;
+    }
+    const Cell* cell = graph_.GetCell(id);
+    if(cell == nullptr)
+    {
+        reference_nodes_.erase(graph_.GetPosition(id));
+        graph_.RemoveNode(id);
+    }
+    else if(cell->IsEmpty())
+    {
+        EraseCell(graph_.GetPosition(id));
+    }
+}
+
+CellId Sheet::AttachCell(Cell* cell, Position pos, bool place_first) {
+    auto it = reference_nodes_.find(pos);
+    if(it == reference_nodes_.end())
+    {
+        return graph_.AddNode(cell, place_first, pos);
     }
-    UpdateSize(pos, true);
+    const CellId id = it->second;
+    reference_nodes_.erase(it);
+    graph_.SetCell(id, cell);
+    return id;
+}
 
+void Sheet::DetachCell(CellId id) {
+    // Вершина может уйти из графа: её отложенное изменение применяется сейчас
+    if(!destroying_ && id < pending_marks_.size() && pending_marks_[id].generation == pending_generation_)
+    {
+        ApplyPendingChangesImpl();
+    }
+    if(destroying_ || graph_.GetDependents(id).Empty())
+    {
+        graph_.RemoveNode(id);
+        return;
+    }
+    graph_.ClearReferences(id);
+    graph_.SetCell(id, nullptr);
+    reference_nodes_.emplace(graph_.GetPosition(id), id);
 }
 
 void Sheet::UpdateSize(Position pos, bool IsCellAdded) {
@@ -73,54 +378,195 @@ void Sheet::UpdateSize(Position pos, bool IsCellAdded) {
     }
 }
 
-const CellInterface* Sheet::GetCell(Position pos) const {
-    if(pos.col >= Position::MAX_COLS || pos.col < 0 || pos.row >= Position::MAX_ROWS || pos.row < 0)
+const Cell* Sheet::GetCell(Position pos) const {
+    CheckPosition(pos);
+    return sheet_.Get(pos);
+}
+
+CellInterface::ValueView Sheet::GetValueView(Position pos) const {
+    const Cell* cell = GetCell(pos);
+    if(cell == nullptr)
     {
-        throw InvalidPositionException("Invalid position");
+        return std::string_view{};
     }
-    auto cell_it = sheet_.find(pos);
-    if(cell_it == sheet_.end())
+    return cell->GetValueView();
+}
+
+CellNumberKind Sheet::GetNumber(Position pos, double& number, FormulaError& error) const {
+    assert(pos.IsValid());
+    const Cell* cell = sheet_.Get(pos);
+    if(cell == nullptr)
     {
-        return nullptr;
+        number = 0.0;
+        return CellNumberKind::Empty;
     }
-    return (cell_it->second).get();
+    return cell->GetNumber(number, error);
+}
+
+Cell* Sheet::GetCell(Position pos) {
+    CheckPosition(pos);
+    ApplyPendingChanges();
+    return sheet_.Get(pos);
 }
 
-CellInterface* Sheet::GetCell(Position pos) {
-    if(pos.col >= Position::MAX_COLS || pos.col < 0 || pos.row >= Position::MAX_ROWS || pos.row < 0)
+void Sheet::ClearCell(Position pos) {
+    CheckPosition(pos);
+    if(transaction_)
     {
-        throw InvalidPositionException("Invalid position");
+        (*transaction_)[pos] = Edit{};
+        return;
     }
-    auto cell_it = sheet_.find(pos);
-    if(cell_it == sheet_.end())
+    EraseCell(pos);
+}
+
+void Sheet::EraseCell(Position pos) {
+    Cell* cell = sheet_.Get(pos);
+    if(cell != nullptr)
     {
-        return nullptr;
+        const bool had_text = !cell->IsEmpty();
+        //Очистка разрушает зависимости формульной ячейки, сбрасывает значения
+        //зависимых формул и обновляет итоги покрывающих её диапазонов. Если от
+        //ячейки зависят формулы, её вершина остаётся в графе без ячейки.
+        cell->Clear();
+        sheet_.Erase(pos);
+        if(had_text)
+        {
+            UpdateSize(pos, false);
+        }
     }
-    return (cell_it->second).get();
 }
 
-void Sheet::ClearCell(Position pos) {
-    if(pos.col >= Position::MAX_COLS || pos.col < 0 || pos.row >= Position::MAX_ROWS || pos.row < 0)
+void Sheet::BeginTransaction() {
+    if(transaction_)
     {
-        throw InvalidPositionException("Invalid position");
+        throw TransactionException("Transaction is already started");
     }
-    if(GetCell(pos) != nullptr)
+    transaction_.emplace();
+}
+
+void Sheet::Commit() {
+    if(!transaction_)
+    {
+        throw TransactionException("No transaction to commit");
+    }
+    std::map<Position, Edit> edits = std::move(*transaction_);
+    transaction_.reset();
+    // Прежнее содержимое ячеек: формулы сохраняются готовыми телами из
+    // таблицы формул и при возврате не разбираются заново
+    std::map<Position, Edit> undo;
+    for(const auto& [pos, edit] : edits)
     {
-        if(dynamic_cast<Cell*>(GetCell(pos))->IsThisCellPartOfFormula())
+        Edit& saved = undo.emplace_hint(undo.end(), pos, Edit{})->second;
+        if(const Cell* cell = sheet_.Get(pos))
         {
-            //Если ячейка является частью формулы, то просто удаляем содержимое этой ячейки
-            SetCell(pos, "");
+            saved.formula = cell->GetFormulaEntry();
+            saved.text = saved.formula.formula == nullptr ? cell->GetText() : std::string{};
         }
-        else
+    }
+    if(!ApplyEdits(std::move(edits)))
+    {
+        // Прежний лист был без циклов, поэтому возврат к нему их не находит
+        [[maybe_unused]] const bool restored = ApplyEdits(std::move(undo));
+        assert(restored);
+        throw CircularDependencyException("There is a circular dependency");
+    }
+}
+
+void Sheet::Rollback() {
+    if(!transaction_)
+    {
+        throw TransactionException("No transaction to roll back");
+    }
+    transaction_.reset();
+}
+
+bool Sheet::ApplyEdits(std::map<Position, Edit>&& edits) {
+    // Содержимое ставится без рёбер графа, как при загрузке листа. Ссылки
+    // прежних формул отпускаются в конце: вершины, на которые ссылаются и
+    // новые формулы, не удаляются и не заводятся заново.
+    std::vector<Position> released;
+    for(auto& [pos, edit] : edits)
+    {
+        Cell* cell = sheet_.Get(pos);
+        if(cell == nullptr)
         {
-            if(dynamic_cast<Cell*>(GetCell(pos))->IsFormulaCell())
+            if(!edit.text)
             {
-                //Если удаляется формульная ячейка, то разрушаются зависимость этой ячейки от других
-                dynamic_cast<Cell*>(GetCell(pos))->EraseParentCellFromAllRefferencedCells();
+                continue;
             }
-            sheet_.erase(pos);
+            cell = CreateCell(pos, std::string{});
+        }
+        const bool had_text = !cell->IsEmpty();
+        cell->SetUnlinked(edit.text ? std::move(*edit.text) : std::string{}, std::move(edit.formula), released);
+        const bool has_text = !cell->IsEmpty();
+        if(!edit.text)
+        {
+            sheet_.Erase(pos);
+        }
+        if(has_text != had_text)
+        {
+            UpdateSize(pos, has_text);
         }
-        UpdateSize(pos, false);
+    }
+    // Ссылки добавляются, когда все ячейки уже на местах
+    std::vector<CellId> linked;
+    for(const auto& [pos, edit] : edits)
+    {
+        Cell* cell = sheet_.Get(pos);
+        if(cell != nullptr && cell->IsFormulaCell())
+        {
+            cell->AddLoadedReferences();
+            linked.push_back(cell->GetId());
+        }
+    }
+    if(!graph_.UpdateOrder(linked))
+    {
+        // Лист вернут к прежнему содержимому, и прежним формулам снова
+        // понадобятся их вершины: пустые ячейки вне правок не удаляются.
+        // Ссылки отвергнутых формул отпустит возврат.
+        return false;
+    }
+    for(Position pos : released)
+    {
+        if(const Cell* cell = sheet_.Get(pos))
+        {
+            ReleaseReferenceNode(cell->GetId());
+        }
+        else if(auto it = reference_nodes_.find(pos); it != reference_nodes_.end())
+        {
+            ReleaseReferenceNode(it->second);
+        }
+    }
+    return true;
+}
+
+void Sheet::MarkChanged(CellId id, bool value_changed) {
+    if(pending_marks_.size() <= id)
+    {
+        pending_marks_.resize(graph_.GetIdBound());
+    }
+    PendingMark& mark = pending_marks_[id];
+    if(mark.generation == pending_generation_)
+    {
+        pending_changes_[mark.index].value_changed |= value_changed;
+        return;
+    }
+    mark.generation = pending_generation_;
+    mark.index = static_cast<std::uint32_t>(pending_changes_.size());
+    pending_changes_.push_back({id, value_changed});
+}
+
+void Sheet::ApplyPendingChangesImpl() const {
+    for(const PendingChange& change : pending_changes_)
+    {
+        graph_.GetCell(change.id)->InvalidateDependents(change.value_changed);
+    }
+    pending_changes_.clear();
+    if(++pending_generation_ == 0)
+    {
+        // Поколение переполнилось: старые метки могут с ним совпасть
+        pending_marks_.assign(pending_marks_.size(), PendingMark{});
+        pending_generation_ = 1;
     }
 }
 
@@ -138,57 +584,117 @@ Size Sheet::GetPrintableSize() const {
     return {max_row, max_col};
 }
 
-void Sheet::PrintValues(std::ostream& output) const {
-    Size print_size = GetPrintableSize();
-    for(int y = 0; y < print_size.rows; ++y)
+void Sheet::Recalculate(ThreadPool& pool) {
+    ApplyPendingChanges();
+    std::vector<Cell*> stale_cells;
+    sheet_.ForEach([&stale_cells](Position, Cell* cell) {
+        if(cell->IsFormulaCell() && !cell->IsValidCache())
+        {
+            stale_cells.push_back(cell);
+        }
+    });
+    std::sort(stale_cells.begin(), stale_cells.end(), [](const Cell* lhs, const Cell* rhs) {
+        return lhs->GetTopologicalOrder() < rhs->GetTopologicalOrder();
+    });
+
+    // Уровень формулы - на единицу больше наибольшего уровня устаревших
+    // формул, на которые она ссылается. В топологическом порядке они уже
+    // посчитаны к моменту, когда до неё дойдёт очередь.
+    const size_t NOT_STALE = static_cast<size_t>(-1);
+    std::vector<size_t> cell_levels(graph_.GetIdBound(), NOT_STALE);
+    std::vector<std::vector<Cell*>> levels;
+    std::vector<CellId> references;
+    for(Cell* cell : stale_cells)
     {
-        for(int x = 0; x < print_size.cols - 1; ++x)
+        size_t level = 0;
+        references.clear();
+        cell->CollectReferencesToEvaluate(references);
+        for(CellId child_id : references)
         {
-            const CellInterface* cell = GetCell({y, x});
-            if(cell != nullptr)
+            if(cell_levels[child_id] != NOT_STALE)
             {
-                output << cell->GetValue();
-                output << "\t"s;
-            } 
-            else
-            {
-                output << "\t"s;
-            }          
+                level = std::max(level, cell_levels[child_id] + 1);
+            }
+        }
+        cell_levels[cell->GetId()] = level;
+        if(level == levels.size())
+        {
+            levels.emplace_back();
         }
-        const CellInterface* cell = GetCell({y, print_size.cols - 1});
-        if(cell != nullptr)
+        levels[level].push_back(cell);
+    }
+
+    // Формулы уровня, ссылки которых не изменили значений, не вычисляются.
+    // Остальные ячейки уровня с общим телом формулы, идущие подряд по
+    // столбцу, вычисляются пачкой. Изменившиеся значения помечают зависимые
+    // формулы следующих уровней после вычисления всего уровня, в одном потоке.
+    std::vector<char> changed;
+    for(std::vector<Cell*>& level : levels)
+    {
+        const size_t level_size = level.size();
+        level.erase(std::remove_if(level.begin(), level.end(), [](const Cell* cell) {
+            return cell->ConfirmValue();
+        }), level.end());
+        saved_evaluations_ += level_size - level.size();
+        const std::vector<RecalculationTask> tasks = MakeRecalculationTasks(level);
+        changed.assign(level.size(), false);
+        pool.ParallelFor(tasks.size(), [this, &level, &tasks, &changed](size_t i) {
+            const RecalculationTask& task = tasks[i];
+            if(task.count == 1)
+            {
+                changed[task.first] = level[task.first]->CalculateValue();
+                return;
+            }
+            std::array<FormulaInterface::Value, FormulaInterface::BATCH_SIZE> results;
+            task.formula->EvaluateBatch(*this, task.offset, task.count, results.data());
+            for(size_t j = 0; j < task.count; ++j)
+            {
+                changed[task.first + j] = level[task.first + j]->SetCalculatedValue(results[j]);
+            }
+        });
+        for(size_t i = 0; i < level.size(); ++i)
         {
-            output << cell->GetValue();
+            if(changed[i])
+            {
+                level[i]->MarkDependentsDirty();
+            }
         }
-        output << "\n"s;
     }
 }
-void Sheet::PrintTexts(std::ostream& output) const {
+
+template <typename Func>
+void Sheet::PrintCells(std::ostream& output, Func print_cell) const {
     Size print_size = GetPrintableSize();
     for(int y = 0; y < print_size.rows; ++y)
     {
-        for(int x = 0; x < print_size.cols - 1; ++x)
-        {
-            const CellInterface* cell = GetCell({y, x});
-            if(cell != nullptr)
+        int printed_tabs = 0;
+        sheet_.ForEachInRow(y, 0, print_size.cols, [&](int x, const Cell* cell) {
+            for(; printed_tabs < x; ++printed_tabs)
             {
-                output << cell->GetText();
-                output << "\t"s;
+                output << '\t';
             }
-            else
-            {
-                output << "\t"s;
-            }           
-        }
-        const CellInterface* cell = GetCell({y, print_size.cols - 1});
-        if(cell != nullptr)
+            print_cell(cell);
+        });
+        for(; printed_tabs < print_size.cols - 1; ++printed_tabs)
         {
-            output << cell->GetText();
+            output << '\t';
         }
-        output << "\n"s;
+        output << '\n';
     }
 }
 
+void Sheet::PrintValues(std::ostream& output) const {
+    PrintCells(output, [&output](const Cell* cell) {
+        output << cell->GetValueView();
+    });
+}
+
+void Sheet::PrintTexts(std::ostream& output) const {
+    PrintCells(output, [&output](const Cell* cell) {
+        cell->PrintText(output);
+    });
+}
+
 std::unique_ptr<SheetInterface> CreateSheet() {
     return std::make_unique<Sheet>();
 }
\ No newline at end of file
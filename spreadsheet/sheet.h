@@ -1,23 +1,107 @@
 #pragma once
 
+#include "cell.h"
 #include "common.h"
+#include "dependency_graph.h"
+#include "formula_table.h"
+#include "object_pool.h"
+#include "thread_pool.h"
+#include "tiled_storage.h"
 
+#include <cstdint>
 #include <functional>
-#include <unordered_map>
 #include <memory>
 #include <map>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
+// Чтения листа не потокобезопасны, хотя и объявлены const: значения
+// формул вычисляются и запоминаются при чтении, а перед чтением значений
+// применяются отложенные изменения ячеек (ApplyPendingChanges). Читать лист
+// из нескольких потоков можно только после Recalculate и без записей.
 class Sheet : public SheetInterface {
 public:
+    Sheet();
     ~Sheet();
 
     void SetCell(Position pos, std::string text) override;
 
-    const CellInterface* GetCell(Position pos) const override;
-    CellInterface* GetCell(Position pos) override;
+    // Загружает лист целиком: результат тот же, что у SetCell для каждой
+    // пары (pos, text) по порядку, если ни один вызов не бросил исключения.
+    // Формулы разбираются параллельно на пуле, граф зависимостей строится за
+    // один проход, а циклы ищутся один раз во всём графе. Лист выдаётся
+    // только готовым, при ошибке он не создаётся: бросается
+    // InvalidPositionException, FormulaException с первой некорректной
+    // формулой или CircularDependencyException со всеми ячейками циклов.
+    static std::unique_ptr<Sheet> BulkLoad(std::vector<std::pair<Position, std::string>> cells,
+                                           ThreadPool& pool);
+
+    // Сборка нового листа из готовых ячеек, см. ниже
+    class Loader;
+
+    // Транзакция правок. Между BeginTransaction и Commit вызовы SetCell и
+    // ClearCell только запоминаются: позиция и синтаксис формулы
+    // проверяются сразу, а чтения видят лист без этих правок. Commit
+    // применяет правки разом, повторные правки одной ячейки - последней.
+    // Цикл проверяется только в итоговом листе: правка, замыкающая цикл
+    // лишь до следующей правки той же транзакции, допустима. Если итоговый
+    // лист содержит цикл, Commit возвращает все ячейки транзакции к прежнему
+    // содержимому и бросает CircularDependencyException. Rollback отбрасывает
+    // правки. Вложенных транзакций нет: BeginTransaction внутри транзакции,
+    // Commit и Rollback вне её бросают TransactionException.
+    void BeginTransaction();
+    void Commit();
+    void Rollback();
+    bool IsInTransaction() const {
+        return transaction_.has_value();
+    }
+
+    const Cell* GetCell(Position pos) const override;
+    Cell* GetCell(Position pos) override;
+
+    // Значение ячейки без копирования, как CellInterface::GetValueView();
+    // у несуществующей ячейки - пустой текст
+    CellInterface::ValueView GetValueView(Position pos) const;
+    CellNumberKind GetNumber(Position pos, double& number, FormulaError& error) const override;
 
     void ClearCell(Position pos) override;
 
+    // Доступ для ячеек листа. Позиция не проверяется: ячейки передают только
+    // позиции ссылок, проверенные при разборе формулы.
+    Cell* FindCell(Position pos) const {
+        return sheet_.Get(pos);
+    }
+    // То же, что ClearCell, без проверки позиции
+    void EraseCell(Position pos);
+
+    // Вершины графа для ссылок формул. Ссылка на несуществующую ячейку
+    // получает вершину без ячейки: пустая ячейка ради неё не создаётся и
+    // в печатную область не входит. Ячейка, записанная в такую позицию,
+    // занимает готовую вершину, а удалённая ячейка, от которой зависят
+    // формулы, оставляет вершину без ячейки.
+    // Вершина ячейки или ссылки в позиции pos; создаётся, если её нет
+    CellId GetReferenceNode(Position pos);
+    // Ссылку на вершину убрали из формулы: вершина без ячейки и пустая
+    // ячейка удаляются, если от них больше ничего не зависит
+    void ReleaseReferenceNode(CellId id);
+    // Вершина для создаваемой ячейки и её освобождение при разрушении ячейки
+    CellId AttachCell(Cell* cell, Position pos, bool place_first);
+    void DetachCell(CellId id);
+
+    // Вызывает func(pos, cell) для всех ячеек листа, по блокам хранилища
+    template <typename Func>
+    void ForEachCell(Func func) const {
+        sheet_.ForEach([&func](Position pos, const Cell* cell) {
+            func(pos, *cell);
+        });
+    }
+    size_t GetCellCount() const {
+        return sheet_.Size();
+    }
+
     Size GetPrintableSize() const override;
 
     void PrintValues(std::ostream& output) const override;
@@ -25,8 +109,170 @@ public:
 
     void UpdateSize(Position pos, bool IsCellAdded);
 
+    // Пересчитывает все формулы с устаревшим значением на пуле потоков.
+    // Ячейки разбиваются на уровни за один проход в топологическом порядке:
+    // формулы одного уровня не зависят друг от друга и вычисляются
+    // параллельно, уровни - по очереди. Результат совпадает с
+    // последовательным вычислением через GetValue(). Идущие подряд ячейки
+    // протянутого столбца одного уровня вычисляются пачкой.
+    void Recalculate(ThreadPool& pool);
+
+    // Изменения ячеек применяются отложенно. Set сообщает об изменении
+    // ячейки (value_changed - см. Cell::InvalidateDependents), лист
+    // запоминает её, а зависимые формулы помечает один раз перед следующим
+    // чтением значений или пересчётом. Повторное изменение той же ячейки
+    // до этого ничего не стоит: метки изменённых ячеек сбрасываются сменой
+    // поколения.
+    void MarkChanged(CellId id, bool value_changed);
+    // Помечает зависимые изменённых ячеек. Recalculate, неконстантный
+    // GetCell и SaveSnapshot вызывают его сами. Метод const, потому что его
+    // вызывают и чтения значений ячеек через Cell::IsValidCache: ячейку
+    // могли получить до изменения. Такое чтение меняет внутреннее состояние
+    // листа, см. замечание о потоках у класса.
+    void ApplyPendingChanges() const {
+        if(!pending_changes_.empty())
+        {
+            ApplyPendingChangesImpl();
+        }
+    }
+    // Число изменённых ячеек, зависимые которых ещё не помечены
+    size_t GetPendingChangeCount() const {
+        return pending_changes_.size();
+    }
+
+    // Сколько вычислений формул сэкономило отсечение пересчёта: формула
+    // помечается при изменении ячеек, от которых она зависит, но не
+    // вычисляется, если значения её ссылок остались прежними
+    size_t GetSavedEvaluations() const {
+        return saved_evaluations_;
+    }
+
+    const DependencyGraph& GetDependencyGraph() const {
+        return graph_;
+    }
+    DependencyGraph& GetDependencyGraph() {
+        return graph_;
+    }
+
+    const FormulaTable& GetFormulaTable() const {
+        return formulas_;
+    }
+    FormulaTable& GetFormulaTable() {
+        return formulas_;
+    }
+
 private:
-    std::unordered_map<Position, std::unique_ptr<CellInterface>, PositionHasher> sheet_;
+    // Ячейки лежат в пуле листа, хранилище возвращает их туда
+    struct CellDeleter {
+        void operator()(Cell* cell) const;
+    };
+
+    // Граф, таблица формул и пул объявлены раньше ячеек: ячейки при
+    // разрушении удаляют себя из графа, отпускают свои формулы и
+    // возвращаются в пул
+    DependencyGraph graph_;
+    FormulaTable formulas_;
+    ObjectPool<Cell> cell_pool_;
+    // Вершины ссылок на несуществующие ячейки
+    std::unordered_map<Position, CellId, PositionHasher> reference_nodes_;
+    TiledStorage<Cell, CellDeleter> sheet_;
+    // Число ячеек с непустым текстом в каждой строке и столбце: по ним
+    // считается печатная область
     std::map<int, int> rows_number_of_elements;
     std::map<int, int> cols_number_of_elements;
-};
\ No newline at end of file
+    // Лист разрушается: вершины удалённых ячеек не сохраняются
+    bool destroying_ = false;
+    // Считают только Recalculate и вычисление значений при чтении
+    // (Cell::CalculateChildCells); второе - const-чтение, см. замечание о
+    // потоках у класса
+    mutable size_t saved_evaluations_ = 0;
+    friend class Cell;
+
+    struct PendingChange {
+        CellId id;
+        bool value_changed;
+    };
+    // Метка изменённой вершины: место в pending_changes_, действительное,
+    // если поколение метки совпадает с текущим
+    struct PendingMark {
+        std::uint32_t generation = 0;
+        std::uint32_t index = 0;
+    };
+    // Отложенные изменения применяют и const-чтения
+    mutable std::vector<PendingChange> pending_changes_;
+    mutable std::vector<PendingMark> pending_marks_;
+    mutable std::uint32_t pending_generation_ = 1;
+
+    void ApplyPendingChangesImpl() const;
+
+    // Правка транзакции; std::nullopt - удаление ячейки. Формула правки
+    // разобрана при записи, и тело держится в таблице формул до Commit.
+    struct Edit {
+        std::optional<std::string> text;
+        FormulaTable::Entry formula;
+    };
+    std::optional<std::map<Position, Edit>> transaction_;
+
+    // Применяет правки одним проходом: содержимое ставится без рёбер графа,
+    // затем рёбра добавляются разом и порядок проверяется один раз.
+    // Возвращает false, если итоговый лист содержит цикл; правки при этом
+    // остаются применёнными, а ссылки прежних формул не отпускаются, чтобы
+    // возврат к прежнему содержимому застал их вершины на месте.
+    bool ApplyEdits(std::map<Position, Edit>&& edits);
+
+    Cell* CreateCell(Position pos, std::string&& text);
+
+    template <typename Func>
+    void PrintCells(std::ostream& output, Func print_cell) const;
+};
+
+// Сборка нового листа из готовых ячеек: BulkLoad, снимок листа. Формулы
+// разбираются заранее в таблице формул собираемого листа, ячейки
+// добавляются без рёбер графа, а Finish достраивает лист разом.
+class Sheet::Loader {
+public:
+    // cells - ожидаемое число ячеек, под него резервируется место
+    explicit Loader(size_t cells = 0);
+
+    FormulaTable& GetFormulaTable() {
+        return sheet_->formulas_;
+    }
+
+    // Создаёт ячейку в пустой позиции. formula.formula == nullptr - ячейка
+    // без формулы с текстом text.
+    Cell* AddCell(Position pos, std::string&& text, FormulaTable::Entry&& formula);
+    bool HasCell(Position pos) const {
+        return sheet_->sheet_.Get(pos) != nullptr;
+    }
+
+    // Добавляет рёбра формул, находит циклы и строит порядок за один проход.
+    // Бросает CircularDependencyException со всеми ячейками циклов.
+    std::unique_ptr<Sheet> Finish();
+
+    // Сборка с готовым порядком (снимок листа). Ячейки формул добавляются
+    // после остальных ячеек и вершин ссылок, в топологическом порядке, а
+    // рёбра формул - AddReferences с уже найденными вершинами. Тогда порядок
+    // графа складывается сам, и FinishOrdered не ищет циклы и не строит
+    // порядок заново.
+    // Вершина ссылки на несуществующую ячейку pos
+    CellId AddReferenceNode(Position pos) {
+        return sheet_->GetReferenceNode(pos);
+    }
+    void AddReferences(Cell* cell, const std::vector<CellId>& references) {
+        cell->AddLoadedReferences(references);
+    }
+    // Стоит ли каждая формула в порядке после всех своих ссылок, явных и
+    // через диапазоны. Если нет, добавленные ячейки с порядком не согласованы
+    // и лист завершать нельзя.
+    bool IsOrdered() const;
+    std::unique_ptr<Sheet> FinishOrdered();
+
+private:
+    std::unique_ptr<Sheet> sheet_;
+    std::vector<Cell*> formula_cells_;
+    // Печатная область считается по всем ячейкам сразу
+    std::vector<int> row_counts_;
+    std::vector<int> col_counts_;
+
+    void FillPrintableSize();
+};
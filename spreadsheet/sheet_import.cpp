@@ -0,0 +1,233 @@
+#include "sheet_import.h"
+
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+namespace {
+
+// Кусок текста меньше этого не делится между потоками
+const size_t MIN_CHUNK_SIZE = 1 << 20;
+
+using Cells = std::vector<std::pair<Position, std::string>>;
+
+// Ячейки куска текста. Строки нумеруются от начала куска.
+struct ChunkCells {
+    Cells cells;
+    int rows = 0;
+};
+
+// Конец строки, начинающейся с begin: перевод строки или end
+const char* FindLineEnd(const char* begin, const char* end) {
+    const void* found = std::memchr(begin, '\n', end - begin);
+    return found == nullptr ? end : static_cast<const char*>(found);
+}
+
+void ParseTsvChunk(std::string_view text, ChunkCells& result) {
+    const char* pos = text.data();
+    const char* const end = pos + text.size();
+    while(pos != end)
+    {
+        const char* const line_end = FindLineEnd(pos, end);
+        int col = 0;
+        while(true)
+        {
+            const void* found = std::memchr(pos, '\t', line_end - pos);
+            const char* field_end = found == nullptr ? line_end : static_cast<const char*>(found);
+            if(field_end != pos)
+            {
+                result.cells.emplace_back(Position{result.rows, col}, std::string(pos, field_end));
+            }
+            if(field_end == line_end)
+            {
+                break;
+            }
+            pos = field_end + 1;
+            ++col;
+        }
+        ++result.rows;
+        pos = line_end == end ? end : line_end + 1;
+    }
+}
+
+void ParseCsvChunk(std::string_view text, ChunkCells& result) {
+    const char* pos = text.data();
+    const char* const end = pos + text.size();
+    std::string field;
+    int col = 0;
+    while(pos != end)
+    {
+        field.clear();
+        size_t quoted_size = 0;
+        if(*pos == '"')
+        {
+            // Поле в кавычках: удвоенная кавычка - сама кавычка
+            ++pos;
+            while(pos != end)
+            {
+                const void* found = std::memchr(pos, '"', end - pos);
+                const char* quote = found == nullptr ? end : static_cast<const char*>(found);
+                field.append(pos, quote);
+                pos = quote;
+                if(pos == end)
+                {
+                    break;
+                }
+                ++pos;
+                if(pos == end || *pos != '"')
+                {
+                    break;
+                }
+                field += '"';
+                ++pos;
+            }
+            quoted_size = field.size();
+        }
+        const char* field_end = pos;
+        while(field_end != end && *field_end != ',' && *field_end != '\n')
+        {
+            ++field_end;
+        }
+        field.append(pos, field_end);
+        pos = field_end;
+        // Перевод строки CRLF; '\r' в кавычках - часть поля
+        if(field.size() > quoted_size && field.back() == '\r' && (pos == end || *pos == '\n'))
+        {
+            field.pop_back();
+        }
+        if(!field.empty())
+        {
+            result.cells.emplace_back(Position{result.rows, col}, field);
+        }
+        if(pos == end || *pos == '\n')
+        {
+            ++result.rows;
+            col = 0;
+        }
+        else
+        {
+            ++col;
+        }
+        if(pos != end)
+        {
+            ++pos;
+        }
+    }
+}
+
+// Позиция за закрывающей кавычкой поля, открытого кавычкой перед pos, или
+// data.size(), если поле не закрыто
+size_t SkipQuotedField(std::string_view data, size_t pos) {
+    while(true)
+    {
+        const size_t quote = data.find('"', pos);
+        if(quote == std::string_view::npos)
+        {
+            return data.size();
+        }
+        if(quote + 1 == data.size() || data[quote + 1] != '"')
+        {
+            return quote + 1;
+        }
+        pos = quote + 2;
+    }
+}
+
+// Первый перевод строки CSV не раньше from, который стоит вне кавычек, или
+// data.size(). Строка begin начинается вне кавычек. Кавычки читаются так
+// же, как в ParseCsvChunk: кавычка открывает поле только в его начале, а
+// остальные кавычки вне поля в кавычках - обычные символы.
+size_t FindCsvLineEnd(std::string_view data, size_t begin, size_t from) {
+    size_t line_end = data.find('\n', from);
+    size_t pos = begin;
+    while(line_end != std::string_view::npos)
+    {
+        const size_t quote = data.find('"', pos);
+        if(quote == std::string_view::npos || quote > line_end)
+        {
+            return line_end;
+        }
+        pos = quote + 1;
+        if(quote != 0 && data[quote - 1] != ',' && data[quote - 1] != '\n')
+        {
+            continue;
+        }
+        pos = SkipQuotedField(data, pos);
+        if(pos > line_end)
+        {
+            line_end = data.find('\n', pos);
+        }
+    }
+    return data.size();
+}
+
+// Делит текст на куски по границам строк. У CSV перевод строки внутри
+// поля в кавычках границей не является.
+std::vector<std::string_view> SplitIntoChunks(std::string_view data, TextFormat format, size_t chunk_count) {
+    std::vector<std::string_view> chunks;
+    const size_t chunk_size = std::max(MIN_CHUNK_SIZE, data.size() / std::max<size_t>(chunk_count, 1) + 1);
+    size_t begin = 0;
+    while(begin < data.size())
+    {
+        size_t split = std::min(data.size(), begin + chunk_size);
+        if(format == TextFormat::Csv)
+        {
+            split = FindCsvLineEnd(data, begin, split);
+        }
+        else
+        {
+            split = data.find('\n', split);
+            split = split == std::string_view::npos ? data.size() : split;
+        }
+        // Перевод строки остаётся в куске: последняя строка куска закончена
+        split = std::min(data.size(), split + 1);
+        chunks.push_back(data.substr(begin, split - begin));
+        begin = split;
+    }
+    return chunks;
+}
+
+}  // namespace
+
+std::unique_ptr<Sheet> ImportSheet(std::string_view data, TextFormat format, ThreadPool& pool) {
+    const std::vector<std::string_view> chunks = SplitIntoChunks(data, format, pool.GetConcurrency() * 4);
+    std::vector<ChunkCells> chunk_cells(chunks.size());
+    pool.ParallelFor(chunks.size(), [&](size_t i) {
+        if(format == TextFormat::Csv)
+        {
+            ParseCsvChunk(chunks[i], chunk_cells[i]);
+        }
+        else
+        {
+            ParseTsvChunk(chunks[i], chunk_cells[i]);
+        }
+    });
+
+    // Строки кусков сдвигаются на число строк в предыдущих кусках
+    size_t total = 0;
+    for(const ChunkCells& chunk : chunk_cells)
+    {
+        total += chunk.cells.size();
+    }
+    Cells cells;
+    cells.reserve(total);
+    int first_row = 0;
+    for(ChunkCells& chunk : chunk_cells)
+    {
+        for(auto& [pos, text] : chunk.cells)
+        {
+            cells.emplace_back(Position{first_row + pos.row, pos.col}, std::move(text));
+        }
+        first_row += chunk.rows;
+        Cells().swap(chunk.cells);
+    }
+    return Sheet::BulkLoad(std::move(cells), pool);
+}
+
+std::unique_ptr<Sheet> ImportSheetFile(const std::string& path, TextFormat format, ThreadPool& pool) {
+    const MappedFile file(path);
+    return ImportSheet(file.GetData(), format, pool);
+}
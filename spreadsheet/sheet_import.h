@@ -0,0 +1,30 @@
+#pragma once
+
+#include "sheet.h"
+#include "thread_pool.h"
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+// Формат текста, из которого загружается лист
+enum class TextFormat {
+    // Формат Sheet::PrintTexts: ячейки строки разделены табуляцией,
+    // строки - переводом строки
+    Tsv,
+    // CSV по RFC 4180: ячейки разделены запятой, поле в кавычках может
+    // содержать запятые, переводы строк и кавычки, записанные дважды
+    Csv,
+};
+
+// Загружает лист из текста data. Текст делится на куски по границам строк,
+// куски разбираются на пуле параллельно, и ячейки передаются в
+// Sheet::BulkLoad, который там же разбирает формулы. Пустое поле ячейку не
+// создаёт. Текст, выведенный PrintTexts, загружается в лист с тем же
+// выводом PrintTexts, если тексты ячеек не содержат табуляций и переводов
+// строк. Ошибки - как у Sheet::BulkLoad.
+std::unique_ptr<Sheet> ImportSheet(std::string_view data, TextFormat format, ThreadPool& pool);
+
+// То же для файла. Файл отображается в память (POSIX mmap) и не читается
+// целиком в буфер. Бросает std::system_error, если файл не удалось открыть.
+std::unique_ptr<Sheet> ImportSheetFile(const std::string& path, TextFormat format, ThreadPool& pool);
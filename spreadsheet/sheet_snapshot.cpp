@@ -0,0 +1,597 @@
+#include "sheet_snapshot.h"
+
+#include "mapped_file.h"
+#include "tiled_storage.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <fstream>
+#include <ostream>
+#include <system_error>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+using namespace std::literals;
+
+namespace {
+
+const char MAGIC[8] = {'S', 'H', 'E', 'E', 'T', 'S', 'N', 'P'};
+const std::uint32_t VERSION = 2;
+// Записывается как есть: при другом порядке байтов не совпадёт
+const std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+enum Section : std::uint32_t {
+    STRINGS,
+    BODIES,
+    TEXT_CELLS,
+    REFERENCE_NODES,
+    FORMULA_CELLS,
+    FORMULA_VALUES,
+    NUMBERS,
+    REFERENCE_OFFSETS,
+    REFERENCES,
+    SECTION_COUNT,
+};
+
+struct SectionRecord {
+    std::uint64_t offset;
+    std::uint64_t size;
+};
+
+struct Header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order;
+    // Число ячеек без формул в секции TEXT_CELLS
+    std::uint64_t text_cell_count;
+    SectionRecord sections[SECTION_COUNT];
+};
+
+// Текст тела формулы без знака "=", записанный для ячейки anchor
+struct BodyRecord {
+    std::uint64_t text_offset;
+    std::uint32_t text_size;
+    std::int32_t anchor_row;
+    std::int32_t anchor_col;
+    std::uint32_t reserved;
+};
+
+struct PositionRecord {
+    std::uint16_t row;
+    std::uint16_t col;
+};
+
+struct FormulaCellRecord {
+    std::uint16_t row;
+    std::uint16_t col;
+    // Номер тела формулы
+    std::uint32_t body;
+};
+
+// Значение формулы; у Number само число - очередное в секции NUMBERS
+enum class ValueKind : std::uint8_t {
+    // Значение не сохранено, формула вычисляется заново
+    None,
+    Number,
+    // Ошибки по FormulaError::Category, в том же порядке
+    RefError,
+    ValueError,
+    ArithmeticError,
+};
+
+static_assert(Position::MAX_ROWS <= 0x10000 && Position::MAX_COLS <= 0x10000);
+static_assert(sizeof(PositionRecord) == 4 && sizeof(FormulaCellRecord) == 8);
+static_assert(std::is_trivially_copyable_v<Header> && std::is_trivially_copyable_v<BodyRecord>
+              && std::is_trivially_copyable_v<PositionRecord> && std::is_trivially_copyable_v<FormulaCellRecord>);
+
+// Ячейки без формул записываются в порядке ForEachCell: по блокам
+// BLOCK_SIZE x BLOCK_SIZE, внутри блока построчно. Номер ячейки в этом
+// порядке растёт от ячейки к ячейке, и запись хранит только разницу.
+const int BLOCK_SIZE = 64;
+const int BLOCK_COLS = Position::MAX_COLS / BLOCK_SIZE;
+const std::uint64_t CELL_KEY_COUNT = std::uint64_t{Position::MAX_ROWS} * Position::MAX_COLS;
+static_assert(TiledStorage<Cell>::TILE_SIZE == BLOCK_SIZE && Position::MAX_ROWS % BLOCK_SIZE == 0
+              && Position::MAX_COLS % BLOCK_SIZE == 0);
+
+std::uint64_t GetCellKey(Position pos) {
+    const std::uint64_t block = std::uint64_t(pos.row / BLOCK_SIZE) * BLOCK_COLS + pos.col / BLOCK_SIZE;
+    return block * BLOCK_SIZE * BLOCK_SIZE + (pos.row % BLOCK_SIZE) * BLOCK_SIZE + pos.col % BLOCK_SIZE;
+}
+
+Position GetKeyPosition(std::uint64_t key) {
+    const auto block = static_cast<int>(key / (BLOCK_SIZE * BLOCK_SIZE));
+    const auto slot = static_cast<int>(key % (BLOCK_SIZE * BLOCK_SIZE));
+    return {block / BLOCK_COLS * BLOCK_SIZE + slot / BLOCK_SIZE, block % BLOCK_COLS * BLOCK_SIZE + slot % BLOCK_SIZE};
+}
+
+// Числа переменной длины: по 7 бит в байте, старший бит - есть ли ещё байт
+void AppendVarint(std::string& output, std::uint64_t value) {
+    while(value >= 0x80)
+    {
+        output += static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    output += static_cast<char>(value);
+}
+
+std::uint64_t ReadVarint(const char*& pos, const char* end) {
+    std::uint64_t value = 0;
+    for(int shift = 0; shift < 64; shift += 7)
+    {
+        if(pos == end)
+        {
+            break;
+        }
+        const auto byte = static_cast<unsigned char>(*pos++);
+        value |= std::uint64_t(byte & 0x7F) << shift;
+        if((byte & 0x80) == 0)
+        {
+            return value;
+        }
+    }
+    throw SnapshotException("Snapshot number is truncated");
+}
+
+// Текст - неотрицательное целое в записи std::to_string: такой текст
+// хранится числом, а не строкой
+const size_t MAX_INTEGER_DIGITS = 15;
+
+bool ParseCanonicalInteger(std::string_view text, std::uint64_t& number) {
+    if(text.empty() || text.size() > MAX_INTEGER_DIGITS || (text[0] == '0' && text.size() > 1))
+    {
+        return false;
+    }
+    number = 0;
+    for(char c : text)
+    {
+        if(c < '0' || c > '9')
+        {
+            return false;
+        }
+        number = number * 10 + (c - '0');
+    }
+    return true;
+}
+
+// Секции выравниваются на 8 байт
+size_t AlignSection(size_t offset) {
+    return (offset + 7) / 8 * 8;
+}
+
+template <typename Record>
+void WriteRecords(std::ostream& output, const std::vector<Record>& records) {
+    output.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(Record));
+}
+
+// Байты секции. Проверяет, что секция лежит внутри снимка.
+std::string_view GetSection(std::string_view data, const SectionRecord& section) {
+    if(section.offset > data.size() || section.size > data.size() - section.offset)
+    {
+        throw SnapshotException("Snapshot section is out of bounds");
+    }
+    return data.substr(section.offset, section.size);
+}
+
+// Записи секции
+template <typename Record>
+std::vector<Record> ReadRecords(std::string_view data, const SectionRecord& section) {
+    const std::string_view bytes = GetSection(data, section);
+    if(bytes.size() % sizeof(Record) != 0)
+    {
+        throw SnapshotException("Snapshot section is out of bounds");
+    }
+    std::vector<Record> records(bytes.size() / sizeof(Record));
+    if(!records.empty())
+    {
+        std::memcpy(records.data(), bytes.data(), bytes.size());
+    }
+    return records;
+}
+
+std::string_view GetString(std::string_view strings, std::uint64_t offset, std::uint64_t size) {
+    if(offset > strings.size() || size > strings.size() - offset)
+    {
+        throw SnapshotException("Snapshot string is out of bounds");
+    }
+    return strings.substr(offset, size);
+}
+
+Position GetPosition(std::int32_t row, std::int32_t col) {
+    const Position pos{row, col};
+    if(!pos.IsValid())
+    {
+        throw SnapshotException("Snapshot position is invalid");
+    }
+    return pos;
+}
+
+ValueKind GetValueKind(const Cell& cell, double& number) {
+    if(!cell.IsValidCache())
+    {
+        return ValueKind::None;
+    }
+    const CellInterface::ValueView value = cell.GetValueView();
+    if(std::holds_alternative<double>(value))
+    {
+        number = std::get<double>(value);
+        return ValueKind::Number;
+    }
+    const auto category = static_cast<std::uint8_t>(std::get<FormulaError>(value).GetCategory());
+    return static_cast<ValueKind>(static_cast<std::uint8_t>(ValueKind::RefError) + category);
+}
+
+}  // namespace
+
+void SaveSnapshot(const Sheet& sheet, std::ostream& output) {
+    // Вершины снимка: ячейки без формул, вершины ссылок на несуществующие
+    // ячейки, ячейки формул в топологическом порядке. Ссылки формул
+    // записываются номерами вершин снимка.
+    // Значения формул записываются с учётом всех изменений ячеек
+    sheet.ApplyPendingChanges();
+    const DependencyGraph& graph = sheet.GetDependencyGraph();
+    const std::uint32_t NO_NODE = std::numeric_limits<std::uint32_t>::max();
+    std::vector<std::uint32_t> nodes(graph.GetIdBound(), NO_NODE);
+
+    // Тексты ячеек, затем тексты тел формул
+    std::string strings;
+    std::string text_cells;
+    std::uint64_t text_cell_count = 0;
+    std::uint64_t next_key = 0;
+    std::vector<const Cell*> formulas;
+    sheet.ForEachCell([&](Position pos, const Cell& cell) {
+        if(cell.IsFormulaCell())
+        {
+            formulas.push_back(&cell);
+            return;
+        }
+        const std::uint64_t key = GetCellKey(pos);
+        AppendVarint(text_cells, key - next_key);
+        next_key = key + 1;
+        // Младший бит: 1 - текст записан числом, 0 - длиной текста в строках
+        const std::string text = cell.GetText();
+        std::uint64_t number = 0;
+        if(ParseCanonicalInteger(text, number))
+        {
+            AppendVarint(text_cells, number << 1 | 1);
+        }
+        else
+        {
+            AppendVarint(text_cells, std::uint64_t{text.size()} << 1);
+            strings += text;
+        }
+        nodes[cell.GetId()] = static_cast<std::uint32_t>(text_cell_count++);
+    });
+    std::sort(formulas.begin(), formulas.end(), [](const Cell* lhs, const Cell* rhs) {
+        return lhs->GetTopologicalOrder() < rhs->GetTopologicalOrder();
+    });
+
+    std::vector<PositionRecord> reference_nodes;
+    for(const Cell* cell : formulas)
+    {
+        for(CellId reference : graph.GetReferences(cell->GetId()))
+        {
+            if(nodes[reference] == NO_NODE && graph.GetCell(reference) == nullptr)
+            {
+                nodes[reference] = static_cast<std::uint32_t>(text_cell_count + reference_nodes.size());
+                const Position pos = graph.GetPosition(reference);
+                reference_nodes.push_back({static_cast<std::uint16_t>(pos.row), static_cast<std::uint16_t>(pos.col)});
+            }
+        }
+    }
+    const size_t first_formula = text_cell_count + reference_nodes.size();
+    for(size_t i = 0; i < formulas.size(); ++i)
+    {
+        nodes[formulas[i]->GetId()] = static_cast<std::uint32_t>(first_formula + i);
+    }
+
+    std::string body_strings;
+    std::vector<BodyRecord> bodies;
+    std::unordered_map<const FormulaInterface*, std::uint32_t> body_indexes;
+    std::vector<FormulaCellRecord> formula_cells;
+    formula_cells.reserve(formulas.size());
+    std::vector<ValueKind> values;
+    values.reserve(formulas.size());
+    std::vector<double> numbers;
+    std::vector<std::uint32_t> reference_offsets = {0};
+    reference_offsets.reserve(formulas.size() + 1);
+    std::vector<std::uint32_t> references;
+    std::vector<std::pair<Position, std::uint32_t>> cell_references;
+    for(const Cell* cell : formulas)
+    {
+        const Position pos = graph.GetPosition(cell->GetId());
+        PositionOffset offset;
+        const FormulaInterface* body = cell->GetSharedFormula(offset);
+        auto [it, inserted] = body_indexes.emplace(body, static_cast<std::uint32_t>(bodies.size()));
+        if(inserted)
+        {
+            // Тело записывается для ячейки, в которой оно разобрано
+            const std::string expression = body->GetExpression({});
+            bodies.push_back({body_strings.size(), static_cast<std::uint32_t>(expression.size()),
+                              pos.row - offset.rows, pos.col - offset.cols, 0});
+            body_strings += expression;
+        }
+        formula_cells.push_back({static_cast<std::uint16_t>(pos.row), static_cast<std::uint16_t>(pos.col), it->second});
+        double number = 0.0;
+        values.push_back(GetValueKind(*cell, number));
+        if(values.back() == ValueKind::Number)
+        {
+            numbers.push_back(number);
+        }
+        // Ссылки - в порядке позиций, как GetReferencedCellsView
+        cell_references.clear();
+        for(CellId reference : graph.GetReferences(cell->GetId()))
+        {
+            cell_references.emplace_back(graph.GetPosition(reference), nodes[reference]);
+        }
+        std::sort(cell_references.begin(), cell_references.end());
+        for(const auto& [reference_pos, node] : cell_references)
+        {
+            references.push_back(node);
+        }
+        reference_offsets.push_back(static_cast<std::uint32_t>(references.size()));
+    }
+    for(BodyRecord& body : bodies)
+    {
+        body.text_offset += strings.size();
+    }
+    strings += body_strings;
+
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.text_cell_count = text_cell_count;
+    size_t offset = sizeof(Header);
+    auto place = [&offset](SectionRecord& section, size_t size) {
+        offset = AlignSection(offset);
+        section = {offset, size};
+        offset += size;
+    };
+    place(header.sections[STRINGS], strings.size());
+    place(header.sections[BODIES], bodies.size() * sizeof(BodyRecord));
+    place(header.sections[TEXT_CELLS], text_cells.size());
+    place(header.sections[REFERENCE_NODES], reference_nodes.size() * sizeof(PositionRecord));
+    place(header.sections[FORMULA_CELLS], formula_cells.size() * sizeof(FormulaCellRecord));
+    place(header.sections[FORMULA_VALUES], values.size() * sizeof(ValueKind));
+    place(header.sections[NUMBERS], numbers.size() * sizeof(double));
+    place(header.sections[REFERENCE_OFFSETS], reference_offsets.size() * sizeof(std::uint32_t));
+    place(header.sections[REFERENCES], references.size() * sizeof(std::uint32_t));
+
+    size_t written = 0;
+    auto pad_to = [&output, &written](const SectionRecord& section) {
+        for(; written < section.offset; ++written)
+        {
+            output.put('\0');
+        }
+        written += section.size;
+    };
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    written = sizeof(header);
+    pad_to(header.sections[STRINGS]);
+    output.write(strings.data(), strings.size());
+    pad_to(header.sections[BODIES]);
+    WriteRecords(output, bodies);
+    pad_to(header.sections[TEXT_CELLS]);
+    output.write(text_cells.data(), text_cells.size());
+    pad_to(header.sections[REFERENCE_NODES]);
+    WriteRecords(output, reference_nodes);
+    pad_to(header.sections[FORMULA_CELLS]);
+    WriteRecords(output, formula_cells);
+    pad_to(header.sections[FORMULA_VALUES]);
+    WriteRecords(output, values);
+    pad_to(header.sections[NUMBERS]);
+    WriteRecords(output, numbers);
+    pad_to(header.sections[REFERENCE_OFFSETS]);
+    WriteRecords(output, reference_offsets);
+    pad_to(header.sections[REFERENCES]);
+    WriteRecords(output, references);
+}
+
+void SaveSnapshotFile(const Sheet& sheet, const std::string& path) {
+    std::ofstream output(path, std::ios::binary);
+    if(!output)
+    {
+        throw std::system_error(errno, std::generic_category(), "Cannot open "s + path);
+    }
+    SaveSnapshot(sheet, output);
+    output.close();
+    if(!output)
+    {
+        throw std::system_error(errno, std::generic_category(), "Cannot write "s + path);
+    }
+}
+
+std::unique_ptr<Sheet> LoadSnapshot(std::string_view data, ThreadPool& pool) {
+    Header header;
+    if(data.size() < sizeof(header))
+    {
+        throw SnapshotException("Snapshot is too short");
+    }
+    std::memcpy(&header, data.data(), sizeof(header));
+    if(std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+    {
+        throw SnapshotException("Not a sheet snapshot");
+    }
+    if(header.version != VERSION || header.byte_order != BYTE_ORDER_MARK)
+    {
+        throw SnapshotException("Unsupported snapshot version or byte order");
+    }
+    const std::string_view strings = GetSection(data, header.sections[STRINGS]);
+    const std::string_view text_cells = GetSection(data, header.sections[TEXT_CELLS]);
+    const std::vector<BodyRecord> bodies = ReadRecords<BodyRecord>(data, header.sections[BODIES]);
+    const std::vector<PositionRecord> reference_nodes
+        = ReadRecords<PositionRecord>(data, header.sections[REFERENCE_NODES]);
+    const std::vector<FormulaCellRecord> formula_cells
+        = ReadRecords<FormulaCellRecord>(data, header.sections[FORMULA_CELLS]);
+    const std::vector<ValueKind> values = ReadRecords<ValueKind>(data, header.sections[FORMULA_VALUES]);
+    const std::vector<double> numbers = ReadRecords<double>(data, header.sections[NUMBERS]);
+    const std::vector<std::uint32_t> reference_offsets
+        = ReadRecords<std::uint32_t>(data, header.sections[REFERENCE_OFFSETS]);
+    const std::vector<std::uint32_t> references = ReadRecords<std::uint32_t>(data, header.sections[REFERENCES]);
+    // Каждая ячейка без формулы занимает в секции хотя бы два байта
+    if(header.text_cell_count > text_cells.size() / 2 || values.size() != formula_cells.size()
+       || reference_offsets.size() != formula_cells.size() + 1 || reference_offsets.front() != 0
+       || reference_offsets.back() != references.size()
+       || !std::is_sorted(reference_offsets.begin(), reference_offsets.end()))
+    {
+        throw SnapshotException("Snapshot sections are inconsistent");
+    }
+
+    std::vector<std::pair<std::string_view, Position>> formulas;
+    formulas.reserve(bodies.size());
+    for(const BodyRecord& body : bodies)
+    {
+        formulas.emplace_back(GetString(strings, body.text_offset, body.text_size),
+                              GetPosition(body.anchor_row, body.anchor_col));
+    }
+    const size_t node_count = header.text_cell_count + reference_nodes.size() + formula_cells.size();
+    Sheet::Loader loader(node_count);
+    const std::vector<FormulaTable::Entry> entries = loader.GetFormulaTable().InternAll(formulas, pool);
+    // Ячейка, в которой разобрано тело. Совпадающие тела таблица формул
+    // объединяет, и тогда это ячейка первого из них.
+    std::vector<Position> anchors;
+    anchors.reserve(entries.size());
+    for(size_t i = 0; i < entries.size(); ++i)
+    {
+        const Position anchor = formulas[i].second;
+        anchors.push_back({anchor.row - entries[i].offset.rows, anchor.col - entries[i].offset.cols});
+    }
+
+    // Вершины графа и позиции вершин снимка, в порядке вершин снимка
+    std::vector<CellId> node_ids;
+    std::vector<Position> node_positions;
+    node_ids.reserve(node_count);
+    node_positions.reserve(node_count);
+
+    const char* pos = text_cells.data();
+    const char* const end = pos + text_cells.size();
+    std::uint64_t next_key = 0;
+    std::uint64_t text_offset = 0;
+    while(pos != end)
+    {
+        const std::uint64_t delta = ReadVarint(pos, end);
+        if(delta >= CELL_KEY_COUNT - next_key)
+        {
+            throw SnapshotException("Snapshot position is invalid");
+        }
+        const Position cell_pos = GetKeyPosition(next_key + delta);
+        next_key += delta + 1;
+        const std::uint64_t content = ReadVarint(pos, end);
+        std::string text;
+        if(content & 1)
+        {
+            text = std::to_string(content >> 1);
+        }
+        else
+        {
+            text = GetString(strings, text_offset, content >> 1);
+            text_offset += content >> 1;
+        }
+        node_ids.push_back(loader.AddCell(cell_pos, std::move(text), {})->GetId());
+        node_positions.push_back(cell_pos);
+    }
+    if(node_ids.size() != header.text_cell_count)
+    {
+        throw SnapshotException("Snapshot sections are inconsistent");
+    }
+    for(const PositionRecord& record : reference_nodes)
+    {
+        const Position node_pos = GetPosition(record.row, record.col);
+        if(loader.HasCell(node_pos))
+        {
+            throw SnapshotException("Snapshot reference node is a cell");
+        }
+        node_ids.push_back(loader.AddReferenceNode(node_pos));
+        node_positions.push_back(node_pos);
+    }
+    // Ячейка формулы заняла бы вершину ссылки с её местом в порядке
+    std::vector<Position> reference_positions(node_positions.begin() + header.text_cell_count, node_positions.end());
+    std::sort(reference_positions.begin(), reference_positions.end());
+    if(std::adjacent_find(reference_positions.begin(), reference_positions.end()) != reference_positions.end())
+    {
+        throw SnapshotException("Snapshot reference node is duplicated");
+    }
+
+    std::vector<Cell*> cells;
+    cells.reserve(formula_cells.size());
+    size_t next_number = 0;
+    for(size_t i = 0; i < formula_cells.size(); ++i)
+    {
+        const FormulaCellRecord& record = formula_cells[i];
+        const Position cell_pos = GetPosition(record.row, record.col);
+        if(loader.HasCell(cell_pos)
+           || std::binary_search(reference_positions.begin(), reference_positions.end(), cell_pos))
+        {
+            throw SnapshotException("Snapshot cell is duplicated");
+        }
+        if(record.body >= entries.size())
+        {
+            throw SnapshotException("Snapshot formula is out of bounds");
+        }
+        Cell* cell = loader.AddCell(cell_pos, {}, {entries[record.body].formula,
+                                                   PositionOffset::Between(anchors[record.body], cell_pos)});
+        switch(values[i])
+        {
+        case ValueKind::None:
+            break;
+        case ValueKind::Number:
+            if(next_number == numbers.size())
+            {
+                throw SnapshotException("Snapshot formula value is out of bounds");
+            }
+            cell->SetCalculatedValue(numbers[next_number++]);
+            break;
+        case ValueKind::RefError:
+        case ValueKind::ValueError:
+        case ValueKind::ArithmeticError:
+            cell->SetCalculatedValue(FormulaError(static_cast<FormulaError::Category>(
+                static_cast<std::uint8_t>(values[i]) - static_cast<std::uint8_t>(ValueKind::RefError))));
+            break;
+        default:
+            throw SnapshotException("Snapshot formula value is unknown");
+        }
+        node_ids.push_back(cell->GetId());
+        node_positions.push_back(cell_pos);
+        cells.push_back(cell);
+    }
+
+    // Ссылки формул должны совпадать с позициями ссылок их тел, а порядок
+    // формул - быть топологическим
+    std::vector<CellId> cell_references;
+    for(size_t i = 0; i < cells.size(); ++i)
+    {
+        const PositionsView expected = cells[i]->GetReferencedCellsView();
+        if(reference_offsets[i + 1] - reference_offsets[i] != expected.size())
+        {
+            throw SnapshotException("Snapshot references do not match formulas");
+        }
+        cell_references.clear();
+        auto expected_pos = expected.begin();
+        for(std::uint32_t j = reference_offsets[i]; j < reference_offsets[i + 1]; ++j, ++expected_pos)
+        {
+            const std::uint32_t node = references[j];
+            if(node >= node_ids.size() || node_positions[node] != *expected_pos)
+            {
+                throw SnapshotException("Snapshot references do not match formulas");
+            }
+            cell_references.push_back(node_ids[node]);
+        }
+        loader.AddReferences(cells[i], cell_references);
+    }
+    if(!loader.IsOrdered())
+    {
+        throw SnapshotException("Snapshot formulas are not in topological order");
+    }
+    return loader.FinishOrdered();
+}
+
+std::unique_ptr<Sheet> LoadSnapshotFile(const std::string& path, ThreadPool& pool) {
+    const MappedFile file(path);
+    return LoadSnapshot(file.GetData(), pool);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "sheet.h"
+#include "thread_pool.h"
+
+#include <iosfwd>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// Двоичный снимок листа. Снимок состоит из заголовка с версией формата и
+// плоских секций, к которым заголовок даёт смещения:
+//  - строки: тексты ячеек и формул подряд;
+//  - тела формул: текст каждого общего тела таблицы формул один раз и
+//    ячейка, относительно которой он записан;
+//  - ячейки без формул: разница позиций с предыдущей ячейкой и длина текста
+//    или само число, если текст - целое число;
+//  - вершины ссылок на несуществующие ячейки: позиции;
+//  - ячейки с формулами в топологическом порядке: позиция и номер тела;
+//  - значения формул, если они были вычислены;
+//  - ссылки формул в виде CSR: смещения начала ссылок каждой формулы и
+//    номера вершин снимка, на которые она ссылается.
+// При загрузке разбираются только разные тела формул, а формулы с
+// сохранённым значением сразу действительны: лист не нужно пересчитывать.
+// Рёбра графа берутся из секции ссылок, а порядок - из порядка формул:
+// загрузка только проверяет их, не ища циклы заново.
+// Числа записываются в порядке байтов машины; снимок с другим порядком
+// байтов или версией не загружается.
+
+// Исключение, выбрасываемое при загрузке повреждённого или чужого снимка
+class SnapshotException : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+void SaveSnapshot(const Sheet& sheet, std::ostream& output);
+// Бросает std::system_error, если файл не удалось записать
+void SaveSnapshotFile(const Sheet& sheet, const std::string& path);
+
+// Загружает снимок из буфера; тела формул разбираются на пуле параллельно
+std::unique_ptr<Sheet> LoadSnapshot(std::string_view data, ThreadPool& pool);
+// То же для файла, отображённого в память
+std::unique_ptr<Sheet> LoadSnapshotFile(const std::string& path, ThreadPool& pool);
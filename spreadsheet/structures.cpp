@@ -27,17 +27,18 @@ std::string Position::ToString() const {
         return "";
     }
 
-    std::string result;
-    result.reserve(MAX_POSITION_LENGTH);
-    int c = col;
-    while (c >= 0) {
-        result.insert(result.begin(), 'A' + c % LETTERS);
-        c = c / LETTERS - 1;
+    // Текст собирается с конца в буфере на стеке: короткая строка
+    // результата помещается во внутренний буфер std::string и память не
+    // выделяется
+    char buffer[MAX_POSITION_LENGTH];
+    char* begin = buffer + MAX_POSITION_LENGTH;
+    for (int r = row + 1; r > 0; r /= 10) {
+        *--begin = static_cast<char>('0' + r % 10);
     }
-
-    result += std::to_string(row + 1);
-
-    return result;
+    for (int c = col; c >= 0; c = c / LETTERS - 1) {
+        *--begin = static_cast<char>('A' + c % LETTERS);
+    }
+    return std::string(begin, buffer + MAX_POSITION_LENGTH);
 }
 
 Position Position::FromString(std::string_view str) {
@@ -73,6 +74,30 @@ Position Position::FromString(std::string_view str) {
     return {row - 1, col - 1};
 }
 
+bool CellRange::operator==(const CellRange& rhs) const {
+    return first == rhs.first && last == rhs.last;
+}
+
+bool CellRange::IsValid() const {
+    return first.IsValid() && last.IsValid() && first.row <= last.row && first.col <= last.col;
+}
+
+bool CellRange::Contains(Position pos) const {
+    return pos.row >= first.row && pos.row <= last.row && pos.col >= first.col && pos.col <= last.col;
+}
+
+std::string CellRange::ToString() const {
+    if (!IsValid()) {
+        return "";
+    }
+    return first.ToString() + ':' + last.ToString();
+}
+
+CellRange CellRange::FromCorners(Position lhs, Position rhs) {
+    return {{std::min(lhs.row, rhs.row), std::min(lhs.col, rhs.col)},
+            {std::max(lhs.row, rhs.row), std::max(lhs.col, rhs.col)}};
+}
+
 bool Size::operator==(const Size rhs) const {
     return cols == rhs.cols && rows == rhs.rows;
 }
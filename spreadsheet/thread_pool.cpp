@@ -0,0 +1,157 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace {
+// Сколько блоков приходится на поток: с запасом, чтобы было что красть
+const size_t CHUNKS_PER_THREAD = 4;
+}  // namespace
+
+ThreadPool::ThreadPool(size_t threads) {
+    for(size_t i = 0; i < threads; ++i)
+    {
+        queues_.push_back(std::make_unique<Queue>());
+    }
+    for(size_t i = 0; i < threads; ++i)
+    {
+        workers_.emplace_back([this, i] {
+            WorkerLoop(i);
+        });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard guard(mutex_);
+        stopping_ = true;
+    }
+    work_available_.notify_all();
+    for(std::thread& worker : workers_)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& func) {
+    if(count == 0)
+    {
+        return;
+    }
+    if(queues_.empty() || count == 1)
+    {
+        for(size_t i = 0; i < count; ++i)
+        {
+            func(i);
+        }
+        return;
+    }
+
+    const size_t chunk_count = std::min(count, GetConcurrency() * CHUNKS_PER_THREAD);
+    const size_t chunk_size = (count + chunk_count - 1) / chunk_count;
+    {
+        std::lock_guard guard(mutex_);
+        func_ = &func;
+        error_ = nullptr;
+        // Счётчик выставляется до публикации блоков: поток, ещё не уснувший
+        // после прошлого вызова, может забрать блок сразу
+        pending_chunks_ = (count + chunk_size - 1) / chunk_size;
+        size_t chunk_index = 0;
+        for(size_t begin = 0; begin < count; begin += chunk_size, ++chunk_index)
+        {
+            Queue& queue = *queues_[chunk_index % queues_.size()];
+            std::lock_guard queue_guard(queue.mutex);
+            queue.chunks.push_back({begin, std::min(count, begin + chunk_size)});
+        }
+        ++generation_;
+    }
+    work_available_.notify_all();
+
+    // Вызывающий поток своей очереди не имеет и помогает, начиная с первой
+    while(TryRunChunk(0))
+    {
+    }
+
+    std::unique_lock lock(mutex_);
+    work_done_.wait(lock, [this] {
+        return pending_chunks_ == 0;
+    });
+    func_ = nullptr;
+    if(error_)
+    {
+        std::rethrow_exception(error_);
+    }
+}
+
+void ThreadPool::WorkerLoop(size_t index) {
+    size_t seen_generation = 0;
+    while(true)
+    {
+        {
+            std::unique_lock lock(mutex_);
+            work_available_.wait(lock, [&] {
+                return stopping_ || generation_ != seen_generation;
+            });
+            if(stopping_)
+            {
+                return;
+            }
+            seen_generation = generation_;
+        }
+        while(TryRunChunk(index))
+        {
+        }
+    }
+}
+
+bool ThreadPool::TryRunChunk(size_t home_queue) {
+    // Сначала своя очередь с конца, затем чужие с начала
+    {
+        Queue& queue = *queues_[home_queue];
+        std::unique_lock guard(queue.mutex);
+        if(!queue.chunks.empty())
+        {
+            Chunk chunk = queue.chunks.back();
+            queue.chunks.pop_back();
+            guard.unlock();
+            RunChunk(chunk);
+            return true;
+        }
+    }
+    for(size_t offset = 1; offset < queues_.size(); ++offset)
+    {
+        Queue& queue = *queues_[(home_queue + offset) % queues_.size()];
+        std::unique_lock guard(queue.mutex);
+        if(!queue.chunks.empty())
+        {
+            Chunk chunk = queue.chunks.front();
+            queue.chunks.pop_front();
+            guard.unlock();
+            RunChunk(chunk);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::RunChunk(Chunk chunk) {
+    try
+    {
+        for(size_t i = chunk.begin; i < chunk.end; ++i)
+        {
+            (*func_)(i);
+        }
+    }
+    catch(...)
+    {
+        std::lock_guard guard(mutex_);
+        if(!error_)
+        {
+            error_ = std::current_exception();
+        }
+    }
+    if(--pending_chunks_ == 0)
+    {
+        std::lock_guard guard(mutex_);
+        work_done_.notify_all();
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Пул потоков с кражей работы. У каждого потока своя очередь блоков задачи:
+// поток берёт работу с конца своей очереди, а опустевший поток крадёт её
+// с начала чужих. Вызывающий ParallelFor поток тоже участвует в работе.
+class ThreadPool {
+public:
+    // threads - число фоновых потоков; 0 означает, что всё выполняет
+    // вызывающий поток.
+    explicit ThreadPool(size_t threads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Число потоков, включая вызывающий
+    size_t GetConcurrency() const {
+        return queues_.size() + 1;
+    }
+
+    // Выполняет func(i) для всех i из [0, count) и дожидается завершения.
+    // Первое выброшенное func исключение пробрасывается вызывающему.
+    // Одновременно может выполняться только один ParallelFor.
+    void ParallelFor(size_t count, const std::function<void(size_t)>& func);
+
+private:
+    struct Chunk {
+        size_t begin;
+        size_t end;
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Chunk> chunks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+
+    std::mutex mutex_;
+    std::condition_variable work_available_;
+    std::condition_variable work_done_;
+    bool stopping_ = false;
+    size_t generation_ = 0;
+
+    const std::function<void(size_t)>* func_ = nullptr;
+    std::atomic<size_t> pending_chunks_ = 0;
+    std::exception_ptr error_;
+
+    void WorkerLoop(size_t index);
+    bool TryRunChunk(size_t home_queue);
+    void RunChunk(Chunk chunk);
+};
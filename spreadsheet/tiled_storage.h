@@ -0,0 +1,169 @@
+#pragma once
+
+#include "common.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <memory>
+
+// Плотное хранилище объектов, адресуемых позицией ячейки.
+// Таблица разбита на блоки TILE_SIZE x TILE_SIZE. Блоки выделяются по
+// требованию и адресуются двухуровневым каталогом: строка блоков -> блок.
+// Внутри блока слоты лежат построчно, поэтому обход строки таблицы идёт по
+// непрерывной памяти, а соседние ячейки почти всегда попадают в один блок.
+// Проверка корректности позиции остаётся на вызывающей стороне. Объекты
+// удаляются через Deleter, как в std::unique_ptr.
+template <typename T, typename Deleter = std::default_delete<T>>
+class TiledStorage {
+public:
+    using Pointer = std::unique_ptr<T, Deleter>;
+
+    static constexpr int TILE_SIZE = 64;
+    static constexpr int TILE_ROWS = (Position::MAX_ROWS + TILE_SIZE - 1) / TILE_SIZE;
+    static constexpr int TILE_COLS = (Position::MAX_COLS + TILE_SIZE - 1) / TILE_SIZE;
+
+    T* Get(Position pos) const {
+        const Tile* tile = FindTile(pos);
+        if(tile == nullptr)
+        {
+            return nullptr;
+        }
+        return tile->slots[SlotIndex(pos)].get();
+    }
+
+    // Помещает объект в позицию pos, заменяя прежний. Возвращает указатель на
+    // сохранённый объект.
+    T* Set(Position pos, Pointer value) {
+        Tile& tile = GetOrCreateTile(pos);
+        Pointer& slot = tile.slots[SlotIndex(pos)];
+        if(!slot)
+        {
+            ++tile.size;
+            ++size_;
+        }
+        slot = std::move(value);
+        return slot.get();
+    }
+
+    // Удаляет объект из позиции pos. Опустевший блок освобождается.
+    void Erase(Position pos) {
+        std::unique_ptr<TileRow>& tile_row = directory_[pos.row / TILE_SIZE];
+        if(!tile_row)
+        {
+            return;
+        }
+        std::unique_ptr<Tile>& tile = (*tile_row)[pos.col / TILE_SIZE];
+        if(!tile || !tile->slots[SlotIndex(pos)])
+        {
+            return;
+        }
+        tile->slots[SlotIndex(pos)].reset();
+        --size_;
+        if(--tile->size == 0)
+        {
+            tile.reset();
+        }
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+
+    // Вызывает func(col, object) для всех объектов строки row в столбцах
+    // [col_begin, col_end) по возрастанию столбца. Пустые блоки пропускаются
+    // целиком.
+    template <typename Func>
+    void ForEachInRow(int row, int col_begin, int col_end, Func func) const {
+        const std::unique_ptr<TileRow>& tile_row = directory_[row / TILE_SIZE];
+        if(!tile_row)
+        {
+            return;
+        }
+        const int row_offset = (row % TILE_SIZE) * TILE_SIZE;
+        for(int tile_col = col_begin / TILE_SIZE; tile_col * TILE_SIZE < col_end; ++tile_col)
+        {
+            const Tile* tile = (*tile_row)[tile_col].get();
+            if(tile == nullptr)
+            {
+                continue;
+            }
+            const int first = std::max(col_begin, tile_col * TILE_SIZE);
+            const int last = std::min(col_end, (tile_col + 1) * TILE_SIZE);
+            for(int col = first; col < last; ++col)
+            {
+                T* value = tile->slots[row_offset + col % TILE_SIZE].get();
+                if(value != nullptr)
+                {
+                    func(col, value);
+                }
+            }
+        }
+    }
+
+    // Вызывает func(pos, object) для всех объектов хранилища построчно
+    // внутри каждого блока.
+    template <typename Func>
+    void ForEach(Func func) const {
+        for(int tile_row = 0; tile_row < TILE_ROWS; ++tile_row)
+        {
+            const TileRow* row_of_tiles = directory_[tile_row].get();
+            if(row_of_tiles == nullptr)
+            {
+                continue;
+            }
+            for(int tile_col = 0; tile_col < TILE_COLS; ++tile_col)
+            {
+                const Tile* tile = (*row_of_tiles)[tile_col].get();
+                if(tile == nullptr)
+                {
+                    continue;
+                }
+                for(int slot = 0; slot < TILE_SIZE * TILE_SIZE; ++slot)
+                {
+                    if(T* value = tile->slots[slot].get())
+                    {
+                        func(Position{tile_row * TILE_SIZE + slot / TILE_SIZE, tile_col * TILE_SIZE + slot % TILE_SIZE}, value);
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    struct Tile {
+        std::array<Pointer, TILE_SIZE * TILE_SIZE> slots;
+        int size = 0;
+    };
+    using TileRow = std::array<std::unique_ptr<Tile>, TILE_COLS>;
+
+    std::array<std::unique_ptr<TileRow>, TILE_ROWS> directory_;
+    size_t size_ = 0;
+
+    static int SlotIndex(Position pos) {
+        return (pos.row % TILE_SIZE) * TILE_SIZE + pos.col % TILE_SIZE;
+    }
+
+    const Tile* FindTile(Position pos) const {
+        const TileRow* tile_row = directory_[pos.row / TILE_SIZE].get();
+        if(tile_row == nullptr)
+        {
+            return nullptr;
+        }
+        return (*tile_row)[pos.col / TILE_SIZE].get();
+    }
+
+    Tile& GetOrCreateTile(Position pos) {
+        std::unique_ptr<TileRow>& tile_row = directory_[pos.row / TILE_SIZE];
+        if(!tile_row)
+        {
+            tile_row = std::make_unique<TileRow>();
+        }
+        std::unique_ptr<Tile>& tile = (*tile_row)[pos.col / TILE_SIZE];
+        if(!tile)
+        {
+            tile = std::make_unique<Tile>();
+        }
+        return *tile;
+    }
+};